@@ -142,11 +142,10 @@ PLUGINAPI int SetTimeBase( int nTimeBase ) {
 // GetRecentInfo function is called by real-time quote window to retrieve the most
 // recent quote and other data see the definition of RecentInfo structure in the Plugin.h file
 ///////////////////////////////////////
-/*
 PLUGINAPI RecentInfo * GetRecentInfo(LPCTSTR pszTicker) {
 	T18_ASSERT(gQ2Ami);
 	return gQ2Ami->Ami_GetRecentInfo(pszTicker);
-}*/
+}
 
 
 ////////////////////////////////////////
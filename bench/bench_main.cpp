@@ -0,0 +1,379 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Benchmark suite of the plugin engine. It runs the unmodified Q2Ami class against mock t18qsrv client and mock
+// AmiBroker (see mock_ami.h). Scenarios:
+// - pipeline: the full path of a deal hndAllTrades() -> notification -> GetQuotesEx() from a single thread
+// - ingest: hndAllTrades() alone on a bursty stream (see deals_gen.h), rate and memory per stored deal
+// - convert: GetQuotesEx() ns per deal for every converter (mode) over deals ingested beforehand
+// - concurrent: tail latency of GetQuotesEx() while another thread ingests deals at --rate (0 - as fast as possible)
+//Results are printed and, with --json FILE, saved as JSON to track regressions over time.
+//There's no build manifest for the harness, it's built directly with a compiler, for example (from the repo root,
+// with dependencies placed as described in readme.md):
+//	g++ -std=c++17 -O2 -DNDEBUG -I../_extern/spdlog-1.3.1/include -I<boost> bench/bench_main.cpp -o q2ami_bench -pthread
+//Usage: q2ami_bench [--scenario all|pipeline|ingest|convert|concurrent] [--tickers N] [--deals N] [--packet N]
+//			[--pump-every N] [--size N] [--rate DEALS_PER_SEC] [--pump-us N] [--seed N] [--json FILE]
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <fstream>
+#include <thread>
+
+#define Q2AMI_QCLI_T ::t18::bench::mockCli
+
+#include "../stdafx.h"
+#include "mock_ami.h"
+#include "deals_gen.h"
+#include "../q2ami.h"
+#include "bench_plugin.h"
+
+namespace t18 {
+	namespace bench {
+
+		struct benchOpts {
+			::std::string scenario{ "all" };
+			unsigned tickers{ 16 };
+			unsigned deals{ 1000000 };
+			unsigned packet{ 32 };
+			unsigned pumpEvery{ 8 };
+			int size{ 200000 };
+			unsigned rate{ 1000000 };
+			unsigned pumpUs{ 1000 };
+			unsigned seed{ 1 };
+			const char* pJson{ nullptr };
+
+			bool parse(int argc, char* argv[]) {
+				for (int i = 1; i + 1 < argc; i += 2) {
+					const char*const a = argv[i];
+					const char*const pVal = argv[i + 1];
+					const long v = ::std::strtol(pVal, nullptr, 10);
+					const auto num = [a, v](const char* pName, auto& dest, const long minVal) {
+						if (::std::strcmp(a, pName)) return false;
+						dest = static_cast<::std::remove_reference_t<decltype(dest)>>(::std::max(v, minVal));
+						return true;
+					};
+					if (0 == ::std::strcmp(a, "--scenario")) scenario = pVal;
+					else if (0 == ::std::strcmp(a, "--json")) pJson = pVal;
+					else if (!num("--tickers", tickers, 1) && !num("--deals", deals, 1) && !num("--packet", packet, 1)
+						&& !num("--pump-every", pumpEvery, 1) && !num("--size", size, 1) && !num("--rate", rate, 0)
+						&& !num("--pump-us", pumpUs, 1) && !num("--seed", seed, 0)) return false;
+				}
+				//m_tickersHot is indexed by tid
+				return 1 == argc % 2 && tickers <= 256 && (scenario == "all" || scenario == "pipeline" || scenario == "ingest"
+					|| scenario == "convert" || scenario == "concurrent");
+			}
+			bool has(const char* pScenario)const { return scenario == "all" || scenario == pScenario; }
+
+			burstyDealsGen::params genParams()const noexcept {
+				burstyDealsGen::params p;
+				p.tickers = tickers;
+				p.dealsPerSec = rate ? rate : 1000000;
+				p.maxPacket = packet;
+				p.seed = seed;
+				return p;
+			}
+		};
+
+		//results as a flat JSON object of objects
+		class jsonOut {
+		protected:
+			::std::string m_s;
+			bool m_bFirstSection{ true }, m_bFirstKey{ true };
+
+		public:
+			void section(const char* pName) {
+				if (!m_bFirstSection) m_s += "\n\t},\n";
+				m_bFirstSection = false;
+				m_bFirstKey = true;
+				m_s += "\t\""; m_s += pName; m_s += "\": {";
+			}
+			void value(const char* pKey, const double v) {
+				char buf[64];
+				sprintf_s(buf, "%.6g", ::std::isfinite(v) ? v : 0.);
+				_key(pKey);
+				m_s += buf;
+			}
+			void value(const char* pKey, const char* pVal) {
+				_key(pKey);
+				m_s += '"'; m_s += pVal; m_s += '"';
+			}
+
+			::std::string str()const { return "{\n" + m_s + (m_bFirstSection ? "" : "\n\t}\n") + "}\n"; }
+
+		protected:
+			void _key(const char* pKey) {
+				m_s += m_bFirstKey ? "\n\t\t\"" : ",\n\t\t\"";
+				m_bFirstKey = false;
+				m_s += pKey; m_s += "\": ";
+			}
+		};
+
+		//resident set size of the process, 0 if unknown
+		inline size_t rssBytes() {
+			::std::ifstream f("/proc/self/statm");
+			size_t total = 0, rss = 0;
+			if (!(f >> total >> rss)) return 0;
+			return rss * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+		}
+
+		inline double nsSince(const ::std::chrono::steady_clock::time_point t0) {
+			return static_cast<double>(::std::chrono::duration_cast<::std::chrono::nanoseconds>(::std::chrono::steady_clock::now() - t0).count());
+		}
+
+		//the plugin with a loaded DB and subscribed tickers
+		class benchSession {
+		public:
+			mockAmiHost ami;
+			benchPlugin plugin;
+
+		protected:
+			bool m_bLoaded{ false };
+
+		public:
+			explicit benchSession(const int size) : ami(size) {}
+			~benchSession() {
+				if (m_bLoaded) plugin.unloadDb();
+			}
+
+			bool open(const unsigned nTickers, const char*const modes) {
+				dbTickers_t tickers;
+				for (unsigned i = 0; i < nTickers; ++i) tickers["TQBR"].emplace_back("T" + ::std::to_string(i));
+				const auto dbPath = makeDb(tickers, modes);
+				if (!plugin.loadDb(dbPath)) {
+					::std::fprintf(stderr, "Failed to load DB at %s, see the log there\n", dbPath.c_str());
+					return false;
+				}
+				m_bLoaded = true;
+				for (const auto& n : plugin.amiTickers()) ami.addTicker(n);
+
+				//connection, subscription on connect (it's issued from Ami_GetStatus()) and the answer of the server
+				plugin.hndConnectionState(true);
+				plugin.status();
+				auto*const pCli = mockCli<Q2Ami>::current();
+				if (!pCli || pCli->serve() != nTickers) {
+					::std::fprintf(stderr, "Subscription failed, see the log at %s\n", dbPath.c_str());
+					return false;
+				}
+				//the very first GetQuotesEx() call is skipped by the plugin
+				ami.requestAll(plugin);
+				ami.requestAll(plugin);
+				ami.resetStats();
+				return true;
+			}
+		};
+
+		inline bool runPipeline(const benchOpts& o, jsonOut& js) {
+			benchSession ss(o.size);
+			if (!ss.open(o.tickers, "ticks")) return false;
+
+			::std::vector<proxy::prxyTsDeal> pkt(o.packet);
+			dealsGen gen(o.tickers);
+			const auto t0 = ::std::chrono::steady_clock::now();
+			unsigned nFed = 0, nPackets = 0;
+			while (nFed < o.deals) {
+				const unsigned cnt = ::std::min(o.packet, o.deals - nFed);
+				for (unsigned i = 0; i < cnt; ++i) gen.fill(pkt[i]);
+				ss.plugin.hndAllTrades(pkt.data(), cnt);
+				nFed += cnt;
+				if (0 == (++nPackets % o.pumpEvery)) ss.ami.pump(ss.plugin);
+			}
+			ss.ami.pump(ss.plugin);
+			const auto ns = nsSince(t0);
+
+			const auto& h = ss.ami.getQuotesNs();
+			::std::printf("pipeline: %.3f ms, %.1f ns/deal, %.0f deals/s, quotes in Ami %zu\n", ns / 1e6, ns / o.deals
+				, o.deals * 1e9 / ns, ss.ami.quotesCount());
+			::std::printf("pipeline: GetQuotesEx %llu calls, %.1f ns/deal, p50 %llu ns, p99 %llu ns, max %llu ns\n"
+				, static_cast<unsigned long long>(h.count()), static_cast<double>(ss.ami.getQuotesTotalNs()) / o.deals
+				, static_cast<unsigned long long>(h.percentile(.5)), static_cast<unsigned long long>(h.percentile(.99))
+				, static_cast<unsigned long long>(h.max()));
+
+			js.section("pipeline");
+			js.value("ns_per_deal", ns / o.deals);
+			js.value("deals_per_sec", o.deals * 1e9 / ns);
+			js.value("getquotes_ns_per_deal", static_cast<double>(ss.ami.getQuotesTotalNs()) / o.deals);
+			js.value("getquotes_p50_ns", static_cast<double>(h.percentile(.5)));
+			js.value("getquotes_p99_ns", static_cast<double>(h.percentile(.99)));
+			js.value("getquotes_max_ns", static_cast<double>(h.max()));
+			return true;
+		}
+
+		struct timedPacket {
+			//microseconds of day the packet is sent at
+			::std::int64_t us;
+			::std::vector<proxy::prxyTsDeal> deals;
+		};
+
+		//pregenerates the bursty stream, so the generator isn't measured
+		inline ::std::vector<timedPacket> makePackets(const benchOpts& o, size_t& nDeals) {
+			burstyDealsGen gen(o.genParams());
+			::std::vector<timedPacket> pkts;
+			nDeals = 0;
+			while (nDeals < o.deals) {
+				pkts.emplace_back();
+				pkts.back().us = gen.next(pkts.back().deals);
+				nDeals += pkts.back().deals.size();
+			}
+			return pkts;
+		}
+
+		inline bool runIngest(const benchOpts& o, jsonOut& js) {
+			size_t nDeals;
+			const auto pkts = makePackets(o, nDeals);
+
+			benchSession ss(o.size);
+			if (!ss.open(o.tickers, "ticks")) return false;
+			const auto rss0 = rssBytes();
+
+			const auto t0 = ::std::chrono::steady_clock::now();
+			for (const auto& p : pkts) ss.plugin.hndAllTrades(p.deals.data(), p.deals.size());
+			const auto ns = nsSince(t0);
+
+			const auto rss1 = rssBytes();
+			size_t nStored, nBytes;
+			ss.plugin.rawDealsUse(nStored, nBytes);
+			const double bytesPerDeal = nStored ? static_cast<double>(nBytes) / static_cast<double>(nStored) : 0.;
+			const double rssPerDeal = nStored && rss1 > rss0 ? static_cast<double>(rss1 - rss0) / static_cast<double>(nStored) : 0.;
+
+			::std::printf("ingest: %zu deals in %zu packets, %.1f ns/deal, %.0f deals/s; %zu stored, %.1f bytes/deal reserved, %.1f bytes/deal of RSS\n"
+				, nDeals, pkts.size(), ns / static_cast<double>(nDeals), static_cast<double>(nDeals) * 1e9 / ns, nStored, bytesPerDeal, rssPerDeal);
+
+			js.section("ingest");
+			js.value("deals", static_cast<double>(nDeals));
+			js.value("packets", static_cast<double>(pkts.size()));
+			js.value("ns_per_deal", ns / static_cast<double>(nDeals));
+			js.value("deals_per_sec", static_cast<double>(nDeals) * 1e9 / ns);
+			js.value("bytes_per_deal", bytesPerDeal);
+			js.value("rss_bytes_per_deal", rssPerDeal);
+			return true;
+		}
+
+		inline bool runConvert(const benchOpts& o, jsonOut& js) {
+			size_t nDeals;
+			const auto pkts = makePackets(o, nDeals);
+
+			for (const char* pMode : { "ticks", "oflow" }) {
+				benchSession ss(o.size);
+				if (!ss.open(o.tickers, pMode)) return false;
+				for (const auto& p : pkts) ss.plugin.hndAllTrades(p.deals.data(), p.deals.size());
+
+				//all deals are converted by the first request of every ticker
+				const auto t0 = ::std::chrono::steady_clock::now();
+				ss.ami.requestAll(ss.plugin);
+				const auto ns = nsSince(t0);
+				const auto& h = ss.ami.getQuotesNs();
+
+				::std::printf("convert %s: %.1f ns/deal, %zu quotes in Ami, slowest ticker %.3f ms\n", pMode
+					, ns / static_cast<double>(nDeals), ss.ami.quotesCount(), static_cast<double>(h.max()) / 1e6);
+
+				const auto sect = ::std::string("convert_") + pMode;
+				js.section(sect.c_str());
+				js.value("ns_per_deal", ns / static_cast<double>(nDeals));
+				js.value("quotes", static_cast<double>(ss.ami.quotesCount()));
+				js.value("max_ticker_ns", static_cast<double>(h.max()));
+			}
+			return true;
+		}
+
+		inline bool runConcurrent(const benchOpts& o, jsonOut& js) {
+			size_t nDeals;
+			const auto pkts = makePackets(o, nDeals);
+
+			benchSession ss(o.size);
+			if (!ss.open(o.tickers, "ticks")) return false;
+
+			//the network thread sends packets at their time of the stream, Ami's thread requests notified tickers every pumpUs
+			::std::atomic<bool> bDone{ false };
+			double ingestNs = 0;
+			::std::thread net([&]() {
+				const auto t0 = ::std::chrono::steady_clock::now();
+				for (const auto& p : pkts) {
+					if (o.rate) ::std::this_thread::sleep_until(t0 + ::std::chrono::microseconds(p.us - pkts.front().us));
+					ss.plugin.hndAllTrades(p.deals.data(), p.deals.size());
+				}
+				ingestNs = nsSince(t0);
+				bDone.store(true, ::std::memory_order_release);
+			});
+
+			while (true) {
+				const bool bFinished = bDone.load(::std::memory_order_acquire);
+				::std::this_thread::sleep_for(::std::chrono::microseconds(o.pumpUs));
+				if (!ss.ami.pump(ss.plugin) && bFinished) break;
+			}
+			net.join();
+
+			const auto& h = ss.ami.getQuotesNs();
+			const double rate = static_cast<double>(nDeals) * 1e9 / ingestNs;
+			::std::printf("concurrent: ingest %.0f deals/s (target %u), GetQuotesEx %llu calls, p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n"
+				, rate, o.rate, static_cast<unsigned long long>(h.count()), static_cast<unsigned long long>(h.percentile(.5))
+				, static_cast<unsigned long long>(h.percentile(.99)), static_cast<unsigned long long>(h.percentile(.999))
+				, static_cast<unsigned long long>(h.max()));
+
+			js.section("concurrent");
+			js.value("target_deals_per_sec", static_cast<double>(o.rate));
+			js.value("ingest_deals_per_sec", rate);
+			js.value("getquotes_calls", static_cast<double>(h.count()));
+			js.value("getquotes_p50_ns", static_cast<double>(h.percentile(.5)));
+			js.value("getquotes_p99_ns", static_cast<double>(h.percentile(.99)));
+			js.value("getquotes_p999_ns", static_cast<double>(h.percentile(.999)));
+			js.value("getquotes_max_ns", static_cast<double>(h.max()));
+			return true;
+		}
+
+		inline int run(const benchOpts& o) {
+			jsonOut js;
+			js.section("config");
+			js.value("scenario", o.scenario.c_str());
+			js.value("tickers", o.tickers);
+			js.value("deals", o.deals);
+			js.value("packet", o.packet);
+			js.value("size", o.size);
+			js.value("rate", o.rate);
+			js.value("seed", o.seed);
+			js.value("unix_time", static_cast<double>(::std::time(nullptr)));
+
+			if (o.has("pipeline") && !runPipeline(o, js)) return 2;
+			if (o.has("ingest") && !runIngest(o, js)) return 2;
+			if (o.has("convert") && !runConvert(o, js)) return 2;
+			if (o.has("concurrent") && !runConcurrent(o, js)) return 2;
+
+			if (o.pJson) {
+				if (!_Q2Ami::periodicFileWriter::writeFile(o.pJson, js.str())) {
+					::std::fprintf(stderr, "Failed to write %s\n", o.pJson);
+					return 3;
+				}
+			}
+			return 0;
+		}
+
+	}
+}
+
+int main(int argc, char* argv[]) {
+	::t18::bench::benchOpts o;
+	if (!o.parse(argc, argv)) {
+		::std::fprintf(stderr, "Usage: %s [--scenario all|pipeline|ingest|convert|concurrent] [--tickers N<=256] [--deals N]\n"
+			"\t[--packet N] [--pump-every N] [--size N] [--rate DEALS_PER_SEC] [--pump-us N] [--seed N] [--json FILE]\n", argv[0]);
+		return 1;
+	}
+	return ::t18::bench::run(o);
+}
@@ -0,0 +1,117 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+//Helpers shared by the benchmark harness and the replay driver. Must be included after q2ami.h
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+namespace t18 {
+	namespace bench {
+
+		//Q2Ami with a few helpers to drive it as AmiBroker does
+		class benchPlugin : public Q2Ami {
+		protected:
+			::std::string m_dbPath;
+
+			PluginNotification _notification(const int reason)const noexcept {
+				PluginNotification pn;
+				::std::memset(&pn, 0, sizeof(pn));
+				pn.nStructSize = static_cast<int>(sizeof(pn));
+				pn.nReason = reason;
+				pn.pszDatabasePath = const_cast<char*>(m_dbPath.c_str());
+				pn.hMainWnd = mockAmiHost::hWnd();
+				return pn;
+			}
+
+		public:
+			bool loadDb(::std::string dbPath) {
+				m_dbPath = ::std::move(dbPath);
+				auto pn = _notification(REASON_DATABASE_LOADED);
+				return 0 != Ami_HandleNotify(&pn);
+			}
+			void unloadDb() {
+				auto pn = _notification(REASON_DATABASE_UNLOADED);
+				Ami_HandleNotify(&pn);
+			}
+
+			//what Ami does periodically. Returns the long status message
+			::std::string status() {
+				PluginStatus ps;
+				::std::memset(&ps, 0, sizeof(ps));
+				ps.nStructSize = static_cast<int>(sizeof(ps));
+				Ami_GetStatus(&ps);
+				return ps.szLongMessage;
+			}
+
+			//deals stored by the plugin and memory reserved for them
+			void rawDealsUse(size_t& nDeals, size_t& nBytes)const {
+				nDeals = nBytes = 0;
+				m_config.forEachTicker([&nDeals, &nBytes](const TickerCfgData_t& td, const ClassDescr_t&) {
+					dealsLock_guard_t lk(td.rawDealsLock);
+					nDeals += td.rawDeals.size();
+					nBytes += td.rawDeals.capacity() * sizeof(proxy::prxyTsDeal);
+				});
+			}
+
+			//"ticker@class" and Ami ticker name of every mode of every ticker
+			::std::vector<::std::pair<::std::string, ::std::string>> amiTickersOf()const {
+				::std::vector<::std::pair<::std::string, ::std::string>> r;
+				m_config.forEachTicker([&r](const TickerCfgData_t& td, const ClassDescr_t& cd) {
+					for (const auto& up : td.modesList) r.emplace_back(td.tickerName + "@" + cd.className, up->amiName);
+				});
+				return r;
+			}
+
+			::std::vector<::std::string> amiTickers()const {
+				::std::vector<::std::string> r;
+				m_config.forEachTicker([&r](const auto& td, const auto&) {
+					for (const auto& up : td.modesList) r.emplace_back(up->amiName);
+				});
+				return r;
+			}
+		};
+
+		//className -> tickers
+		typedef ::std::map<::std::string, ::std::vector<::std::string>> dbTickers_t;
+
+		//makes a DB directory with cfg.ini for the tickers with the modes. Checkpoints are disabled, so every run starts
+		// clean. extraGlobals are appended to the global section, by default the tickers are subscribed on connect
+		inline ::std::string makeDb(const dbTickers_t& tickers, const char*const modes = "ticks"
+			, const char*const extraGlobals = "subscribeOnConnect = 1\n")
+		{
+			const auto dir = ::std::filesystem::temp_directory_path() / "q2ami_bench_db";
+			::std::filesystem::remove_all(dir);
+			::std::filesystem::create_directories(dir);
+
+			::std::ofstream f(dir / _Q2Ami::Cfg::pszConfigFileName);
+			f << "serverIp = 127.0.0.1\nserverPort = 9999\ncheckpoint = 0\n" << extraGlobals << "\n";
+			for (const auto& c : tickers) {
+				f << "\n[" << c.first << "]\ntickers = ";
+				for (size_t i = 0; i < c.second.size(); ++i) f << (i ? "," : "") << c.second[i];
+				f << "\nsessionStart = -1\nsessionEnd = -1\ndefModes = " << modes << "\n";
+			}
+			return dir.string();
+		}
+
+	}
+}
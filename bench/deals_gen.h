@@ -0,0 +1,136 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+//burstyDealsGen makes a synthetic, but market-like stream of deals for benchmarks: the activity of tickers follows
+// Zipf's law (a few tickers get most of deals), the market alternates calm periods and short bursts of much higher
+// rate, prices walk by one step and volumes have a heavy tail. The stream is split into packets of deals that happened
+// during the same millisecond, as t18qsrv does with QUIK's callbacks, so bursts produce large packets.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "../q2ami_supl.h"
+
+namespace t18 {
+	namespace bench {
+
+		class burstyDealsGen {
+		public:
+			struct params {
+				unsigned tickers{ 64 };
+				//mean rate of the stream
+				double dealsPerSec{ 100000 };
+				//rate during a burst relative to the calm rate
+				double burstFactor{ 10. };
+				//fraction of time the market spends in bursts
+				double burstFraction{ .05 };
+				//mean durations of a burst and of a calm period are derived from it
+				double meanBurstMs{ 20. };
+				//Zipf's exponent of tickers activity
+				double zipfS{ 1.1 };
+				unsigned maxPacket{ 256 };
+				::std::uint64_t seed{ 1 };
+			};
+
+		protected:
+			static constexpr ::std::int64_t packetPeriodUs = 1000;
+
+			const params m_p;
+			::std::mt19937_64 m_rng;
+			::std::discrete_distribution<unsigned> m_tickerDistr;
+			::std::vector<double> m_prices;
+			const int m_y, m_m, m_d;
+
+			double m_calmRate, m_burstRate;
+			bool m_bBurst{ false };
+			//the end of the current regime and the time of the next deal, microseconds of day
+			double m_regimeEndUs, m_nextDealUs;
+			dealnum_t m_dealNum{ 1000000 };
+
+			static ::std::discrete_distribution<unsigned> _zipf(const unsigned n, const double s) {
+				::std::vector<double> w(n);
+				for (unsigned i = 0; i < n; ++i) w[i] = 1. / ::std::pow(static_cast<double>(i + 1), s);
+				return ::std::discrete_distribution<unsigned>(w.begin(), w.end());
+			}
+
+			double _exp(const double mean) {
+				return ::std::exponential_distribution<double>(1. / mean)(m_rng);
+			}
+
+			void _nextRegime() {
+				m_bBurst = !m_bBurst;
+				const double meanCalmMs = m_p.meanBurstMs * (1. - m_p.burstFraction) / m_p.burstFraction;
+				m_regimeEndUs += _exp((m_bBurst ? m_p.meanBurstMs : meanCalmMs) * 1000.);
+			}
+
+		public:
+			explicit burstyDealsGen(const params& p, const mxTimestamp today = mxTimestamp::now())
+				: m_p(p), m_rng(p.seed), m_tickerDistr(_zipf(::std::max(1u, p.tickers), p.zipfS))
+				, m_prices(::std::max(1u, p.tickers)), m_y(today.Year()), m_m(today.Month()), m_d(today.Day())
+			{
+				T18_ASSERT(p.dealsPerSec > 0 && p.burstFactor >= 1 && p.burstFraction > 0 && p.burstFraction < 1 && p.maxPacket > 0);
+				//mean rate = calm*(1-f) + calm*factor*f
+				m_calmRate = p.dealsPerSec / ((1. - p.burstFraction) + p.burstFactor * p.burstFraction);
+				m_burstRate = m_calmRate * p.burstFactor;
+				for (size_t i = 0; i < m_prices.size(); ++i) m_prices[i] = 100. + static_cast<double>(i);
+
+				m_nextDealUs = m_regimeEndUs = 10. * 3600 * 1000000;
+				_nextRegime();
+			}
+
+			//microseconds of day of the next packet
+			::std::int64_t nextPacketUs()const noexcept {
+				return (static_cast<::std::int64_t>(m_nextDealUs) / packetPeriodUs + 1) * packetPeriodUs;
+			}
+
+			//fills pkt with deals of the next millisecond with deals (at most maxPacket of them). Returns microseconds of
+			// day of the moment the packet is sent
+			::std::int64_t next(::std::vector<proxy::prxyTsDeal>& pkt) {
+				pkt.clear();
+				const auto sendUs = nextPacketUs();
+				while (m_nextDealUs < static_cast<double>(sendUs) && pkt.size() < m_p.maxPacket) {
+					const auto us = static_cast<::std::int64_t>(m_nextDealUs);
+					const unsigned t = m_tickerDistr(m_rng);
+					auto& pr = m_prices[t];
+					const auto step = ::std::uniform_int_distribution<int>(-1, 1)(m_rng);
+					pr = ::std::max(.01, pr + step * .01);
+
+					pkt.emplace_back();
+					auto& d = pkt.back();
+					const int sec = static_cast<int>(us / 1000000);
+					d.tid = static_cast<decltype(d.tid)>(t);
+					d.ts = mxTimestamp(m_y, m_m, m_d, sec / 3600, (sec / 60) % 60, sec % 60, static_cast<int>(us % 1000000));
+					d.pr = ::std::round(pr * 100.) / 100.;
+					//geometric volumes: mostly single lots, sometimes big
+					d.volLots = 1 + static_cast<decltype(d.volLots)>(::std::geometric_distribution<unsigned>(.3)(m_rng));
+					d.bLong = static_cast<decltype(d.bLong)>(step > 0 || (0 == step && (m_dealNum & 1)));
+					d.dealNum = m_dealNum++;
+
+					m_nextDealUs += _exp(1e6 / (m_bBurst ? m_burstRate : m_calmRate));
+					while (m_nextDealUs >= m_regimeEndUs) _nextRegime();
+				}
+				return sendUs;
+			}
+		};
+
+	}
+}
@@ -0,0 +1,255 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+//Simulated environment of the plugin for the benchmark harness: a mock of the t18qsrv client, that records requests
+// instead of sending them, and a mock of AmiBroker, that keeps quotes arrays of tickers and calls GetQuotesEx() for
+// tickers it was notified about, just like Ami does on WM_USER_STREAMING_UPDATE.
+//Must be included before q2ami.h:
+//	#define Q2AMI_QCLI_T ::t18::bench::mockCli
+//	#include "bench/mock_ami.h"
+//	#include "q2ami.h"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../q2ami_supl.h"
+#include "../q2ami_hist.h"
+
+namespace t18 {
+	namespace bench {
+
+		//mockCli replaces proxy::QCliWThread. Subscription requests are kept until serve() answers them from the calling
+		// thread, that plays the role of the network thread
+		template<typename HandlerT>
+		class mockCli {
+		public:
+			static constexpr size_t sAllTradesRequest_addedBufLen = 64;
+
+		protected:
+			HandlerT& m_h;
+			::std::mutex m_mtx;
+			::std::vector<::std::string> m_subscriptions;
+			typedef decltype(proxy::prxyTickerInfo::tid) tid_t;
+			tid_t m_nextTid{ 0 };
+			//"ticker@class" -> tid of served subscriptions
+			::std::unordered_map<::std::string, tid_t> m_tids;
+
+			static mockCli*& _current()noexcept {
+				static mockCli* p = nullptr;
+				return p;
+			}
+
+		public:
+			mockCli(HandlerT& h, const char*, ::std::uint16_t)noexcept : m_h(h) {
+				_current() = this;
+			}
+			~mockCli() {
+				if (this == _current()) _current() = nullptr;
+			}
+
+			//the client created by the plugin for the loaded DB
+			static mockCli* current()noexcept { return _current(); }
+
+			template<size_t N>
+			int makeAllTradesRequest(char (&req)[N], const char* pTicker, const char* pClass, const mxTimestamp /*tsSince*/) {
+				return sprintf_s(req, "%s@%s", pTicker, pClass);
+			}
+
+			template<typename CmdT, typename S>
+			void post_packet(const CmdT /*cmd*/, S&& s) {
+				::std::string body(s);
+				if (body.empty()) return;
+				::std::lock_guard<::std::mutex> lk(m_mtx);
+				m_subscriptions.emplace_back(::std::move(body));
+			}
+
+			//answers all pending subscriptions with successive ticker ids, lots of lotSize and 2 decimals prices.
+			// Returns number of subscriptions served
+			size_t serve(const proxy::volume_lots_t lotSize = 1) {
+				::std::vector<::std::string> subs;
+				{
+					::std::lock_guard<::std::mutex> lk(m_mtx);
+					subs.swap(m_subscriptions);
+				}
+				for (const auto& s : subs) {
+					const auto at = s.find('@');
+					const auto ticker = s.substr(0, at), cls = s.substr(at + 1);
+					proxy::prxyTickerInfo pti;
+					pti.reset();
+					{
+						::std::lock_guard<::std::mutex> lk(m_mtx);
+						const auto it = m_tids.emplace(s, m_nextTid).first;
+						if (it->second == m_nextTid) ++m_nextTid;
+						pti.tid = it->second;
+					}
+					pti.lotSize = lotSize;
+					pti.precision = 2;
+					pti.minStepSize = .01;
+					m_h.hndSubscribeAllTradesResult(&pti, ticker.c_str(), cls.c_str());
+				}
+				return subs.size();
+			}
+
+			//tid of the served "ticker@class" or -1. Safe to call from any thread
+			int tidOf(const ::std::string& name) {
+				::std::lock_guard<::std::mutex> lk(m_mtx);
+				const auto it = m_tids.find(name);
+				return it == m_tids.end() ? -1 : static_cast<int>(it->second);
+			}
+		};
+
+		//synthetic deal stream: tickers take turns, timestamps grow by stepUs per deal starting at 10:00 of today
+		class dealsGen {
+		protected:
+			const unsigned m_nTickers;
+			const ::std::int64_t m_stepUs;
+			const int m_y, m_m, m_d;
+			::std::int64_t m_usOfDay{ 10ll * 3600 * 1000000 };
+			dealnum_t m_dealNum{ 1000000 };
+			unsigned m_next{ 0 };
+
+		public:
+			explicit dealsGen(const unsigned nTickers, const ::std::int64_t stepUs = 1000, const mxTimestamp today = mxTimestamp::now())noexcept
+				: m_nTickers(nTickers), m_stepUs(stepUs), m_y(today.Year()), m_m(today.Month()), m_d(today.Day()) {}
+
+			//microseconds since midnight of the next deal
+			::std::int64_t nextUsOfDay()const noexcept { return m_usOfDay; }
+
+			void fill(proxy::prxyTsDeal& d)noexcept {
+				const auto us = m_usOfDay;
+				m_usOfDay += m_stepUs;
+				const int sec = static_cast<int>(us / 1000000);
+				d.tid = static_cast<decltype(d.tid)>(m_next);
+				d.ts = mxTimestamp(m_y, m_m, m_d, sec / 3600, (sec / 60) % 60, sec % 60, static_cast<int>(us % 1000000));
+				d.pr = 100. + static_cast<double>(m_dealNum % 200) * .01;
+				d.volLots = 1 + static_cast<decltype(d.volLots)>(m_dealNum % 10);
+				d.bLong = static_cast<decltype(d.bLong)>(m_dealNum & 1);
+				d.dealNum = m_dealNum++;
+				if (++m_next >= m_nTickers) m_next = 0;
+			}
+		};
+
+		//mockAmiHost keeps a quotes array of nSize elements for every Ami ticker
+		class mockAmiHost {
+		public:
+			struct amiTicker {
+				::std::vector<Quotation> quotes;
+				int nLastValid{ -1 };
+			};
+
+		protected:
+			const int m_nSize;
+			::std::unordered_map<::std::string, amiTicker> m_tickers;
+
+			::std::mutex m_mtx;
+			::std::unordered_set<::std::string> m_notified;
+
+			_Q2Ami::latencyHist m_gqNs;
+			::std::uint64_t m_gqTotalNs{ 0 };
+
+			static mockAmiHost*& _current()noexcept {
+				static mockAmiHost* p = nullptr;
+				return p;
+			}
+			static void _onPostMessage(HWND, UINT msg, WPARAM wp, LPARAM) {
+				const auto p = _current();
+				if (!p || WM_USER_STREAMING_UPDATE != msg || !wp) return;
+				::std::lock_guard<::std::mutex> lk(p->m_mtx);
+				p->m_notified.emplace(reinterpret_cast<const char*>(wp));
+			}
+
+		public:
+			explicit mockAmiHost(const int nSize) : m_nSize(nSize) {
+				_current() = this;
+				q2ami_platform::postMessageSink() = &_onPostMessage;
+			}
+			~mockAmiHost() {
+				q2ami_platform::postMessageSink() = nullptr;
+				_current() = nullptr;
+			}
+
+			//a value to pass as the main window of Ami
+			static HWND hWnd()noexcept {
+				static int dummy;
+				return &dummy;
+			}
+
+			void addTicker(const ::std::string& amiName) {
+				auto& t = m_tickers[amiName];
+				t.quotes.resize(static_cast<size_t>(m_nSize));
+				t.nLastValid = -1;
+			}
+			const ::std::unordered_map<::std::string, amiTicker>& tickers()const noexcept { return m_tickers; }
+
+			//duration of GetQuotesEx() calls in nanoseconds
+			const _Q2Ami::latencyHist& getQuotesNs()const noexcept { return m_gqNs; }
+			::std::uint64_t getQuotesTotalNs()const noexcept { return m_gqTotalNs; }
+			void resetStats()noexcept {
+				m_gqNs.reset();
+				m_gqTotalNs = 0;
+			}
+			//quotes in arrays of all tickers
+			size_t quotesCount()const noexcept {
+				size_t n = 0;
+				for (const auto& e : m_tickers) n += static_cast<size_t>(e.second.nLastValid + 1);
+				return n;
+			}
+
+			template<typename PluginT>
+			int getQuotes(PluginT& plugin, const ::std::string& amiName) {
+				auto& t = m_tickers.at(amiName);
+				const auto t0 = ::std::chrono::steady_clock::now();
+				const int r = plugin.Ami_GetQuotesEx(amiName.c_str(), 0, t.nLastValid, m_nSize, t.quotes.data(), nullptr);
+				const auto ns = static_cast<::std::uint64_t>(::std::chrono::duration_cast<::std::chrono::nanoseconds>(
+					::std::chrono::steady_clock::now() - t0).count());
+				m_gqNs.record(ns);
+				m_gqTotalNs += ns;
+				t.nLastValid = r - 1;
+				return r;
+			}
+
+			//requests quotes of every ticker
+			template<typename PluginT>
+			void requestAll(PluginT& plugin) {
+				for (const auto& e : m_tickers) getQuotes(plugin, e.first);
+			}
+
+			//requests quotes of every ticker notified since the previous call. Returns number of tickers requested
+			template<typename PluginT>
+			size_t pump(PluginT& plugin) {
+				::std::unordered_set<::std::string> n;
+				{
+					::std::lock_guard<::std::mutex> lk(m_mtx);
+					n.swap(m_notified);
+				}
+				for (const auto& name : n) {
+					if (m_tickers.count(name)) getQuotes(plugin, name);
+				}
+				return n.size();
+			}
+		};
+
+	}
+}
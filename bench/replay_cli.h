@@ -0,0 +1,398 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+//Local stand-in of t18qsrv for load tests. replayCli replaces proxy::QCliWThread (define Q2AMI_QCLI_T as
+// ::t18::bench::replayCli before q2ami.h is included) and, just like the real client, calls plugin's handlers from its
+// own "network" thread. It answers queryTickerInfo and subscribeAllTrades requests for tickers of a replaySource and
+// streams deals of subscribed tickers in real time, N times faster or as fast as possible, optionally injecting QUIK
+// disconnects.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
+#include "mock_ami.h"
+#include "../q2ami_capture.h"
+
+namespace t18 {
+	namespace bench {
+
+		//replaySource provides the tickers list and packets of deals with the time they should be delivered at
+		class replaySource {
+		public:
+			struct ticker {
+				::std::string tickerName, className;
+				proxy::prxyTickerInfo pti;
+			};
+			struct packet {
+				//time of the packet in the source's timeline, microseconds
+				::std::int64_t us;
+				//deals with tid set to the index of the ticker in tickers()
+				::std::vector<proxy::prxyTsDeal> deals;
+				//connection records of a capture file have no deals
+				bool bConnectionRec{ false }, bConnected{ false };
+			};
+
+			virtual ~replaySource() {}
+			virtual const ::std::vector<ticker>& tickers()const noexcept = 0;
+			//returns false at the end
+			virtual bool next(packet& p) = 0;
+
+			static ::std::int64_t usOfDay(const mxTimestamp& t)noexcept {
+				return ((static_cast<::std::int64_t>(t.Hour()) * 60 + t.Minute()) * 60 + t.Second()) * 1000000 + t.Microsecond();
+			}
+		};
+
+		//replays a capture file written by the plugin with the `capture` option (see q2ami_capture.h). Packets are
+		// delivered with the same intervals as they were received
+		class captureSource : public replaySource {
+		protected:
+			::std::vector<ticker> m_tickers;
+			//server's tid -> index in m_tickers
+			::std::unordered_map<::std::uint32_t, ::std::uint32_t> m_tidMap;
+			::std::unique_ptr<_Q2Ami::captureReader> m_pReader;
+			_Q2Ami::captureReader::record m_rec;
+			::std::int64_t m_dayOffsetUs{ 0 }, m_lastUs{ -1 };
+
+		public:
+			explicit captureSource(const char* pPath) : m_pReader(::std::make_unique<_Q2Ami::captureReader>(pPath)) {
+				//the first pass collects tickers
+				_Q2Ami::captureReader r(pPath);
+				while (r.next(m_rec)) {
+					if (_Q2Ami::capture::recSubscribed != m_rec.hdr.type) continue;
+					bool bOk;
+					ticker t;
+					t.pti.reset();
+					if (!m_rec.subscribed(bOk, t.pti, t.tickerName, t.className) || !bOk) continue;
+					if (m_tidMap.emplace(static_cast<::std::uint32_t>(t.pti.tid), static_cast<::std::uint32_t>(m_tickers.size())).second) {
+						m_tickers.emplace_back(::std::move(t));
+					}
+				}
+			}
+
+			bool isValid()const noexcept { return m_pReader->isValid() && !m_tickers.empty(); }
+
+			const ::std::vector<ticker>& tickers()const noexcept override { return m_tickers; }
+
+			bool next(packet& p)override {
+				while (m_pReader->next(m_rec)) {
+					//a capture file may contain records after midnight of the next day
+					auto us = usOfDay(m_rec.rcvTs()) + m_dayOffsetUs;
+					if (us < m_lastUs) {
+						m_dayOffsetUs += 24ll * 3600 * 1000000;
+						us += 24ll * 3600 * 1000000;
+					}
+					m_lastUs = us;
+					p.us = us;
+					p.deals.clear();
+					p.bConnectionRec = false;
+
+					if (_Q2Ami::capture::recConnection == m_rec.hdr.type) {
+						p.bConnectionRec = true;
+						p.bConnected = m_rec.connected();
+						return true;
+					}
+					if (_Q2Ami::capture::recDeals != m_rec.hdr.type) continue;
+
+					const auto pD = m_rec.deals();
+					for (size_t i = 0, n = m_rec.dealsCount(); i < n; ++i) {
+						const auto it = m_tidMap.find(static_cast<::std::uint32_t>(pD[i].tid));
+						if (it == m_tidMap.end()) continue;
+						p.deals.push_back(pD[i]);
+						p.deals.back().tid = static_cast<decltype(pD[i].tid)>(it->second);
+					}
+					if (!p.deals.empty()) return true;
+				}
+				return false;
+			}
+		};
+
+		//endless or limited synthetic stream of deals of nTickers tickers of TQBR class at the given total rate
+		class syntheticSource : public replaySource {
+		protected:
+			::std::vector<ticker> m_tickers;
+			dealsGen m_gen;
+			const unsigned m_packet;
+			unsigned m_left;
+
+		public:
+			syntheticSource(const unsigned nTickers, const unsigned dealsPerSec, const unsigned packet, const unsigned totalDeals)
+				: m_gen(nTickers, ::std::max(::std::int64_t(1), static_cast<::std::int64_t>(1000000 / ::std::max(1u, dealsPerSec))))
+				, m_packet(packet), m_left(totalDeals)
+			{
+				for (unsigned i = 0; i < nTickers; ++i) {
+					ticker t;
+					t.tickerName = "T" + ::std::to_string(i);
+					t.className = "TQBR";
+					t.pti.reset();
+					t.pti.tid = static_cast<decltype(t.pti.tid)>(i);
+					t.pti.lotSize = 1;
+					t.pti.precision = 2;
+					t.pti.minStepSize = .01;
+					m_tickers.emplace_back(::std::move(t));
+				}
+			}
+
+			const ::std::vector<ticker>& tickers()const noexcept override { return m_tickers; }
+
+			bool next(packet& p)override {
+				if (!m_left) return false;
+				const unsigned cnt = ::std::min(m_packet, m_left);
+				m_left -= cnt;
+				p.bConnectionRec = false;
+				p.deals.resize(cnt);
+				//a packet is sent when its last deal happens
+				for (auto& d : p.deals) {
+					p.us = m_gen.nextUsOfDay();
+					m_gen.fill(d);
+				}
+				return true;
+			}
+		};
+
+		struct replaySettings {
+			replaySource* pSource{ nullptr };
+			//1 - real time, N - N times faster, 0 - as fast as possible
+			double speed{ 1. };
+			//every disconnectEveryMs of the source timeline QUIK loses connection to the broker for disconnectForMs of
+			// wall time. Deals of the outage are delivered as a burst after the reconnection. 0 disables
+			unsigned disconnectEveryMs{ 0 }, disconnectForMs{ 0 };
+		};
+
+		template<typename HandlerT>
+		class replayCli {
+		public:
+			static constexpr size_t sAllTradesRequest_addedBufLen = 64;
+
+		protected:
+			HandlerT& m_h;
+			const replaySettings m_set;
+
+			::std::mutex m_mtx;
+			::std::condition_variable m_cv;
+			::std::vector<::std::pair<bool, ::std::string>> m_requests;//bQuery, body
+			bool m_bStop{ false }, m_bFeed{ false };
+
+			//source ticker index -> subscribed
+			::std::vector<char> m_subscribed;
+			::std::atomic<size_t> m_nSubscribed{ 0 };
+			::std::atomic<::std::uint64_t> m_dealsSent{ 0 }, m_packetsSent{ 0 }, m_disconnects{ 0 };
+			::std::atomic<bool> m_bFinished{ false };
+
+			::std::thread m_thread;
+
+			static replaySettings& _settings()noexcept {
+				static replaySettings s;
+				return s;
+			}
+			static replayCli*& _current()noexcept {
+				static replayCli* p = nullptr;
+				return p;
+			}
+
+		public:
+			//must be set before the plugin loads a DB
+			static replaySettings& settings()noexcept { return _settings(); }
+			static replayCli* current()noexcept { return _current(); }
+
+			replayCli(HandlerT& h, const char*, ::std::uint16_t) : m_h(h), m_set(_settings()) {
+				T18_ASSERT(m_set.pSource);
+				m_subscribed.assign(m_set.pSource->tickers().size(), 0);
+				_current() = this;
+				m_thread = ::std::thread([this]() { _run(); });
+			}
+			~replayCli() {
+				{
+					::std::lock_guard<::std::mutex> lk(m_mtx);
+					m_bStop = true;
+				}
+				m_cv.notify_one();
+				m_thread.join();
+				if (this == _current()) _current() = nullptr;
+			}
+
+			template<size_t N>
+			int makeAllTradesRequest(char(&req)[N], const char* pTicker, const char* pClass, const mxTimestamp /*tsSince*/) {
+				return sprintf_s(req, "%s@%s", pTicker, pClass);
+			}
+
+			template<typename CmdT, typename S>
+			void post_packet(const CmdT cmd, S&& s) {
+				{
+					::std::lock_guard<::std::mutex> lk(m_mtx);
+					m_requests.emplace_back(proxy::ProtoCli2Srv::queryTickerInfo == cmd, ::std::string(s));
+				}
+				m_cv.notify_one();
+			}
+
+			//starts streaming deals of subscribed tickers
+			void startFeed() {
+				{
+					::std::lock_guard<::std::mutex> lk(m_mtx);
+					m_bFeed = true;
+				}
+				m_cv.notify_one();
+			}
+
+			size_t subscribedCount()const noexcept { return m_nSubscribed.load(::std::memory_order_relaxed); }
+			::std::uint64_t dealsSent()const noexcept { return m_dealsSent.load(::std::memory_order_relaxed); }
+			::std::uint64_t packetsSent()const noexcept { return m_packetsSent.load(::std::memory_order_relaxed); }
+			::std::uint64_t disconnects()const noexcept { return m_disconnects.load(::std::memory_order_relaxed); }
+			//the source is exhausted
+			bool finished()const noexcept { return m_bFinished.load(::std::memory_order_acquire); }
+
+		protected:
+			int _find(const ::std::string& t, const ::std::string& c)const noexcept {
+				const auto& v = m_set.pSource->tickers();
+				for (size_t i = 0; i < v.size(); ++i) {
+					if (v[i].tickerName == t && v[i].className == c) return static_cast<int>(i);
+				}
+				return -1;
+			}
+
+			const proxy::prxyTickerInfo* _pti(const int idx, proxy::prxyTickerInfo& pti)const noexcept {
+				if (idx < 0) return nullptr;
+				pti = m_set.pSource->tickers()[static_cast<size_t>(idx)].pti;
+				//the plugin indexes its tables by tid, so tids are made dense
+				pti.tid = static_cast<decltype(pti.tid)>(idx);
+				return &pti;
+			}
+
+			//network thread only
+			void _serve(const bool bQuery, const ::std::string& body) {
+				proxy::prxyTickerInfo pti;
+				if (bQuery) {
+					//(<class-code>(<ticker-1>(?:,<ticker-i>)*))+
+					size_t pos = 0;
+					while (pos < body.length()) {
+						const auto ob = body.find('(', pos), cb = body.find(')', pos);
+						if (ob == ::std::string::npos || cb == ::std::string::npos || cb < ob) break;
+						const auto cls = body.substr(pos, ob - pos);
+						size_t b = ob + 1;
+						while (b < cb) {
+							auto e = body.find(',', b);
+							if (e == ::std::string::npos || e > cb) e = cb;
+							const auto t = body.substr(b, e - b);
+							m_h.hndQueryTickerInfoResult(_pti(_find(t, cls), pti), t.c_str(), cls.c_str());
+							b = e + 1;
+						}
+						pos = cb + 1;
+					}
+					return;
+				}
+
+				const auto at = body.find('@');
+				if (at == ::std::string::npos) return;
+				const auto t = body.substr(0, at), cls = body.substr(at + 1);
+				const int idx = _find(t, cls);
+				if (idx >= 0 && !m_subscribed[static_cast<size_t>(idx)]) {
+					m_subscribed[static_cast<size_t>(idx)] = 1;
+					m_nSubscribed.fetch_add(1, ::std::memory_order_relaxed);
+				}
+				m_h.hndSubscribeAllTradesResult(_pti(idx, pti), t.c_str(), cls.c_str());
+			}
+
+			//serves pending requests, returns false if the thread must stop
+			bool _serveRequests(::std::unique_lock<::std::mutex>& lk) {
+				while (!m_requests.empty()) {
+					decltype(m_requests) r;
+					r.swap(m_requests);
+					lk.unlock();
+					for (const auto& e : r) _serve(e.first, e.second);
+					lk.lock();
+				}
+				return !m_bStop;
+			}
+
+			//waits until the wall clock time t serving requests meanwhile. Returns false if the thread must stop
+			bool _waitUntil(const ::std::chrono::steady_clock::time_point t) {
+				::std::unique_lock<::std::mutex> lk(m_mtx);
+				while (true) {
+					if (!_serveRequests(lk)) return false;
+					if (::std::chrono::steady_clock::now() >= t) return true;
+					m_cv.wait_until(lk, t, [this]() { return m_bStop || !m_requests.empty(); });
+				}
+			}
+
+			void _run() {
+				m_h.hndConnectionState(true);
+				{
+					::std::unique_lock<::std::mutex> lk(m_mtx);
+					while (!m_bFeed) {
+						if (!_serveRequests(lk)) return;
+						m_cv.wait(lk, [this]() { return m_bStop || m_bFeed || !m_requests.empty(); });
+					}
+				}
+
+				auto& src = *m_set.pSource;
+				replaySource::packet p;
+				bool bFirst = true;
+				::std::int64_t srcStartUs = 0, nextDisconnectUs = 0;
+				const auto wallStart = ::std::chrono::steady_clock::now();
+				while (src.next(p)) {
+					if (bFirst) {
+						bFirst = false;
+						srcStartUs = p.us;
+						nextDisconnectUs = srcStartUs + static_cast<::std::int64_t>(m_set.disconnectEveryMs) * 1000;
+					}
+
+					if (m_set.disconnectEveryMs && p.us >= nextDisconnectUs) {
+						nextDisconnectUs += static_cast<::std::int64_t>(m_set.disconnectEveryMs) * 1000;
+						m_disconnects.fetch_add(1, ::std::memory_order_relaxed);
+						m_h.hndQuikConnectionState(false);
+						if (!_waitUntil(::std::chrono::steady_clock::now() + ::std::chrono::milliseconds(m_set.disconnectForMs))) return;
+						m_h.hndQuikConnectionState(true);
+					}
+
+					if (m_set.speed > 0) {
+						const auto dueNs = static_cast<::std::int64_t>(static_cast<double>(p.us - srcStartUs) * 1000. / m_set.speed);
+						if (!_waitUntil(wallStart + ::std::chrono::nanoseconds(dueNs))) return;
+					} else {
+						::std::unique_lock<::std::mutex> lk(m_mtx);
+						if (!_serveRequests(lk)) return;
+					}
+
+					if (p.bConnectionRec) {
+						m_h.hndConnectionState(p.bConnected);
+						continue;
+					}
+					//the server sends deals of subscribed tickers only
+					p.deals.erase(::std::remove_if(p.deals.begin(), p.deals.end(), [this](const proxy::prxyTsDeal& d) {
+						return !m_subscribed[static_cast<size_t>(d.tid)];
+					}), p.deals.end());
+					if (p.deals.empty()) continue;
+
+					m_h.hndAllTrades(p.deals.data(), p.deals.size());
+					m_packetsSent.fetch_add(1, ::std::memory_order_relaxed);
+					m_dealsSent.fetch_add(p.deals.size(), ::std::memory_order_relaxed);
+				}
+				m_bFinished.store(true, ::std::memory_order_release);
+
+				//serving requests until the plugin destroys the client
+				::std::unique_lock<::std::mutex> lk(m_mtx);
+				while (_serveRequests(lk)) {
+					m_cv.wait(lk, [this]() { return m_bStop || !m_requests.empty(); });
+				}
+			}
+		};
+
+	}
+}
@@ -0,0 +1,179 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Load test driver: runs the unmodified Q2Ami class against a local stand-in of t18qsrv (see replay_cli.h) that replays
+// a capture file or a synthetic deals stream from its own network thread, while the main thread plays AmiBroker's UI
+// thread: it requests quotes of notified tickers every --pump-ms and polls the plugin status.
+//Built like the benchmark harness (see bench_main.cpp), for example:
+//	g++ -std=c++17 -O2 -DNDEBUG -I../_extern/spdlog-1.3.1/include -I<boost> bench/replay_main.cpp -o q2ami_replay -pthread
+//Usage: q2ami_replay (--capture FILE | [--tickers N] [--rate DEALS_PER_SEC] [--deals N] [--packet N])
+//			[--speed X] [--disconnect-every MS --disconnect-for MS] [--size N] [--pump-ms MS] [--status-ms MS]
+//--speed 1 replays in real time (default), N - N times faster, 0 - as fast as possible.
+
+#include <cstdlib>
+#include <cstring>
+
+#define Q2AMI_QCLI_T ::t18::bench::replayCli
+
+#include "../stdafx.h"
+#include "replay_cli.h"
+#include "../q2ami.h"
+#include "bench_plugin.h"
+
+namespace t18 {
+	namespace bench {
+
+		struct replayOpts {
+			const char* pCapture{ nullptr };
+			unsigned tickers{ 16 };
+			unsigned rate{ 10000 };
+			unsigned deals{ 1000000 };
+			unsigned packet{ 32 };
+			double speed{ 1. };
+			unsigned disconnectEveryMs{ 0 }, disconnectForMs{ 0 };
+			int size{ 200000 };
+			unsigned pumpMs{ 50 };
+			unsigned statusMs{ 1000 };
+
+			bool parse(int argc, char* argv[]) {
+				for (int i = 1; i + 1 < argc; i += 2) {
+					const char*const a = argv[i];
+					const char*const pVal = argv[i + 1];
+					const long v = ::std::strtol(pVal, nullptr, 10);
+					//positive integer option
+					const auto posInt = [a, v](const char* pName, auto& dest) {
+						if (::std::strcmp(a, pName)) return false;
+						dest = static_cast<::std::remove_reference_t<decltype(dest)>>(v > 0 ? v : 0);
+						return true;
+					};
+					if (0 == ::std::strcmp(a, "--capture")) pCapture = pVal;
+					else if (0 == ::std::strcmp(a, "--speed")) speed = ::std::strtod(pVal, nullptr);
+					else if (0 == ::std::strcmp(a, "--disconnect-every")) disconnectEveryMs = static_cast<unsigned>(::std::max(0l, v));
+					else if (0 == ::std::strcmp(a, "--disconnect-for")) disconnectForMs = static_cast<unsigned>(::std::max(0l, v));
+					else if (!posInt("--tickers", tickers) && !posInt("--rate", rate) && !posInt("--deals", deals)
+						&& !posInt("--packet", packet) && !posInt("--size", size) && !posInt("--pump-ms", pumpMs)
+						&& !posInt("--status-ms", statusMs)) return false;
+				}
+				return 1 == argc % 2 && speed >= 0 && tickers > 0 && tickers <= 256 && rate > 0 && deals > 0 && packet > 0
+					&& size > 0 && pumpMs > 0 && statusMs > 0;
+			}
+		};
+
+		inline int run(const replayOpts& o) {
+			typedef replayCli<Q2Ami> cli_t;
+			typedef ::std::chrono::steady_clock clock_t;
+
+			::std::unique_ptr<replaySource> pSrc;
+			if (o.pCapture) {
+				auto p = ::std::make_unique<captureSource>(o.pCapture);
+				if (!p->isValid()) {
+					::std::fprintf(stderr, "%s isn't a capture file of this build or has no subscribed tickers\n", o.pCapture);
+					return 2;
+				}
+				pSrc = ::std::move(p);
+			} else pSrc = ::std::make_unique<syntheticSource>(o.tickers, o.rate, o.packet, o.deals);
+			const auto& srcTickers = pSrc->tickers();
+			if (srcTickers.size() > 256) {
+				::std::fprintf(stderr, "Too many tickers (%zu) in the source, the plugin supports up to 256\n", srcTickers.size());
+				return 2;
+			}
+
+			auto& set = cli_t::settings();
+			set.pSource = pSrc.get();
+			set.speed = o.speed;
+			set.disconnectEveryMs = o.disconnectEveryMs;
+			set.disconnectForMs = o.disconnectForMs;
+
+			dbTickers_t tickers;
+			for (const auto& t : srcTickers) tickers[t.className].emplace_back(t.tickerName);
+			const auto dbPath = makeDb(tickers);
+
+			mockAmiHost ami(o.size);
+			benchPlugin plugin;
+			if (!plugin.loadDb(dbPath)) {
+				::std::fprintf(stderr, "Failed to load DB at %s, see the log there\n", dbPath.c_str());
+				return 3;
+			}
+			for (const auto& n : plugin.amiTickers()) ami.addTicker(n);
+
+			//the client connects from its thread and the plugin subscribes all tickers from Ami_GetStatus()
+			cli_t* pCli = nullptr;
+			const auto subsDeadline = clock_t::now() + ::std::chrono::seconds(10);
+			while (true) {
+				plugin.status();
+				pCli = cli_t::current();
+				if (pCli && pCli->subscribedCount() >= srcTickers.size()) break;
+				if (clock_t::now() > subsDeadline) {
+					::std::fprintf(stderr, "Subscription timeout, %zu of %zu tickers subscribed. See the log at %s\n"
+						, pCli ? pCli->subscribedCount() : 0, srcTickers.size(), dbPath.c_str());
+					return 4;
+				}
+				::std::this_thread::sleep_for(::std::chrono::milliseconds(10));
+			}
+			//the very first GetQuotesEx() call is skipped by the plugin
+			ami.requestAll(plugin);
+			ami.requestAll(plugin);
+
+			const auto t0 = clock_t::now();
+			auto nextStatus = t0 + ::std::chrono::milliseconds(o.statusMs);
+			pCli->startFeed();
+			while (true) {
+				const bool bFinished = pCli->finished();
+				::std::this_thread::sleep_for(::std::chrono::milliseconds(o.pumpMs));
+				const auto nPumped = ami.pump(plugin);
+
+				const auto now = clock_t::now();
+				if (now >= nextStatus) {
+					nextStatus += ::std::chrono::milliseconds(o.statusMs);
+					const auto st = plugin.status();
+					::std::printf("%8.1fs deals sent %llu. %s\n", ::std::chrono::duration<double>(now - t0).count()
+						, static_cast<unsigned long long>(pCli->dealsSent()), st.c_str());
+				}
+				//everything sent was delivered to Ami
+				if (bFinished && !nPumped) break;
+			}
+			const auto sec = ::std::chrono::duration<double>(clock_t::now() - t0).count();
+
+			size_t nQuotes = 0;
+			for (const auto& e : ami.tickers()) nQuotes += static_cast<size_t>(e.second.nLastValid + 1);
+			const auto nDeals = pCli->dealsSent();
+			const auto& h = ami.getQuotesNs();
+			::std::printf("replayed %llu deals in %llu packets of %zu tickers in %.3fs (%.0f deals/s), %llu disconnects, quotes in Ami %zu\n"
+				, static_cast<unsigned long long>(nDeals), static_cast<unsigned long long>(pCli->packetsSent()), srcTickers.size()
+				, sec, static_cast<double>(nDeals) / sec, static_cast<unsigned long long>(pCli->disconnects()), nQuotes);
+			::std::printf("GetQuotesEx: %llu calls, p50 %llu ns, p99 %llu ns, max %llu ns\n"
+				, static_cast<unsigned long long>(h.count()), static_cast<unsigned long long>(h.percentile(.5))
+				, static_cast<unsigned long long>(h.percentile(.99)), static_cast<unsigned long long>(h.max()));
+
+			plugin.unloadDb();
+			return 0;
+		}
+
+	}
+}
+
+int main(int argc, char* argv[]) {
+	::t18::bench::replayOpts o;
+	if (!o.parse(argc, argv)) {
+		::std::fprintf(stderr, "Usage: %s (--capture FILE | [--tickers N<=256] [--rate DEALS_PER_SEC] [--deals N] [--packet N])\n"
+			"\t[--speed X] [--disconnect-every MS --disconnect-for MS] [--size N] [--pump-ms MS] [--status-ms MS]\n", argv[0]);
+		return 1;
+	}
+	return ::t18::bench::run(o);
+}
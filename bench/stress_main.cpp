@@ -0,0 +1,320 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Concurrency stress test: the network thread feeds a bursty deals stream and answers subscriptions, while several
+// threads call GetQuotesEx() for random tickers like parallel AmiBroker windows do, and another one polls the status and
+// reads every ticker with GetRecentInfo() like the real-time quote window does.
+//Tickers aren't subscribed on connect, so subscriptions are issued by GetQuotesEx() and answered by the network thread
+// during the run. After every call the caller checks that quotes of its array have strictly increasing timestamps (as
+// the T18_DEBUG block of Q2Ami::_deliverStage() does), at the end every ticker is drained and its last quote is checked
+// against the last deal sent. Any violation makes the exit code non zero.
+//By default callers of the same ticker share its quotes array (serialized by a lock, as Ami does for a symbol),
+// --private-arrays gives every thread its own arrays, like independent analysis windows.
+//Meant to be built with ThreadSanitizer and T18_DEBUG to catch data races and trigger the plugin's own checks:
+//	g++ -std=c++17 -O1 -g -fsanitize=thread -DT18_DEBUG -I../_extern/spdlog-1.3.1/include -I<boost> bench/stress_main.cpp
+//		-o q2ami_stress -pthread
+//Usage: q2ami_stress [--threads N] [--seconds N] [--tickers N] [--rate DEALS_PER_SEC] [--packet N] [--size N]
+//			[--private-arrays 1] [--seed N]
+
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#define Q2AMI_QCLI_T ::t18::bench::mockCli
+
+#include "../stdafx.h"
+#include "mock_ami.h"
+#include "deals_gen.h"
+#include "../q2ami.h"
+#include "bench_plugin.h"
+
+namespace t18 {
+	namespace bench {
+
+		struct stressOpts {
+			unsigned threads{ 4 };
+			unsigned seconds{ 10 };
+			unsigned tickers{ 32 };
+			unsigned rate{ 200000 };
+			unsigned packet{ 64 };
+			int size{ 5000 };
+			unsigned privateArrays{ 0 };
+			unsigned seed{ 1 };
+
+			bool parse(int argc, char* argv[]) {
+				for (int i = 1; i + 1 < argc; i += 2) {
+					const char*const a = argv[i];
+					const long v = ::std::strtol(argv[i + 1], nullptr, 10);
+					const auto num = [a, v](const char* pName, auto& dest, const long minVal) {
+						if (::std::strcmp(a, pName)) return false;
+						dest = static_cast<::std::remove_reference_t<decltype(dest)>>(::std::max(v, minVal));
+						return true;
+					};
+					if (!num("--threads", threads, 1) && !num("--seconds", seconds, 1) && !num("--tickers", tickers, 1)
+						&& !num("--rate", rate, 1) && !num("--packet", packet, 1) && !num("--size", size, 16)
+						&& !num("--private-arrays", privateArrays, 0) && !num("--seed", seed, 0)) return false;
+				}
+				//m_tickersHot is indexed by tid
+				return 1 == argc % 2 && tickers <= 256;
+			}
+		};
+
+		//Ami's side: quotes arrays of tickers and notifications
+		class stressHost {
+		public:
+			struct quotesArray {
+				::std::mutex mtx;
+				::std::vector<Quotation> quotes;
+				int nLastValid{ -1 };
+			};
+			struct ticker {
+				::std::string amiName;
+				//notified since the last request
+				::std::atomic<bool> bDirty{ false };
+				//the shared array and an array of every thread for --private-arrays
+				::std::vector<::std::unique_ptr<quotesArray>> arrays;
+			};
+
+		protected:
+			const int m_nSize;
+			const bool m_bPrivate;
+			::std::vector<::std::unique_ptr<ticker>> m_tickers;
+			::std::unordered_map<::std::string, ticker*> m_byName;
+
+			::std::atomic<::std::uint64_t> m_calls{ 0 }, m_violations{ 0 };
+
+			static stressHost*& _current()noexcept {
+				static stressHost* p = nullptr;
+				return p;
+			}
+			static void _onPostMessage(HWND, UINT msg, WPARAM wp, LPARAM) {
+				const auto p = _current();
+				if (!p || WM_USER_STREAMING_UPDATE != msg || !wp) return;
+				//the map isn't modified after the threads are started
+				const auto it = p->m_byName.find(reinterpret_cast<const char*>(wp));
+				if (it != p->m_byName.end()) it->second->bDirty.store(true, ::std::memory_order_relaxed);
+			}
+
+		public:
+			stressHost(const int nSize, const bool bPrivate) : m_nSize(nSize), m_bPrivate(bPrivate) {
+				_current() = this;
+				q2ami_platform::postMessageSink() = &_onPostMessage;
+			}
+			~stressHost() {
+				q2ami_platform::postMessageSink() = nullptr;
+				_current() = nullptr;
+			}
+
+			//must be called before any thread is started
+			void addTicker(const ::std::string& amiName, const unsigned nThreads) {
+				auto pT = ::std::make_unique<ticker>();
+				pT->amiName = amiName;
+				for (unsigned i = 0, n = m_bPrivate ? nThreads : 1; i < n; ++i) {
+					pT->arrays.emplace_back(::std::make_unique<quotesArray>());
+					pT->arrays.back()->quotes.resize(static_cast<size_t>(m_nSize));
+				}
+				m_byName.emplace(amiName, pT.get());
+				m_tickers.emplace_back(::std::move(pT));
+			}
+			size_t tickersCount()const noexcept { return m_tickers.size(); }
+			ticker& tickerAt(const size_t i)noexcept { return *m_tickers[i]; }
+
+			::std::uint64_t calls()const noexcept { return m_calls.load(::std::memory_order_relaxed); }
+			::std::uint64_t violations()const noexcept { return m_violations.load(::std::memory_order_relaxed); }
+			void violation(const char* pWhat, const ::std::string& amiName, const int idx) {
+				//the first few are enough to start an investigation
+				if (m_violations.fetch_add(1, ::std::memory_order_relaxed) < 16) {
+					::std::fprintf(stderr, "VIOLATION: %s, ticker %s, idx %d\n", pWhat, amiName.c_str(), idx);
+				}
+			}
+
+			//calls GetQuotesEx() for the array of the thread and checks the result
+			template<typename PluginT>
+			void getQuotes(PluginT& plugin, ticker& t, const unsigned threadIdx) {
+				auto& a = *t.arrays[m_bPrivate ? threadIdx : 0];
+				::std::lock_guard<::std::mutex> lk(a.mtx);
+				t.bDirty.store(false, ::std::memory_order_relaxed);
+				const int r = plugin.Ami_GetQuotesEx(t.amiName.c_str(), 0, a.nLastValid, m_nSize, a.quotes.data(), nullptr);
+				m_calls.fetch_add(1, ::std::memory_order_relaxed);
+				if (r < 0 || r > m_nSize) {
+					violation("GetQuotesEx returned invalid count", t.amiName, r);
+					return;
+				}
+				a.nLastValid = r - 1;
+				for (int k = 1; k < r; ++k) {
+					if (a.quotes[static_cast<size_t>(k)].DateTime.Date <= a.quotes[static_cast<size_t>(k - 1)].DateTime.Date) {
+						violation("non increasing timestamps", t.amiName, k);
+						break;
+					}
+				}
+			}
+		};
+
+		inline int run(const stressOpts& o) {
+			typedef ::std::chrono::steady_clock clock_t;
+
+			stressHost host(o.size, 0 != o.privateArrays);
+			benchPlugin plugin;
+			dbTickers_t tickers;
+			for (unsigned i = 0; i < o.tickers; ++i) tickers["TQBR"].emplace_back("T" + ::std::to_string(i));
+			const auto dbPath = makeDb(tickers, "ticks", "subscribeOnConnect = 0\n");
+			if (!plugin.loadDb(dbPath)) {
+				::std::fprintf(stderr, "Failed to load DB at %s, see the log there\n", dbPath.c_str());
+				return 2;
+			}
+			//source ticker index -> host ticker index and "ticker@class"
+			const auto names = plugin.amiTickersOf();
+			if (names.size() != o.tickers) {
+				::std::fprintf(stderr, "Unexpected number of Ami tickers %zu\n", names.size());
+				return 2;
+			}
+			for (const auto& n : names) host.addTicker(n.second, o.threads);
+
+			plugin.hndConnectionState(true);
+			auto*const pCli = mockCli<Q2Ami>::current();
+			if (!pCli) return 2;
+
+			::std::atomic<bool> bStop{ false };
+			//the last price sent for every source ticker
+			::std::vector<double> lastPrice(o.tickers, 0.);
+			::std::uint64_t nSent = 0, nPackets = 0;
+
+			::std::thread net([&]() {
+				burstyDealsGen::params gp;
+				gp.tickers = o.tickers;
+				gp.dealsPerSec = o.rate;
+				gp.maxPacket = o.packet;
+				gp.seed = o.seed;
+				burstyDealsGen gen(gp);
+				::std::vector<proxy::prxyTsDeal> pkt;
+				::std::vector<int> tidOf(o.tickers, -1);
+				::std::mt19937 rng(o.seed);
+
+				const auto t0 = clock_t::now();
+				::std::int64_t us0 = -1;
+				while (!bStop.load(::std::memory_order_relaxed)) {
+					//subscriptions issued by GetQuotesEx() are answered between packets, as the real client does
+					if (pCli->serve()) {
+						for (unsigned i = 0; i < o.tickers; ++i) {
+							if (tidOf[i] < 0) tidOf[i] = pCli->tidOf(names[i].first);
+						}
+					}
+					const auto us = gen.next(pkt);
+					if (us0 < 0) us0 = us;
+					::std::this_thread::sleep_until(t0 + ::std::chrono::microseconds(us - us0));
+
+					//the server sends deals of subscribed tickers only
+					size_t n = 0;
+					for (auto& d : pkt) {
+						const auto src = static_cast<unsigned>(d.tid);
+						if (tidOf[src] < 0) continue;
+						lastPrice[src] = d.pr;
+						d.tid = static_cast<decltype(d.tid)>(tidOf[src]);
+						pkt[n++] = d;
+					}
+					if (n) {
+						plugin.hndAllTrades(pkt.data(), n);
+						nSent += n;
+						++nPackets;
+					}
+					//QUIK's connection to the broker blinks sometimes
+					if (0 == rng() % 20000) {
+						plugin.hndQuikConnectionState(false);
+						plugin.hndQuikConnectionState(true);
+					}
+				}
+				//answering late subscriptions, so the drain below doesn't wait for them forever
+				pCli->serve();
+			});
+
+			::std::vector<::std::thread> amis;
+			for (unsigned ti = 0; ti < o.threads; ++ti) {
+				amis.emplace_back([&, ti]() {
+					::std::mt19937 rng(o.seed * 1000 + ti);
+					while (!bStop.load(::std::memory_order_relaxed)) {
+						//mostly notified tickers, sometimes random ones, like scans over the whole watchlist do
+						const auto i = rng() % host.tickersCount();
+						auto& t = host.tickerAt(i);
+						if (t.bDirty.load(::std::memory_order_relaxed) || 0 == rng() % 8) host.getQuotes(plugin, t, ti);
+						if (0 == rng() % 64) ::std::this_thread::sleep_for(::std::chrono::microseconds(rng() % 500));
+					}
+				});
+			}
+
+			//Ami's UI thread refreshes the real-time quote window and polls the status
+			const auto tEnd = clock_t::now() + ::std::chrono::seconds(o.seconds);
+			for (unsigned iter = 0; clock_t::now() < tEnd; ++iter) {
+				for (size_t i = 0; i < host.tickersCount(); ++i) {
+					const auto& t = host.tickerAt(i);
+					const auto*const pRi = plugin.Ami_GetRecentInfo(t.amiName.c_str());
+					//a torn snapshot would likely show a trade without a price
+					if (pRi && (pRi->nStatus & RI_STATUS_TRADE) && !(pRi->fLast > 0)) {
+						host.violation("GetRecentInfo returned a trade without a price", t.amiName, -1);
+					}
+				}
+				if (0 == iter % 10) plugin.status();
+				::std::this_thread::sleep_for(::std::chrono::milliseconds(10));
+			}
+			bStop.store(true, ::std::memory_order_relaxed);
+			net.join();
+			for (auto& t : amis) t.join();
+
+			//every array must now end with the last deal of its ticker
+			size_t nChecked = 0;
+			for (unsigned i = 0; i < o.tickers; ++i) {
+				auto& t = host.tickerAt(i);
+				for (unsigned ti = 0; ti < (o.privateArrays ? o.threads : 1u); ++ti) {
+					//two calls: the subscription of a ticker that was never requested is answered only now
+					host.getQuotes(plugin, t, ti);
+					pCli->serve();
+					host.getQuotes(plugin, t, ti);
+				}
+				if (lastPrice[i] <= 0) continue;
+				//the plugin delivers a bar once, so with --private-arrays only the array that got the last bar is checked
+				bool bFound = false;
+				for (const auto& pA : t.arrays) {
+					if (pA->nLastValid >= 0 && pA->quotes[static_cast<size_t>(pA->nLastValid)].Price
+						== static_cast<decltype(pA->quotes[0].Price)>(lastPrice[i])) bFound = true;
+				}
+				if (!bFound) host.violation("the last quote doesn't match the last deal", t.amiName, -1);
+				++nChecked;
+			}
+
+			::std::printf("%u Ami threads, %u tickers: %llu deals in %llu packets, %llu GetQuotesEx calls, %zu tickers checked, %llu violations\n"
+				, o.threads, o.tickers, static_cast<unsigned long long>(nSent), static_cast<unsigned long long>(nPackets)
+				, static_cast<unsigned long long>(host.calls()), nChecked, static_cast<unsigned long long>(host.violations()));
+			::std::printf("status: %s\n", plugin.status().c_str());
+
+			plugin.unloadDb();
+			return host.violations() ? 1 : 0;
+		}
+
+	}
+}
+
+int main(int argc, char* argv[]) {
+	::t18::bench::stressOpts o;
+	if (!o.parse(argc, argv)) {
+		::std::fprintf(stderr, "Usage: %s [--threads N] [--seconds N] [--tickers N<=256] [--rate DEALS_PER_SEC] [--packet N]\n"
+			"\t[--size N] [--private-arrays 1] [--seed N]\n", argv[0]);
+		return 1;
+	}
+	return ::t18::bench::run(o);
+}
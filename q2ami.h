@@ -18,9 +18,9 @@
 */
 #pragma once
 
-//we need mutex&condition_variable to synchronize network thread with the main thread
 #include <mutex>
-#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
 
 //////////////////////////////////////////////////////////////////////////
 //#define SPDLOG_NO_THREAD_ID
@@ -29,15 +29,39 @@
 //#define SPDLOG_WCHAR_TO_UTF8_SUPPORT
 #define SPDLOG_DISABLE_DEFAULT_LOGGER
 
+//trace statements written with SPDLOG_LOGGER_TRACE() are compiled out of release builds
+#ifndef SPDLOG_ACTIVE_LEVEL
+#ifdef T18_DEBUG
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#else
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+#endif
+#endif
+
 #include <spdlog/spdlog.h>
+#include <spdlog/async.h>
 #include <spdlog/sinks/rotating_file_sink.h>
+#ifdef _WIN32
 #include <spdlog/sinks/msvc_sink.h>
+#else
+#include <spdlog/sinks/stdout_sinks.h>
+#endif
 //////////////////////////////////////////////////////////////////////////
 
 #include "../t18/t18/proxy/client.h"
 #include "../t18/t18/utils/atomic_flags_set.h"
 
 #include "q2ami_cfg.h"
+#include "q2ami_log.h"
+#include "q2ami_flight.h"
+#include "q2ami_capture.h"
+#include "q2ami_requests.h"
+
+//the client of t18qsrv could be replaced by defining Q2AMI_QCLI_T before the file is included. The benchmark harness
+// uses it to run the plugin against a simulated server, see bench/mock_ami.h
+#ifndef Q2AMI_QCLI_T
+#define Q2AMI_QCLI_T proxy::QCliWThread
+#endif
 
 namespace t18 {
 
@@ -112,19 +136,31 @@ namespace t18 {
 		typedef typename Cfg_t::dealsLock_guard_ex_t dealsLock_guard_ex_t;
 		typedef typename Cfg_t::dealsLock_guard_t dealsLock_guard_t;
 
+		typedef typename Cfg_t::convLock_guard_t convLock_guard_t;
+
 		typedef typename Cfg_t::ClassDescr_t ClassDescr_t;
 
+		typedef _Q2Ami::TickerHotData TickerHotData_t;
+		typedef decltype(proxy::prxyTsDeal::tid) tid_t;
+
+		typedef _Q2Ami::latencyClock latencyClock_t;
+
 	protected:
+	#ifdef _WIN32
 		typedef ::spdlog::sinks::msvc_sink_mt outds_sink_t;
+	#else
+		typedef ::spdlog::sinks::stderr_sink_mt outds_sink_t;
+	#endif
 
-		typedef proxy::QCliWThread<self_t> qcli_t;
+		typedef Q2AMI_QCLI_T<self_t> qcli_t;
 
-		typedef ::std::mutex network2ami_sync_t;
-		typedef ::std::unique_lock<network2ami_sync_t> network2ami_lock_t;
+		typedef _Q2Ami::instrumentedLock<::std::mutex> network2ami_sync_t;
+		//queryTickerInfo requests by "ticker@class" keys
+		typedef _Q2Ami::requestTracker<::std::string, TickerInfo, network2ami_sync_t> tickerInfoRequests_t;
 
-		typedef utils::spinlock spinlock_t;
-		typedef utils::spinlock_guard spinlock_guard_t;
-		typedef utils::spinlock_guard_ex spinlock_guard_ex_t;
+		typedef _Q2Ami::instrumentedLock<utils::spinlock> spinlock_t;
+		typedef ::std::lock_guard<spinlock_t> spinlock_guard_t;
+		typedef ::std::unique_lock<spinlock_t> spinlock_guard_ex_t;
 
 		//////////////////////////////////////////////////////////////////////////
 		typedef ::std::uint32_t flags_t;
@@ -134,8 +170,10 @@ namespace t18 {
 		static constexpr flags_t _flagsQ2Ami_Running = (_flagsQ2Ami_ConfigureInProcess << 1);
 		static constexpr flags_t _flagsQ2Ami_CheckTheLog = (_flagsQ2Ami_Running << 1);
 		static constexpr flags_t _flagsQ2Ami_NeverDidGetQuotes = (_flagsQ2Ami_CheckTheLog << 1);
+		//set by the network thread on connection if all tickers must be subscribed, cleared by Ami's UI thread when it's done
+		static constexpr flags_t _flagsQ2Ami_SubscribeAllPending = (_flagsQ2Ami_NeverDidGetQuotes << 1);
 
-		static constexpr flags_t _flagsQ2Ami__lastUsedBit = _flagsQ2Ami_NeverDidGetQuotes;
+		static constexpr flags_t _flagsQ2Ami__lastUsedBit = _flagsQ2Ami_SubscribeAllPending;
 		//////////////////////////////////////////////////////////////////////////
 
 	public:
@@ -150,20 +188,56 @@ namespace t18 {
 		static constexpr auto log_default_level = ::spdlog::level::trace;
 		static constexpr auto file_log_level = ::spdlog::level::debug;
 		static constexpr auto log_immediate_flush_on_level = log_default_level;
+		//the file logger is asynchronous: messages are formatted by the calling thread and written (and flushed) by
+		// a dedicated thread. When more than logQueueSize messages are pending, the oldest are dropped, so the
+		// network thread never waits for the disk
+		static constexpr size_t logQueueSize = 8192;
+		//min period between messages of a call site that may fire per deal or per GetQuotesEx() call
+		static constexpr ::std::uint64_t logLimitedPeriodMs = 5000;
 
 		//////////////////////////////////////////////////////////////////////////
 
+		//Configure() waits for tickers info at most timeout_Configure2queryTickerInfo_ms plus
+		// timeout_Configure2queryTickerInfo_perTicker_ms for every ticker
 		static constexpr long timeout_Configure2queryTickerInfo_ms = 10000;
+		static constexpr long timeout_Configure2queryTickerInfo_perTicker_ms = 100;
+		//max number of tickers in a single queryTickerInfo request
+		static constexpr size_t configureChunkSize = 50;
+
+		//how often config file is checked for changes
+		static constexpr ::std::uint64_t cfgCheckPeriodMs = 3000;
+		//min period of recalculation of deals rate shown in the plugin status
+		static constexpr ::std::uint64_t statusRatePeriodMs = 1000;
+		//how often contended locks are reported to the log
+		static constexpr ::std::uint64_t lockStatsPeriodMs = 60000;
+
+		//deals latency table is written to this file of the DB directory on right click on the plugin status
+		static inline constexpr const char pszLatencyFileName[] = "latency.txt";
+		//metrics are periodically written to this file of the DB directory if metricsPeriodSec option is set
+		static inline constexpr const char pszMetricsFileName[] = "metrics.prom";
+		//flight recorder is dumped to this file of the DB directory when the log must be checked or on right click
+		// on the plugin status. See tools/flight2trace.cpp
+		static inline constexpr const char pszFlightFileName[] = "flight.bin";
 
 		//when quotes array is full, is is shifted by uShiftQuotesArrayOffset elements.
 		static constexpr int uShiftQuotesArrayOffset = 3000;
 		//static constexpr int uShiftQuotesArrayOffset = 2850;
 
+		//number of deals copied from rawDeals under a single lock acquisition during conversion
+		static constexpr size_t dealsCopyChunk = 256;
+		//initial size of convBase::stage
+		static constexpr size_t stageInitialSize = 64;
+		//a deal received not later than this after its exchange time is a live one, i.e. the backfill of the ticker
+		// has caught up (see RTInfo::onDeal()). The local clock is expected to follow the exchange time, see tradingDayStart()
+		static constexpr ::std::int64_t liveDealMaxLagUs = 30 * 1000000;
+
 		//////////////////////////////////////////////////////////////////////////
 		
 	protected:
 		Cfg_t m_config;
-		::std::unique_ptr<::spdlog::logger> m_Log;
+		//must be shared_ptr, async_logger requires it
+		::std::shared_ptr<::spdlog::logger> m_Log;
+		::std::shared_ptr<::spdlog::details::thread_pool> m_logThreadPool;
 
 		T18_COMP_SILENCE_ZERO_AS_NULLPTR;
 		HWND m_hAmiBrokerWnd{ NULL };
@@ -171,9 +245,8 @@ namespace t18 {
 
 		::std::unique_ptr<qcli_t> m_pCli;
 
-		// for network thread - ami thread synchronization
-		network2ami_sync_t m_syncMtx;
-		::std::condition_variable m_syncCV;
+		//pending requests to the server, that are answered from the network thread. Empty unless Configure() is running
+		tickerInfoRequests_t m_tickerInfoRequests;
 
 		safe_flags_t m_flags;//thread safe
 		
@@ -184,15 +257,35 @@ namespace t18 {
 							  // so small and fast spinlock seems the best choice.
 
 		static_assert(sizeof(proxy::prxyTsDeal::tid) == 1, "Expecting tid to have a range of [0,255] here.");
-		::std::array<TickerCfgData_t*, 256> m_ptrs2TickerCfgData;
-		// m_ptrs2TickerCfgData is a different thing. It's indexed by tickerid, assigned by the server, 
+		::std::array<TickerHotData_t, 256> m_tickersHot;
+		// m_tickersHot is a different thing. It's indexed by tickerid, assigned by the server, 
 		// and therefore it's preallocated from the start.
-		// its members points to config members. m_ptrs2TickerCfgData can only be used/updated from the network thread. 
+		// its members points to config members. m_tickersHot can only be used/updated from the network thread. 
 
-		//must always be empty except for the duration of configure(), so no deinitialization on db unloading required
-		::std::vector<TickerInfo> m_queryTickerInfo;
-		
-		::std::vector<TickerCfgData_t*> m_rti4Update;
+		//tids of tickers to notify Ami about after processing of allTrades packet
+		::std::vector<tid_t> m_rti4Update;
+
+		//used from Ami's UI thread only
+		::std::uint64_t m_nextCfgCheckTick{ 0 };
+		::std::uint64_t m_nextLockStatsTick{ 0 };
+
+		//deals rate shown in the plugin status. Ami's UI thread only
+		::std::uint64_t m_statusRateTick{ 0 }, m_statusRateDeals{ 0 };
+		double m_statusDealsRate{ 0 };
+
+		//latencies of deals of all tickers, see also TickerCfgData::latency
+		_Q2Ami::dealLatency m_latency;
+		//counters for monitoring, see also TickerCfgData::counters
+		_Q2Ami::pluginCounters m_counters;
+		//writes metrics file, must be stopped before the config is cleared
+		_Q2Ami::periodicFileWriter m_metricsWriter;
+
+		//last events of the network and quote paths
+		_Q2Ami::flightRecorder m_flight;
+		//flight recorder was already dumped for the current _flagsQ2Ami_CheckTheLog. Ami's UI thread only
+		bool m_bFlightDumped{ false };
+		//tap of everything received from t18qsrv, see Cfg::capture()
+		_Q2Ami::captureWriter m_capture;
 
 		//////////////////////////////////////////////////////////////////////////
 	public:
@@ -201,26 +294,52 @@ namespace t18 {
 
 			::spdlog::drop_all();
 			m_Log.reset();
+			//writes all pending messages and stops the logging thread
+			m_logThreadPool.reset();
 		}
 		Q2Ami() {
-			_cleanPtrs2TickerCfgData();
+			_cleanTickersHot();
 			_init_outds_logger();
 		}
 
 	protected:
 		void _shutdownCli() {
 			m_Log->info("Performing client shutdown from state '{}'", stateName(m_state));
+			m_metricsWriter.stop();
 			m_state = State::NotInitialized;
-			m_flags.clear<_flagsQ2Ami_Running | _flagsQ2Ami_CheckTheLog>();
+			m_flags.clear<_flagsQ2Ami_Running | _flagsQ2Ami_CheckTheLog | _flagsQ2Ami_SubscribeAllPending>();
 			m_pCli.reset();
+			//nothing will answer them anymore
+			m_tickerInfoRequests.cancelAll();
+			m_bFlightDumped = false;
+			//the network thread is stopped, nothing will be captured anymore
+			if (m_capture.isRunning()) {
+				m_capture.stop();
+				m_Log->info("Capture stopped: {} bytes written, {} records dropped, {} write errors"
+					, m_capture.bytesWritten(), m_capture.recordsDropped(), m_capture.writeErrors());
+			}
+
+			//the network thread is stopped, so everything received could be converted and saved
+			m_config.saveCheckpoint(*m_Log.get(), [this](TickerCfgData_t& tcd) {
+				if (tcd.eTI.isValid()) _convertNewDeals(&tcd);
+			});
+			m_config.saveLastQuotes(*m_Log.get());
+			//both hold convLock of every ticker, GetQuotesEx() calls that found a ticker busy meanwhile must be repeated
+			m_config.forEachTicker([this](TickerCfgData_t& tcd, const ClassDescr_t&) { _notifySkipped(&tcd); });
 
 			{
 				spinlock_guard_t g(m_spinlock);
-				_cleanPtrs2TickerCfgData();
+				_cleanTickersHot();
 			}
 			m_rti4Update.clear();
 
 			m_config.logDealsStorageUseCount(*m_Log.get());
+			_logLockStats(false);
+			_logLatency();
+			m_latency.reset();
+			m_counters.reset();
+			m_statusRateTick = m_statusRateDeals = 0;
+			m_statusDealsRate = 0;
 			m_config.clearAll();
 
 			T18_COMP_SILENCE_ZERO_AS_NULLPTR;
@@ -232,8 +351,16 @@ namespace t18 {
 			auto r = m_config.readFromPath(*m_Log.get(), pszDatabasePath);
 			if (r) {
 				m_Log->info("Config of DB '{}' has been loaded", pszDatabasePath);
+				m_config.loadCheckpoint(*m_Log.get());
+				m_config.loadLastQuotes(*m_Log.get());
+
+				m_rti4Update.reserve(m_tickersHot.size());
 
-				m_rti4Update.reserve(m_config.tickersCount());
+				_applyMetricsPeriod();
+				if (m_config.capture()) {
+					m_capture.start(m_config.dbPath());
+					m_Log->info("Received data will be captured to {}", _Q2Ami::capture::fileName(mxTimestamp::now()));
+				}
 
 				m_flags.set<_flagsQ2Ami_Running | _flagsQ2Ami_NeverDidGetQuotes>();
 
@@ -269,14 +396,116 @@ namespace t18 {
 			return true;
 		}
 
+		//(re)starts the metrics writer if metricsPeriodSec has changed. Ami's UI thread only
+		void _applyMetricsPeriod() {
+			const auto metricsPeriod = m_config.metricsPeriodSec();
+			if (m_metricsWriter.isRunning()) {
+				if (m_metricsWriter.periodSec() == metricsPeriod) return;
+				m_metricsWriter.stop();
+				if (!metricsPeriod) m_Log->info("Metrics writing stopped");
+			}
+			if (metricsPeriod) {
+				m_metricsWriter.start(m_config.dbPath() + "/" + pszMetricsFileName, metricsPeriod
+					, [this](::std::string& s) { _describeMetrics(s); });
+				m_Log->info("Metrics will be written to {} every {}s", pszMetricsFileName, metricsPeriod);
+			}
+		}
+
+		//applies changes of the config file without interrupting data flow. Existing tickers are kept intact, new and
+		// reattached tickers are subscribed as usual on the first request from Ami (or right away if subscribeOnConnect is set)
+		void _reloadCfg() {
+			if (!_isDbLoaded() || m_flags.isSet<_flagsQ2Ami_ConfigureInProcess>()) return;
+
+			m_Log->info("Reloading config...");
+			size_t nNew, nRemoved, nNewModes;
+			const bool bChanged = m_config.reload(*m_Log.get(), nNew, nRemoved, nNewModes
+				, [this](TickerCfgData_t& tcd, ::std::unique_ptr<convBase_t>&& upMode) { _addMode(tcd, ::std::move(upMode)); });
+			if (bChanged) {
+				m_Log->warn("Config reloaded: {} tickers added, {} removed, {} modes added, {} tickers total. Run Configure to add new tickers to Ami"
+					, nNew, nRemoved, nNewModes, m_config.tickersCount());
+				m_flags.set<_flagsQ2Ami_CheckTheLog>();
+				if (nNew > 0 && m_config.subscribeOnConnect()) _subscribeAll();
+			} else m_Log->info("Config reloaded, tickers list wasn't changed");
+
+			_applyMetricsPeriod();
+			//network thread writes to the capture without synchronization, so it can't be started or stopped on the fly
+			if (m_config.capture() != m_capture.isRunning()) {
+				m_Log->warn("Change of the capture option takes effect on the next DB load");
+			}
+		}
+
+		//appends the mode, that was added to the config of a known ticker, and brings it to the state of other modes of
+		// the ticker: it gets the same subscription time and converts the deals they have already processed. Ami's UI thread only
+		void _addMode(TickerCfgData_t& tcd, ::std::unique_ptr<convBase_t>&& upMode) {
+			_appendMode(tcd, ::std::move(upMode));
+			//catching up may take a while, GetQuotesEx() calls that found the ticker busy meanwhile must be repeated
+			_notifySkipped(&tcd);
+		}
+		//see _addMode()
+		void _appendMode(TickerCfgData_t& tcd, ::std::unique_ptr<convBase_t>&& upMode) {
+			T18_ASSERT(upMode);
+			auto& m = *upMode;
+			//nobody converts the ticker until the mode is caught up
+			convLock_guard_t cl(tcd.convLock);
+			mxTimestamp tsSince;
+			{
+				//must not race with _subscribe(), that sets the previous quote of every mode
+				spinlock_guard_t lk(m_spinlock);
+				tsSince = tcd.tsSubscribedSince;
+				if (!tsSince.empty()) m.setPrevQuot(tsSince, nullptr);
+				tcd.modesList.push_back(::std::move(upMode));
+			}
+			if (tsSince.empty()) return;
+
+			proxy::prxyTsDeal dealsBuf[dealsCopyChunk];
+			const auto lastDealIdx = tcd.nextDealToProcess;
+			size_t nextDealIdx = 0;
+			while (nextDealIdx < lastDealIdx) {
+				const size_t n = ::std::min(dealsCopyChunk, lastDealIdx - nextDealIdx);
+				{
+					dealsLock_guard_t dlg(tcd.rawDealsLock);
+					::std::copy_n(&tcd.rawDeals[nextDealIdx], n, dealsBuf);
+				}
+				nextDealIdx += n;
+				_convertDeals(m, dealsBuf, n, tcd.eTI, m_config.unrequestedModeMaxBars());
+			}
+			m_Log->info("Mode {} has converted {} deals already received", m.amiName, lastDealIdx);
+		}
+
+		//logs counters of plugin-wide locks and rawDealsLock of tickers (all or only contended)
+		void _logLockStats(const bool bContendedOnly)const {
+			::std::string s;
+			if (!bContendedOnly || m_spinlock.stats().wasContended()) m_spinlock.stats().describe(s, "m_spinlock");
+			const auto& rl = m_tickerInfoRequests.lock();
+			if (!bContendedOnly || rl.stats().wasContended()) rl.stats().describe(s, "m_tickerInfoRequests");
+			if (!s.empty()) m_Log->info("Locks stats:\n{}", s);
+			m_config.logLockStats(*m_Log.get(), bContendedOnly);
+		}
+		//periodic report of contended locks. Ami's UI thread only
+		void _checkLockStats() {
+			const auto t = ::GetTickCount64();
+			if (t < m_nextLockStatsTick) return;
+			const bool bFirst = 0 == m_nextLockStatsTick;
+			m_nextLockStatsTick = t + lockStatsPeriodMs;
+			if (!bFirst) _logLockStats(true);
+		}
+
+		//throttled check of config file changes. Ami's UI thread only
+		void _checkCfgChanged() {
+			const auto t = ::GetTickCount64();
+			if (t < m_nextCfgCheckTick) return;
+			m_nextCfgCheckTick = t + cfgCheckPeriodMs;
+			if (m_config.cfgFileChanged()) _reloadCfg();
+		}
+
 		bool _isDbLoaded()const noexcept {
 			const auto r = static_cast<bool>(m_hAmiBrokerWnd);
 			T18_ASSERT(!(r^static_cast<bool>(m_pCli)));
 			return r;
 		}
 		
-		void _cleanPtrs2TickerCfgData()noexcept {
-			::std::fill(m_ptrs2TickerCfgData.begin(), m_ptrs2TickerCfgData.end(), nullptr);
+		void _cleanTickersHot()noexcept {
+			::std::fill(m_tickersHot.begin(), m_tickersHot.end(), TickerHotData_t());
 		}
 
 		void _init_outds_logger() {
@@ -285,7 +514,7 @@ namespace t18 {
 				// Create basic file logger (not rotated)
 				auto outds_logger = ::std::make_shared<outds_sink_t>();
 				outds_logger->set_level(log_default_level);
-				m_Log = ::std::make_unique<::spdlog::logger>("my", outds_logger);
+				m_Log = ::std::make_shared<::spdlog::logger>("my", outds_logger);
 				m_Log->set_level(log_default_level);
 
 				m_Log->debug("outds initialized");
@@ -317,9 +546,14 @@ namespace t18 {
 				auto file_sink = ::std::make_shared<::spdlog::sinks::rotating_file_sink_mt>(fpath.c_str(), 1024*64, 3);
 				file_sink->set_level(file_log_level);
 
-				m_Log = ::std::make_unique<::spdlog::logger>("my", ::spdlog::sinks_init_list{ outds_logger , file_sink });
+				//the thread is created once and is reused by loggers of subsequently loaded DBs. Messages of a previous
+				// logger still in the queue keep it alive until they are written
+				if (!m_logThreadPool) m_logThreadPool = ::std::make_shared<::spdlog::details::thread_pool>(logQueueSize, 1);
+				m_Log = ::std::make_shared<::spdlog::async_logger>("my", ::spdlog::sinks_init_list{ outds_logger , file_sink }
+					, m_logThreadPool, ::spdlog::async_overflow_policy::overrun_oldest);
 				m_Log->set_level(log_default_level);
-				m_Log->flush_on(log_default_level);
+				//flushing is done by the logging thread, so it's cheap for the caller
+				m_Log->flush_on(log_immediate_flush_on_level);
 
 				m_Log->debug("Complete logging initialized!");
 			} catch (const ::spdlog::spdlog_ex& ex) {
@@ -344,13 +578,20 @@ namespace t18 {
 		}
 
 		void hndConnectionState(const bool bConnected) {
+			m_flight.record(_Q2Ami::flightEvent::evConnection, _Q2Ami::flightRecorder::noTid, bConnected ? 1 : 0);
+			m_capture.connection(mxTimestamp::now(), bConnected);
 			if (bConnected) {
 				m_Log->info("Connected to t18qsrv from state '{}'", stateName(m_state));
 				m_state = State::Connected;
+				//requests are sent from Ami's thread (see Ami_GetStatus()), because m_pCli may not be assigned yet
+				if (m_config.subscribeOnConnect()) m_flags.set<_flagsQ2Ami_SubscribeAllPending>();
 			} else {
 				if (State::NotInitialized != m_state) {
 					m_Log->critical("Connection to t18qsrv failed from state '{}'!", stateName(m_state));
 					m_state = State::Err_ConnectionFailed;
+					//responses won't come, so Configure() shouldn't wait for them till the timeout
+					const auto n = m_tickerInfoRequests.cancelAll();
+					if (n) m_Log->warn("{} pending queryTickerInfo requests cancelled", n);
 				}
 			}
 		}
@@ -369,15 +610,28 @@ namespace t18 {
 				r = _onDbLoad(pn);
 			}else if (pn->nReason & REASON_DATABASE_UNLOADED) {
 				r = _onDbUnload(pn);
-			} /*else if (pn->nReason & REASON_STATUS_RMBCLICK) {
-			}*/
+			} else if (pn->nReason & REASON_SETTINGS_CHANGE) {
+				_reloadCfg();
+			} else if (pn->nReason & REASON_STATUS_RMBCLICK) {
+				if (_isDbLoaded()) {
+					_dumpLatency();
+					_dumpFlight();
+				}
+			}
 			return r;
 		}
-		static constexpr int Ami_symLimit()noexcept { return 16; }
+		//called by Ami to find out the maximum number of symbols in the real-time quote window. Ami may ask for it before
+		// the DB is loaded and never ask again, so until then (and after the DB is unloaded) the config returns
+		// the upper bound of symbols the plugin could serve, see Cfg::maxRtSymbolsLimit()
+		int Ami_symLimit()const noexcept {
+			return m_config.rtSymbolsLimit();
+		}
 
 		//////////////////////////////////////////////////////////////////////////
 	protected:
 		void _notifyAmi(const TickerCfgData_t*const pTCD)const noexcept {
+			//no RecentInfo is passed: convBase::recentInfo is filled only by GetRecentInfo() on Ami's UI thread, so here it would
+			// be stale (or empty for a symbol never queried). Ami calls GetRecentInfo() itself to get fresh data
 			for (const auto& up : pTCD->modesList) {
 				T18_ASSERT(up);
 				::PostMessage(m_hAmiBrokerWnd, WM_USER_STREAMING_UPDATE, reinterpret_cast<WPARAM>(up->amiName.c_str()), 0);
@@ -422,12 +676,329 @@ namespace t18 {
 
 		
 
-		//#TODO 
+		//negative latency means it couldn't be measured
+		void _recordLatency(TickerCfgData_t*const pTCD, const _Q2Ami::dealLatency::stage_t st, const ::std::int64_t us)noexcept {
+			if (UNLIKELY(us < 0)) return;
+			const auto v = static_cast<_Q2Ami::latencyHist::value_t>(us);
+			m_latency.record(st, v);
+			pTCD->latency.record(st, v);
+		}
+
+		//returns table of latencies of all tickers
+		::std::string _describeLatency()const {
+			::std::string s("stage/ticker             stage          count    p50(ms)    p99(ms)    max(ms)\n");
+			m_latency.describe(s, "ALL");
+			m_config.forEachTicker([&s](const TickerCfgData_t& tcd, const ClassDescr_t& cd) {
+				if (tcd.isDetached()) return;
+				const auto name = tcd.tickerName + "@" + cd.className;
+				tcd.latency.describe(s, name.c_str());
+			});
+			return s;
+		}
+		void _logLatency()const {
+			if (m_latency.hist[_Q2Ami::dealLatency::stReceipt].count()) m_Log->info("Deals latency:\n{}", _describeLatency());
+		}
+		//writes the latency table to the log and to a file in the DB directory. Ami's UI thread only
+		void _dumpLatency()const {
+			const auto s = _describeLatency();
+			m_Log->info("Deals latency:\n{}", s);
+			const auto fpath = m_config.dbPath() + "/" + pszLatencyFileName;
+			utils::myFile hF(fpath.c_str(), "w");
+			if (hF) fwrite(s.data(), 1, s.length(), hF);
+		}
+		//appends short summary of latencies (p50/p99/max in ms) of the stages to the status message
+		void _statusLatency(char (&msg)[256])const {
+			const auto& hr = m_latency.hist[_Q2Ami::dealLatency::stReceipt];
+			const auto& hd = m_latency.hist[_Q2Ami::dealLatency::stDelivery];
+			if (!hr.count()) return;
+			char _buf[128];
+			sprintf_s(_buf, " Lag ms p50/p99/max: recv %.0f/%.0f/%.0f, ami %.0f/%.0f/%.0f"
+				, hr.percentile(.5) / 1000., hr.percentile(.99) / 1000., hr.max() / 1000.
+				, hd.percentile(.5) / 1000., hd.percentile(.99) / 1000., hd.max() / 1000.);
+			strncat_s(msg, _buf, _TRUNCATE);
+		}
+
+		//ticker id for the flight recorder
+		static ::std::uint16_t _flightTid(const TickerCfgData_t*const pTCD)noexcept {
+			return pTCD->eTI.isPtiValid() ? static_cast<::std::uint16_t>(pTCD->eTI.tid) : _Q2Ami::flightRecorder::noTid;
+		}
+
+		//writes the flight recorder with names of subscribed tickers to a file in the DB directory. Ami's UI thread only
+		void _dumpFlight() {
+			m_bFlightDumped = true;
+			::std::vector<::std::pair<::std::uint16_t, ::std::string>> names;
+			m_config.forEachTicker([this, &names](const TickerCfgData_t& tcd, const ClassDescr_t& cd) {
+				spinlock_guard_t lk(m_spinlock);
+				if (tcd.unsafe_subscribeWasSuccessfull()) names.emplace_back(static_cast<::std::uint16_t>(tcd.eTI.tid), tcd.tickerName + "@" + cd.className);
+			});
+			const auto s = m_flight.serialize(names);
+
+			const auto fpath = m_config.dbPath() + "/" + pszFlightFileName;
+			const auto tmpPath = fpath + ".tmp";
+			if (!_Q2Ami::periodicFileWriter::writeFile(tmpPath, s) || !::MoveFileExA(tmpPath.c_str(), fpath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+				m_Log->error("Failed to write flight recorder to {}", fpath);
+				return;
+			}
+			m_Log->info("Flight recorder ({} bytes) was written to {}", s.length(), fpath);
+		}
+
+		//appends deals rate, the age of the last received packet, number of deals in memory and the worst backlog of
+		// conversion to the status message, so it's visible whether the feed stalled or Ami falls behind. Ami's UI thread only
+		void _statusThroughput(char (&msg)[256]) {
+			const auto now = ::GetTickCount64();
+			const auto deals = m_counters.deals.load(::std::memory_order_relaxed);
+			if (!deals) return;
+
+			if (!m_statusRateTick) {
+				m_statusRateTick = now;
+				m_statusRateDeals = deals;
+			} else if (now - m_statusRateTick >= statusRatePeriodMs) {
+				m_statusDealsRate = static_cast<double>(deals - m_statusRateDeals) * 1000. / static_cast<double>(now - m_statusRateTick);
+				m_statusRateTick = now;
+				m_statusRateDeals = deals;
+			}
+
+			::std::uint64_t inMem = 0, worstBacklog = 0;
+			const TickerCfgData_t* pWorst = nullptr;
+			m_config.forEachTicker([&](const TickerCfgData_t& tcd, const ClassDescr_t&) {
+				inMem += tcd.counters.dealsStored.load(::std::memory_order_relaxed);
+				const auto b = tcd.counters.backlog();
+				if (b > worstBacklog) {
+					worstBacklog = b;
+					pWorst = &tcd;
+				}
+			});
+
+			const auto lastTick = m_counters.lastPacketTick.load(::std::memory_order_relaxed);
+			char _buf[128];
+			sprintf_s(_buf, " Feed %.0f deals/s, last %.1fs ago. In mem %llu, backlog %llu%s%s%s."
+				, m_statusDealsRate, now > lastTick ? static_cast<double>(now - lastTick) / 1000. : 0.
+				, static_cast<unsigned long long>(inMem), static_cast<unsigned long long>(worstBacklog)
+				, pWorst ? " (" : "", pWorst ? pWorst->tickerName.c_str() : "", pWorst ? ")" : "");
+			strncat_s(msg, _buf, _TRUNCATE);
+		}
+
+		//formats metrics in Prometheus text format. Called from the metrics thread, so only counters and data, that is safe
+		// to read from any thread, may be used here
+		void _describeMetrics(::std::string& s)const {
+			typedef _Q2Ami::promText promText_t;
+			promText_t pt(s);
+			::std::string lb;
+
+			pt.family("q2ami_connection_state", "gauge", "1 for the current state of the plugin, 0 for others");
+			const auto curState = m_state;
+			for (int i = 0; i <= static_cast<int>(State::SomeRequestFailed); ++i) {
+				const auto st = static_cast<State>(i);
+				lb.clear();
+				promText_t::label(lb, "state", stateName(st));
+				pt.sample("q2ami_connection_state", ::std::uint64_t(st == curState ? 1 : 0), lb);
+			}
+
+			const auto counter = [&pt](const char*const pName, const char*const pHelp, const ::std::atomic<::std::uint64_t>& c) {
+				pt.family(pName, "counter", pHelp);
+				pt.sample(pName, c.load(::std::memory_order_relaxed));
+			};
+			counter("q2ami_packets_received_total", "AllTrades packets received", m_counters.packets);
+			counter("q2ami_deals_received_total", "Deals received from the server", m_counters.deals);
+			counter("q2ami_deal_bytes_received_total", "Size of deals received from the server", m_counters.dealBytes);
+			counter("q2ami_notifications_total", "Notifications of Ami about new deals of a ticker", m_counters.notifications);
+			counter("q2ami_getquotes_busy_total", "GetQuotesEx() calls returned without new data, because another thread was converting the ticker"
+				, m_counters.getQuotesBusy);
+
+			static constexpr double quantiles[] = { .5, .9, .99 };
+			static constexpr const char* quantileNames[] = { "0.5", "0.9", "0.99" };
+			const auto& gq = m_counters.getQuotesUs;
+			pt.family("q2ami_getquotes_duration_seconds", "summary", "Duration of GetQuotesEx() calls");
+			for (size_t q = 0; q < ::std::size(quantiles); ++q) {
+				lb.clear();
+				promText_t::label(lb, "quantile", quantileNames[q]);
+				pt.sample("q2ami_getquotes_duration_seconds", static_cast<double>(gq.percentile(quantiles[q])) / 1e6, lb);
+			}
+			pt.sample("q2ami_getquotes_duration_seconds_sum", static_cast<double>(m_counters.getQuotesNs.load(::std::memory_order_relaxed)) / 1e9);
+			pt.sample("q2ami_getquotes_duration_seconds_count", gq.count());
+
+			pt.family("q2ami_deal_latency_seconds", "gauge", "Latency of deals relative to the exchange time at a processing stage");
+			for (int i = 0; i < _Q2Ami::dealLatency::_stagesCount; ++i) {
+				const auto& h = m_latency.hist[i];
+				if (!h.count()) continue;
+				for (size_t q = 0; q < ::std::size(quantiles); ++q) {
+					lb.clear();
+					promText_t::label(lb, "stage", _Q2Ami::dealLatency::stageNames[i]);
+					promText_t::label(lb, "quantile", quantileNames[q]);
+					pt.sample("q2ami_deal_latency_seconds", static_cast<double>(h.percentile(quantiles[q])) / 1e6, lb);
+				}
+			}
+
+			const auto perTicker = [this, &pt, &lb](const char*const pName, const char*const pType, const char*const pHelp, auto&& get) {
+				pt.family(pName, pType, pHelp);
+				m_config.forEachTicker([&](const TickerCfgData_t& tcd, const ClassDescr_t& cd) {
+					if (tcd.isDetached()) return;
+					lb.clear();
+					promText_t::label(lb, "ticker", tcd.tickerName);
+					promText_t::label(lb, "class", cd.className);
+					pt.sample(pName, static_cast<::std::uint64_t>(get(tcd.counters)), lb);
+				});
+			};
+			typedef _Q2Ami::tickerCounters tc_t;
+			perTicker("q2ami_ticker_deals_received_total", "counter", "Deals of the ticker received from the server"
+				, [](const tc_t& c) { return c.dealsReceived.load(::std::memory_order_relaxed); });
+			perTicker("q2ami_ticker_deals_filtered_total", "counter", "Deals of the ticker dropped by the time filter or as already processed"
+				, [](const tc_t& c) { return c.dealsFiltered.load(::std::memory_order_relaxed); });
+			perTicker("q2ami_ticker_deals_in_memory", "gauge", "Deals of the ticker kept in memory"
+				, [](const tc_t& c) { return c.dealsStored.load(::std::memory_order_relaxed); });
+			perTicker("q2ami_ticker_backlog_deals", "gauge", "Deals of the ticker received, but not converted for Ami yet"
+				, [](const tc_t& c) { return c.backlog(); });
+			perTicker("q2ami_ticker_notifications_total", "counter", "Notifications of Ami about new deals of the ticker"
+				, [](const tc_t& c) { return c.notifications.load(::std::memory_order_relaxed); });
+		}
+
+		//The state of a mode restored from the checkpoint is valid only if Ami's array still ends with the bar, that was
+		// the last one delivered before the restart. Must be called under convLock
+		static bool _canResume(const convBase_t& m, const int nLastValid, const Quotation*const pQuotes)noexcept {
+			return m.stageHasDelivered && m.stageLastValid >= 0 && nLastValid >= 0
+				&& pQuotes[nLastValid].DateTime.Date == m.stage[0].DateTime.Date;
+		}
+
+		//issues subscribeAllTrades request for the ticker unless a competing thread already did it. pLQ is the last quote
+		// known to Ami before tsSubsSince (if any). Returns true if the request was sent
+		bool _subscribe(TickerCfgData_t*const pCfgInfo, const ClassDescr_t*const pClassDescr, const mxTimestamp tsSubsSince
+			, const Quotation*const pLQ, const bool bResume, const char*const pszTicker)
+		{
+			char req[2 * m_config.maxStringCodeLen + qcli_t::sAllTradesRequest_addedBufLen];
+			const int n = m_pCli->makeAllTradesRequest(req, pCfgInfo->tickerName.c_str(), pClassDescr->className.c_str(), tsSubsSince);
+			if (UNLIKELY(n <= 0)) {
+				m_Log->critical("Failed to create subscribeAllTrades request for {} @ {}", pszTicker, tsSubsSince.to_string());
+				return false;
+			}
+			T18_ASSERT(static_cast<int>(::std::strlen(req)) == n);//strlen not an issue here
+
+			//updating Ticker data
+			bool bSubsIssued;
+			{
+				spinlock_guard_t lk(m_spinlock);
+				//must check again if competing thread already did this
+				bSubsIssued = pCfgInfo->unsafe_subscribeWasIssued();
+
+				if (LIKELY(! bSubsIssued)) {
+					T18_ASSERT(pCfgInfo->tsSubscribedSince.empty());
+					pCfgInfo->tsSubscribedSince = tsSubsSince;
+
+					//resumed modes already know their previous quote
+					if (!bResume) {
+						for (const auto& up : pCfgInfo->modesList) {
+							T18_ASSERT(up);
+							up->setPrevQuot(tsSubsSince, pLQ);
+						}
+					}
+				}
+			}
+
+			if (UNLIKELY(bSubsIssued)) {
+				m_Log->debug("Whoa, indeed subscribeAllTrades was already issued for {}@{} here! Skipping new requrest"
+					, pCfgInfo->tickerName, pClassDescr->className);
+				return false;
+			}
+
+			//preparing rawDeals
+			T18_ASSERT(pCfgInfo->initRawDealsCapacity > 0);
+			{
+				dealsLock_guard_t dlg(pCfgInfo->rawDealsLock);
+				pCfgInfo->rawDeals.reserve(pCfgInfo->initRawDealsCapacity);
+			}
+
+			m_Log->info("subscribeAllTrades for {}: req={}.\nInitial raw deals capacity is {}", pszTicker, req, pCfgInfo->initRawDealsCapacity);
+
+			//making request and asynchronously waiting for the results
+			m_pCli->post_packet(proxy::ProtoCli2Srv::subscribeAllTrades, req);
+			return true;
+		}
+
+		//Returns the timestamp to subscribe the ticker since. It's the beginning of the trading day, unless
+		// subscribeSinceLastQuote is set and every mode of the ticker knows the last quote of its Ami array and could
+		// continue from it (see convBase::resumableSince()). reqLastQuote is the actual last quote of pReqMode, if any.
+		mxTimestamp _subsSince(TickerCfgData_t*const pCfgInfo, const ClassDescr_t*const pClassDescr, convBase_t*const pReqMode
+			, const mxTimestamp reqLastQuote)
+		{
+			const auto dayStart = pClassDescr->tradingDayStart();
+			if (!m_config.subscribeSinceLastQuote()) return dayStart;
+
+			const auto since = [pCfgInfo, pReqMode, reqLastQuote, dayStart]() {
+				convLock_guard_t cl(pCfgInfo->convLock);
+				if (pReqMode) pReqMode->lastKnownQuote = reqLastQuote;
+
+				mxTimestamp r;
+				for (const auto& up : pCfgInfo->modesList) {
+					const auto& lq = up->lastKnownQuote;
+					const auto t = lq.empty() ? lq : up->resumableSince(lq);
+					if (t.empty() || t <= dayStart) return dayStart;
+					if (r.empty() || t < r) r = t;
+				}
+				return r.empty() ? dayStart : r;
+			}();
+			//GetQuotesEx() of another mode might have found the ticker busy
+			_notifySkipped(pCfgInfo);
+			return since;
+		}
+
+		//subscribes every configured ticker, that isn't subscribed yet, from the beginning of its trading day (or see _subsSince()), so deals
+		// are received before Ami asks for them. Tickers with the state restored from the checkpoint are left for
+		// GetQuotesEx(), because only it can check whether they could be resumed. Ami's UI thread only
+		void _subscribeAll() {
+			if (State::Connected != m_state) return;
+
+			//requests are sent one after another without waiting for replies, the server answers them in order
+			size_t nSubscribed = 0;
+			for (const auto& e : m_config.subscriptionOrder()) {
+				auto*const pCfgInfo = e.first;
+				bool bSkip;
+				{
+					spinlock_guard_t lk(m_spinlock);
+					bSkip = pCfgInfo->unsafe_subscribeWasIssued();
+				}
+				if (bSkip) continue;
+				{
+					convLock_guard_t cl(pCfgInfo->convLock);
+					bSkip = pCfgInfo->hasResumeState();
+				}
+				_notifySkipped(pCfgInfo);
+				if (bSkip) continue;
+
+				const auto name = pCfgInfo->tickerName + "@" + e.second->className;
+				if (_subscribe(pCfgInfo, e.second, _subsSince(pCfgInfo, e.second, nullptr, mxTimestamp()), nullptr, false, name.c_str())) {
+					++nSubscribed;
+				}
+			}
+			m_Log->info("Subscribed {} tickers on connect", nSubscribed);
+		}
+
+		//Called by GetQuotesEx() when convLock of the ticker is held by another thread. Marks the ticker, so the holder
+		// notifies Ami once it's done (see _notifySkipped()), then tries to lock once more, because the holder might have
+		// released the lock before the mark was set. Returns true if the lock was acquired.
+		//Fences pair with the one in _notifySkipped(): either the holder sees the mark, or the second try succeeds. Every
+		// holder of convLock must call _notifySkipped() once it's released
+		static bool _claimBusyTicker(TickerCfgData_t*const pTCD, convLock_guard_t& cl) {
+			pTCD->bConvSkipped.store(true, ::std::memory_order_relaxed);
+			::std::atomic_thread_fence(::std::memory_order_seq_cst);
+			return cl.try_lock();
+		}
+
+		//must be called after convLock of the ticker was released by a thread that converted its deals
+		void _notifySkipped(TickerCfgData_t*const pTCD)const noexcept {
+			::std::atomic_thread_fence(::std::memory_order_seq_cst);
+			if (UNLIKELY(pTCD->bConvSkipped.load(::std::memory_order_relaxed))
+				&& pTCD->bConvSkipped.exchange(false, ::std::memory_order_relaxed))
+			{
+				_notifyAmi(pTCD);
+			}
+		}
+
+		//must be called under pTCD->convLock
 		int _doGetQuotes(TickerCfgData_t* pTCD, convBase_t*const pModeConv, int nLastValid, const int nSize, Quotation*const pQuotes){
 			T18_ASSERT(nLastValid < nSize && nLastValid >= -1);
 
 			if (UNLIKELY(uShiftQuotesArrayOffset >= nSize)) {
-				m_Log->critical("Too small quotes array size={}. Make it (much) more than {} for optimal performance. Aborting"
+				Q2AMI_LOG_LIMITED(*m_Log, ::spdlog::level::critical, logLimitedPeriodMs
+					, "Too small quotes array size={}. Make it (much) more than {} for optimal performance. Aborting"
 					, nSize, uShiftQuotesArrayOffset);
 				m_flags.set<_flagsQ2Ami_CheckTheLog>();
 				return nLastValid + 1;
@@ -436,113 +1007,164 @@ namespace t18 {
 			if (UNLIKELY(!pTCD->eTI.isValid())) {
 				//happens for example when the session has not started yet, i.e. the "subscribe" request was sent, but didn't get the first
 				//"allTrades" packet. 
-				m_Log->trace("_doGetQuotes: eTI is invalid for {}, didn't the AllTrades packet yet? Ignoring"
+				SPDLOG_LOGGER_TRACE(m_Log, "_doGetQuotes: eTI is invalid for {}, didn't the AllTrades packet yet? Ignoring"
 					, pModeConv->amiName);
 				return nLastValid + 1;
 			}
 
-			size_t curDealsCnt;
+			//every mode of the ticker is run over the new deals at once, so the deals are read from rawDeals only once
+			// no matter how many modes there are. Results for modes not requested now are kept until Ami asks for them.
+			const auto prevNextDeal = pTCD->nextDealToProcess;
+			_convertNewDeals(pTCD);
+			const auto r = _deliverStage(*pModeConv, _flightTid(pTCD), nLastValid, nSize, pQuotes) + 1;
+			if (pTCD->nextDealToProcess != prevNextDeal) {
+				_recordLatency(pTCD, _Q2Ami::dealLatency::stDelivery, latencyClock_t(mxTimestamp::now()).since(pTCD->tsLastConverted));
+			}
+			return r;
+		}
+
+		//runs every mode of the ticker over deals that weren't processed yet. Must be called under pTCD->convLock
+		void _convertNewDeals(TickerCfgData_t*const pTCD) {
 			const auto& dealsVec = pTCD->rawDeals;
-			auto nextDealIdx = pModeConv->nextDealToProcess;
 			const auto& eTI = pTCD->eTI;
+			const auto& modes = pTCD->modesList;
+			auto nextDealIdx = pTCD->nextDealToProcess;
+			const auto firstDealIdx = nextDealIdx;
 
-			T18_DEBUG_ONLY(size_t _capac);
+			proxy::prxyTsDeal dealsBuf[dealsCopyChunk];
+
+			//unfortunately, we MUST acquire lock because in case vector::push_back(), called in parallel thread,
+			//change the vector capacity, all iterators/pointers will be invalidated. So copying a chunk of deals
+			//at once to reduce the number of lock acquisitions
 			dealsLock_guard_ex_t dlg(pTCD->rawDealsLock);
-			curDealsCnt = dealsVec.size();
-			T18_DEBUG_ONLY(_capac = dealsVec.capacity());
+			T18_ASSERT(dealsVec.capacity() > 0 || pTCD->isDetached() || !"WTF? Deals vector must already be initialized!");
+			while (true) {
+				const size_t curDealsCnt = dealsVec.size();
+				if (nextDealIdx >= curDealsCnt) break;
+
+				const size_t n = ::std::min(dealsCopyChunk, curDealsCnt - nextDealIdx);
+				::std::copy_n(&dealsVec[nextDealIdx], n, dealsBuf);
+				dlg.unlock();
+
+				nextDealIdx += n;
+				pTCD->tsLastConverted = dealsBuf[n - 1].ts;
+				for (const auto& up : modes) {
+					T18_ASSERT(up);
+					_convertDeals(*up, dealsBuf, n, eTI, m_config.unrequestedModeMaxBars());
+				}
+				dlg.lock();
+			}
 			dlg.unlock();
-			T18_ASSERT(_capac > 0 || !"WTF? Deals vector must already be initialized!");
-
-			if (LIKELY(nextDealIdx < curDealsCnt)) {
-				proxy::prxyTsDeal tsd;
-
-				T18_DEBUG_ONLY(mxTimestamp prevTs);
-				T18_DEBUG_ONLY(int prevNLV{ nLastValid });
-				T18_DEBUG_ONLY(bool bFirst{ true });
-				T18_DEBUG_ONLY(bool bJustMoved{ false });
-				const auto maxLastValid = nSize - 1;
-
-				while ( LIKELY(nextDealIdx < curDealsCnt) ) {
-					dlg.lock();//unfortunately, we MUST acquire lock because in case vector::push_back(), called in parallel thread,
-							   //change the vector capacity, all iterators/pointers will be invalidated.
-					tsd = dealsVec[nextDealIdx++];
-					dlg.unlock();
-
-					//checking if we are to shift ami's array
-					if (UNLIKELY(nLastValid >= maxLastValid)) {
-						//we have to shift quotes array uShiftQuotesArrayOffset elements back
-						T18_ASSERT(nLastValid == maxLastValid);
-						nLastValid -= uShiftQuotesArrayOffset;
-						T18_DEBUG_ONLY(prevNLV -= uShiftQuotesArrayOffset);
-						::std::memmove(pQuotes, &pQuotes[uShiftQuotesArrayOffset], sizeof(*pQuotes)*static_cast<unsigned>(nLastValid + 1));
-						T18_DEBUG_ONLY(bJustMoved = true);
-					} else T18_DEBUG_ONLY(bJustMoved = false);
-
-					//for the debug build we must make sure the timestamps are sequential
-				#ifdef T18_DEBUG
-					//timestamps MUST differ from bar to bar. convBase::processDeal() MUST enqueue quotes with different
-					// timestamps, because we can't make them different here (prevTs at first is initialized from already
-					// updated version, written to quotes in previous attempt.
-					Quotation& curQ = pQuotes[nLastValid];//just an address calculation, so don't care about nLastValid
-					if (UNLIKELY(bFirst)) {
-						bFirst = false;
-						if (UNLIKELY(nLastValid < 0)) {
-							prevTs = mxTimestamp(tag_mxTimestamp());
-							m_Log->trace("_doGetQuotes {} (first), src array is empty. nextDealIdx={}", pModeConv->amiName, nextDealIdx - 1);
-						} else {
-							prevTs = AmiDate2Timestamp(curQ.DateTime);
-							m_Log->trace("_doGetQuotes {} (first) nLastValid={}, prevTs={}, orig nextDealIdx={}"
-								, pModeConv->amiName, nLastValid, prevTs.to_string(), nextDealIdx - 1);
-						}
-						prevNLV = nLastValid;
-					} else if (prevNLV != nLastValid) {
-						T18_ASSERT(nLastValid >= 0 && nLastValid < nSize);
-						auto curTs = AmiDate2Timestamp(curQ.DateTime);
-
-						//m_Log->trace("_doGetQuotes {} (next) nLastValid={}, curTs={}, orig nextDealIdx={}"
-						//	, pModeConv->amiName, pTCD->tickerName, nLastValid, curTs.to_string(), nextDealIdx - 1);
-
-						if (curTs <= prevTs) {
-							char _buf[1024];
-							sprintf_s(_buf, "_doGetQuotes - Invalid time of ticker=%s. bJustMoved=%d, nLastValid=%d, prevNLV=%d, curTs=%s, prevTs=%s"
-								, pModeConv->amiName.c_str(), bJustMoved ? 1 : 0, nLastValid, prevNLV
-								, (curTs.empty() ? "!empty!" : ((mxTimestamp(tag_mxTimestamp()) == curTs) ? "!zero!" : curTs.to_string().c_str() ))
-								, (prevTs.empty() ? "!empty!" : ((mxTimestamp(tag_mxTimestamp()) == prevTs) ? "!zero!" : prevTs.to_string().c_str())));
-
-							m_Log->critical(_buf);
-							m_flags.set<_flagsQ2Ami_CheckTheLog>();
-							//T18_ASSERT(!"_doGetQuotes - Invalid time!");
-							T18_COMP_SILENCE_ZERO_AS_NULLPTR;
-							::MessageBox(NULL, _buf, "_doGetQuotes - Invalid time!", MB_OK | MB_ICONERROR);
-							T18_COMP_POP;
-						}
-						prevNLV = nLastValid;
-						prevTs = curTs;
+			if (nextDealIdx != firstDealIdx) {
+				m_flight.record(_Q2Ami::flightEvent::evConvert, _flightTid(pTCD), static_cast<::std::int32_t>(firstDealIdx)
+					, static_cast<::std::int32_t>(nextDealIdx - firstDealIdx));
+			}
+			pTCD->nextDealToProcess = nextDealIdx;
+			pTCD->counters.dealsConverted.store(nextDealIdx, ::std::memory_order_relaxed);
+		}
+
+		//maxUnrequestedBars limits the stage of a mode Ami hasn't requested yet (0 - no limit)
+		static void _convertDeals(convBase_t& m, const proxy::prxyTsDeal*const pDeals, const size_t n, const _Q2Ami::extTickerInfo& eTI
+			, const int maxUnrequestedBars)
+		{
+			auto& stage = m.stage;
+			for (size_t i = 0; i < n; ++i) {
+				// If converter requires more available slots than allowed by nLastValid & nSize, it should update as much as it can
+				// changing nLastValid value and then return number of required free slots to finish parsing tsd. It'll be called again.
+				int convRet;
+				do {
+					//there must be at least one free slot in the stage for a converter to use
+					if (UNLIKELY(static_cast<size_t>(m.stageLastValid + 2) > stage.size())) {
+						stage.resize(::std::max(stageInitialSize, stage.size() * 2));
 					}
-				#endif
-
-					//processing the deal.
-					//nLastValid = pModeConv->processDeal(tsd, eTI, pQuotes, nLastValid, nSize);
-					// If converter requires more available slots than allowed by nLastValid & nSize, it should update as much as it can
-					// changing nLastValid value and then return number of required free slots to finish parsing tsd. It'll be called again.
-					int convRet;
-					T18_DEBUG_ONLY(auto dbg_old_nLastValid = nLastValid);
-					while ( UNLIKELY((convRet = pModeConv->processDeal(tsd, eTI, pQuotes, nLastValid, nSize)) > 0) ) {
-						T18_ASSERT(dbg_old_nLastValid <= nLastValid && nLastValid <= nSize);
-						const auto shiftOffs = ::std::min(convRet + uShiftQuotesArrayOffset, nLastValid );
-						nLastValid -= shiftOffs;
-						T18_DEBUG_ONLY(prevNLV -= shiftOffs);
-						::std::memmove(pQuotes, &pQuotes[shiftOffs], sizeof(*pQuotes)*static_cast<unsigned>(nLastValid + 1));
+					T18_DEBUG_ONLY(const auto dbg_old_nLastValid = m.stageLastValid);
+					convRet = m.processDeal(pDeals[i], eTI, stage.data(), m.stageLastValid, static_cast<int>(stage.size()));
+					T18_ASSERT(dbg_old_nLastValid <= m.stageLastValid && m.stageLastValid < static_cast<int>(stage.size()));
+					if (UNLIKELY(convRet > 0)) {
+						stage.resize(stage.size() + static_cast<size_t>(convRet));
 					}
-					T18_ASSERT(dbg_old_nLastValid <= nLastValid && nLastValid <= nSize);
+				} while (UNLIKELY(convRet > 0));
+			}
+
+			//if the mode isn't requested by Ami for a long time, there's no need to keep more bars than Ami's array could hold.
+			// Size of the array of a mode that was never requested is unknown, then the configured limit is used
+			const int keepBars = m.amiArraySize > 0 ? m.amiArraySize : maxUnrequestedBars;
+			if (UNLIKELY(keepBars > 0 && m.stageLastValid >= 2 * keepBars)) {
+				const int nDrop = m.stageLastValid + 1 - keepBars;
+				::std::memmove(stage.data(), &stage[static_cast<size_t>(nDrop)], sizeof(Quotation)*static_cast<unsigned>(keepBars));
+				m.stageLastValid -= nDrop;
+				m.stageHasDelivered = false;
+			}
+		}
 
-					dlg.lock();
-					curDealsCnt = dealsVec.size();
-					dlg.unlock();
+		//moves buffered mode data into Ami's quotes array. Returns new nLastValid. Must be called under convLock
+		int _deliverStage(convBase_t& m, const ::std::uint16_t flightTid, int nLastValid, const int nSize, Quotation*const pQuotes) {
+			T18_ASSERT(nLastValid < nSize && nLastValid >= -1);
+			m.amiArraySize = nSize;
+			if (m.stageLastValid < 0) return nLastValid;
+
+			int i = 0;
+			if (m.stageHasDelivered) {
+				//the first stage element is a (possibly updated) version of the bar that's already the last in Ami's array
+				if (LIKELY(nLastValid >= 0 && pQuotes[nLastValid].DateTime.Date == m.stage[0].DateTime.Date)) {
+					pQuotes[nLastValid] = m.stage[0];
+					i = 1;
+				} else if (nLastValid >= 0 && pQuotes[nLastValid].DateTime.Date > m.stage[0].DateTime.Date) {
+					m_Log->warn("_deliverStage {}: Ami's array has newer last quote {} than was delivered {}. Skipping it"
+						, m.amiName, AmiDate2Timestamp(pQuotes[nLastValid].DateTime).to_string()
+						, AmiDate2Timestamp(m.stage[0].DateTime).to_string());
+					i = 1;
+				}//else Ami doesn't have the bar anymore, so it'll be appended as usual
+			}
+
+			T18_DEBUG_ONLY(int dbgCheckFrom = nLastValid < 0 ? 0 : nLastValid);
+			const auto maxLastValid = nSize - 1;
+			while (i <= m.stageLastValid) {
+				//checking if we are to shift ami's array
+				if (UNLIKELY(nLastValid >= maxLastValid)) {
+					//we have to shift quotes array uShiftQuotesArrayOffset elements back
+					T18_ASSERT(nLastValid == maxLastValid);
+					m_flight.record(_Q2Ami::flightEvent::evShift, flightTid, nLastValid, uShiftQuotesArrayOffset);
+					nLastValid -= uShiftQuotesArrayOffset;
+					T18_DEBUG_ONLY(dbgCheckFrom = ::std::max(0, dbgCheckFrom - uShiftQuotesArrayOffset));
+					::std::memmove(pQuotes, &pQuotes[uShiftQuotesArrayOffset], sizeof(*pQuotes)*static_cast<unsigned>(nLastValid + 1));
 				}
-				pModeConv->nextDealToProcess = nextDealIdx;
+				const int n = ::std::min(maxLastValid - nLastValid, m.stageLastValid - i + 1);
+				::std::memcpy(&pQuotes[nLastValid + 1], &m.stage[static_cast<size_t>(i)], sizeof(*pQuotes)*static_cast<unsigned>(n));
+				nLastValid += n;
+				i += n;
 			}
-			return nLastValid + 1;
+
+		#ifdef T18_DEBUG
+			//timestamps MUST differ from bar to bar. convBase::processDeal() MUST enqueue quotes with different
+			// timestamps, because we can't make them different here
+			for (int k = dbgCheckFrom + 1; k <= nLastValid; ++k) {
+				if (pQuotes[k].DateTime.Date <= pQuotes[k - 1].DateTime.Date) {
+					const auto curTs = AmiDate2Timestamp(pQuotes[k].DateTime), prevTs = AmiDate2Timestamp(pQuotes[k - 1].DateTime);
+					char _buf[1024];
+					sprintf_s(_buf, "_doGetQuotes - Invalid time of ticker=%s. idx=%d, nLastValid=%d, curTs=%s, prevTs=%s"
+						, m.amiName.c_str(), k, nLastValid
+						, (curTs.empty() ? "!empty!" : ((mxTimestamp(tag_mxTimestamp()) == curTs) ? "!zero!" : curTs.to_string().c_str() ))
+						, (prevTs.empty() ? "!empty!" : ((mxTimestamp(tag_mxTimestamp()) == prevTs) ? "!zero!" : prevTs.to_string().c_str())));
+
+					m_Log->critical(_buf);
+					m_flight.record(_Q2Ami::flightEvent::evInvalidTime, flightTid, k, nLastValid);
+					m_flags.set<_flagsQ2Ami_CheckTheLog>();
+					//T18_ASSERT(!"_doGetQuotes - Invalid time!");
+					T18_COMP_SILENCE_ZERO_AS_NULLPTR;
+					::MessageBox(NULL, _buf, "_doGetQuotes - Invalid time!", MB_OK | MB_ICONERROR);
+					T18_COMP_POP;
+					break;
+				}
+			}
+		#endif
+
+			//the last bar is kept in the stage, because converter may update it later
+			m.stage[0] = m.stage[static_cast<size_t>(m.stageLastValid)];
+			m.stageLastValid = 0;
+			m.stageHasDelivered = true;
+			m.lastKnownQuote = AmiDate2Timestamp(pQuotes[nLastValid].DateTime);
+			return nLastValid;
 		}
 	public:
 
@@ -554,46 +1176,75 @@ namespace t18 {
 		#endif
 
 			T18_ASSERT(m_rti4Update.empty());
+			const auto rcvTs = mxTimestamp::now();
+			const latencyClock_t rcvClock(rcvTs);
+			m_capture.deals(rcvTs, pTrades, cnt);
+			m_flight.record(_Q2Ami::flightEvent::evPacket, _Q2Ami::flightRecorder::noTid, static_cast<::std::int32_t>(cnt));
+			_Q2Ami::counterAdd(m_counters.packets, 1);
+			_Q2Ami::counterAdd(m_counters.deals, cnt);
+			_Q2Ami::counterAdd(m_counters.dealBytes, cnt * sizeof(proxy::prxyTsDeal));
+			m_counters.lastPacketTick.store(::GetTickCount64(), ::std::memory_order_relaxed);
 
 			for (size_t i = 0; i < cnt; ++i) {
 				const auto& tsd = pTrades[i];
 
-				auto pTCD = m_ptrs2TickerCfgData[tsd.tid];
-				//there should never be a race condition accessing m_ptrs2TickerCfgData, because it's modification
+				auto& hot = m_tickersHot[tsd.tid];
+				//there should never be a race condition accessing m_tickersHot, because it's modification
 				// from the main thread happens only in _shutdownCli(), but either the Running flag
 				// was cleared and we were never able to entered here, or the function worked until the end and the network thread
-				// was finished during _shutdownCli(), and m_ptrs2TickerCfgData is still valid.
+				// was finished during _shutdownCli(), and m_tickersHot is still valid.
 
+				const auto pTCD = hot.pTCD;
 				if (LIKELY(pTCD)) {
-					T18_ASSERT(pTCD->rawDeals.capacity() > 0);//seems to be fine here without using syncronization
+					T18_ASSERT(pTCD->rawDeals.capacity() > 0 || pTCD->isDetached());//seems to be fine here without using syncronization
+					_Q2Ami::counterAdd(pTCD->counters.dealsReceived, 1);
 					
-					//checking the time of the deal 
-					if (pTCD->timeSuits(tsd.ts.Time())) {
+					//checking the time of the deal. Tickers removed from config still come from the server, since there's no unsubscribe
+					//deals, that were processed before the restart, are sent again after resuming from the checkpoint
+					if (hot.timeSuits(tsd.ts.Time()) && LIKELY(!pTCD->isDetached()) && LIKELY(!hot.seenBeforeResume(tsd))) {
 
-						if (UNLIKELY(!pTCD->eTI.isDealNumOffsetSpecified())) {
+						if (UNLIKELY(!hot.bDealNumOffsetSpecified)) {
 							//we MUST set deal number offset based on the first - i.e. current deal
 							pTCD->eTI.setDealNumOffset(tsd.dealNum);
+							hot.bDealNumOffsetSpecified = true;
 						}
 
 						{
 							//we MUST acquire lock before accessing, especially for modification rawDeals vector
 							dealsLock_guard_t dlg(pTCD->rawDealsLock);
 							pTCD->rawDeals.push_back(tsd);
+							pTCD->counters.dealsStored.store(pTCD->rawDeals.size(), ::std::memory_order_relaxed);
 						}
-						if (!::std::any_of(m_rti4Update.begin(), m_rti4Update.end(), [pTCD](const auto v) {return v == pTCD; })) {
-							m_rti4Update.emplace_back(pTCD);
+						const auto lagUs = rcvClock.since(tsd.ts);
+						_recordLatency(pTCD, _Q2Ami::dealLatency::stReceipt, lagUs);
+						hot.lastDealTs = tsd.ts;
+						//it's published later once for all deals of the packet
+						hot.pRtInfo->onDeal(tsd, hot.lotSize, lagUs >= 0 && lagUs <= liveDealMaxLagUs);
+						if (!hot.bNotifyQueued) {
+							hot.bNotifyQueued = true;
+							m_rti4Update.emplace_back(tsd.tid);
 						}
-					}//else skipping
+					} else _Q2Ami::counterAdd(pTCD->counters.dealsFiltered, 1);
 				} else {
 					//this actually should never happen
-					m_Log->critical("WTF? Got allTrades message for tid={} we know nothing about!", tsd.tid);
+					Q2AMI_LOG_LIMITED(*m_Log, ::spdlog::level::critical, logLimitedPeriodMs
+						, "WTF? Got allTrades message for tid={} we know nothing about!", tsd.tid);
 				}
 			}
 
 			//finally we must inform Amibroker that there's some new data
-			for (const auto v : m_rti4Update) {
-				_notifyAmi(v);
+			const latencyClock_t ntfClock(mxTimestamp::now());
+			for (const auto tid : m_rti4Update) {
+				auto& hot = m_tickersHot[tid];
+				hot.bNotifyQueued = false;
+				hot.pRtInfo->publish();
+				_notifyAmi(hot.pTCD);
+				_Q2Ami::counterAdd(hot.pTCD->counters.notifications, 1);
+				m_flight.record(_Q2Ami::flightEvent::evNotify, tid
+					, static_cast<::std::int32_t>(hot.pTCD->counters.dealsStored.load(::std::memory_order_relaxed)));
+				_recordLatency(hot.pTCD, _Q2Ami::dealLatency::stNotify, ntfClock.since(hot.lastDealTs));
 			}
+			_Q2Ami::counterAdd(m_counters.notifications, m_rti4Update.size());
 			m_rti4Update.clear();
 		}
 
@@ -603,6 +1254,9 @@ namespace t18 {
 		{
 			if (!m_flags.isSet<_flagsQ2Ami_Running>()) return;
 
+			m_flight.record(_Q2Ami::flightEvent::evSubscribed, pPTI ? pPTI->tid : _Q2Ami::flightRecorder::noTid, pPTI ? 1 : 0);
+			m_capture.subscribed(mxTimestamp::now(), pPTI, pTickerName, pClassName);
+
 			auto pCfgInfo = m_config.find(pTickerName, pClassName);
 			if (LIKELY(pCfgInfo)) {
 
@@ -621,10 +1275,14 @@ namespace t18 {
 						// (for example, change lot size for a next session). We need a mechanism to update that info here
 
 						pCfgInfo->eTI.setPti(pPTI);
-						T18_ASSERT(pPTI->tid < m_ptrs2TickerCfgData.size());
-						T18_ASSERT(!m_ptrs2TickerCfgData[pPTI->tid] || m_ptrs2TickerCfgData[pPTI->tid] == pCfgInfo);						
-						m_ptrs2TickerCfgData[pPTI->tid] = pCfgInfo;
+						T18_ASSERT(pPTI->tid < m_tickersHot.size());
+						T18_ASSERT(!m_tickersHot[pPTI->tid].pTCD || m_tickersHot[pPTI->tid].pTCD == pCfgInfo);
+						m_tickersHot[pPTI->tid].set(pCfgInfo);
 						lk.unlock();
+						//deals since the subscription time are coming next
+						pCfgInfo->pRtInfo->onSubscribed();
+						//the ticker removed from config and then added back starts to receive deals again, see TickerCfgData::reattach()
+						if (UNLIKELY(pCfgInfo->isDetached())) pCfgInfo->attach();
 
 						//querying rawDeals state under protection (should not be necessary, however, just for a case)
 						dealsLock_guard_ex_t dlg(pCfgInfo->rawDealsLock);
@@ -647,6 +1305,7 @@ namespace t18 {
 							dealsLock_guard_t dlg(pCfgInfo->rawDealsLock);
 							pCfgInfo->rawDeals.clear();
 							pCfgInfo->rawDeals.shrink_to_fit();
+							pCfgInfo->counters.dealsStored.store(0, ::std::memory_order_relaxed);
 						}
 
 						m_Log->critical("hndSubscribeAllTradesResult: no such ticker {}@{} on the server!", pTickerName, pClassName);
@@ -660,6 +1319,7 @@ namespace t18 {
 						dealsLock_guard_t dlg(pCfgInfo->rawDealsLock);
 						pCfgInfo->rawDeals.clear();
 						pCfgInfo->rawDeals.shrink_to_fit();
+						pCfgInfo->counters.dealsStored.store(0, ::std::memory_order_relaxed);
 					}
 
 					m_Log->critical("hndSubscribeAllTradesResult: WTF? never issued subscription request for {}@{}"
@@ -684,21 +1344,24 @@ namespace t18 {
 			int ret = nLastValid + 1;
 
 			if (!_isDbLoaded()) return ret;
+			const _Q2Ami::scopedDuration callDuration(m_counters);
 
 			if (UNLIKELY(m_flags.isSet<_flagsQ2Ami_NeverDidGetQuotes>())) {
 				m_flags.clear<_flagsQ2Ami_NeverDidGetQuotes>();
-				m_Log->trace("Skipping first call to GetQuotesEx, ticker={}", pszTicker);
+				SPDLOG_LOGGER_TRACE(m_Log, "Skipping first call to GetQuotesEx, ticker={}", pszTicker);
 				return ret;
 			}
 			
 			if (UNLIKELY(!pszTicker || !Ami_IsTimeBaseOk(nPeriodicity) || !pQuotes || nLastValid >= nSize || nSize <= 0)) {
-				m_Log->warn("Invalid call to GetQuotesEx(per={}, nLastValid={}, nSize={}), ignoring...", nPeriodicity, nLastValid, nSize);
+				Q2AMI_LOG_LIMITED(*m_Log, ::spdlog::level::warn, logLimitedPeriodMs
+					, "Invalid call to GetQuotesEx(per={}, nLastValid={}, nSize={}), ignoring...", nPeriodicity, nLastValid, nSize);
 				return ret;
 			}
 						
 			_Q2Ami::convBase* pModeConv;
 			const ClassDescr_t* pClassDescr;
 			auto* pCfgInfo = m_config.findByAmiTicker(*m_Log.get(), pszTicker, &pModeConv, &pClassDescr);
+			::std::uint16_t flightTid = _Q2Ami::flightRecorder::noTid;
 			if (LIKELY(pCfgInfo)) {
 				T18_ASSERT(pClassDescr && pModeConv);
 				//we MUST hold lock, while accessing mt-related members
@@ -711,7 +1374,9 @@ namespace t18 {
 					if (bSubsIssued) {
 						tsSubsSince = pCfgInfo->tsSubscribedSince;
 					}
+					if (bSubsOk) flightTid = pCfgInfo->eTI.tid;
 				}
+				m_flight.record(_Q2Ami::flightEvent::evGetQuotesEnter, flightTid, nLastValid, nSize);
 
 				if (LIKELY(bSubsIssued)) {
 					//checking if the subscription was successfull
@@ -720,39 +1385,62 @@ namespace t18 {
 						if (LIKELY(pModeConv)) {
 							//it's perfectly valid ticker, already subscribed to trades. Going to process new quotes, if we're
 							//connected or if there're some unprocessed data left
-							bool bLeftUnprocessed;
 							const bool bConnected = State::Connected == m_state;
-							if (!bConnected) {
-								size_t curDealsCnt;
-								{
-									dealsLock_guard_t dlg(pCfgInfo->rawDealsLock);
-									curDealsCnt = pCfgInfo->rawDeals.size();
-								}
-								bLeftUnprocessed = curDealsCnt > pModeConv->nextDealToProcess;
-							} else bLeftUnprocessed = false;
 
-							if (LIKELY(bConnected || bLeftUnprocessed)) {
-								//before the first call to quotes updates, we must rewing Ami's array so that tsSubsSince is the last quote
+							//another Ami thread (a chart and an exploration refreshing the same symbol) may be converting the ticker now.
+							// Since every mode is converted at once, the new data of this mode will be buffered in its stage too, so
+							// instead of waiting for the whole conversion the call returns no new data and Ami is notified about the
+							// ticker again once the converting thread is done
+							convLock_guard_t cl(pCfgInfo->convLock, ::std::try_to_lock);
+							if (UNLIKELY(!cl.owns_lock()) && !_claimBusyTicker(pCfgInfo, cl)) {
+								_Q2Ami::counterAdd(m_counters.getQuotesBusy, 1);
+								m_flight.record(_Q2Ami::flightEvent::evGetQuotesBusy, flightTid, nLastValid, nSize);
+							} else {
+								//before the first call to quotes updates, we must rewind Ami's array so that tsSubsSince is the last quote
 								//to prevent ticks overlaying
-								if (UNLIKELY(pModeConv->nextDealToProcess == 0 && nLastValid >= 0)) { //for first call only	
-									const auto curNLV = nLastValid;
-									const Quotation* pLQ;
-									//also we MUST shift nLastValid to previous day's last quote
-									do {
-										pLQ = &pQuotes[nLastValid];
-									} while ((AmiDate2Timestamp(pLQ->DateTime) >= tsSubsSince) && (--nLastValid >= 0));
-
-									if (curNLV > nLastValid) {
-										m_Log->debug("Before first call to _doGetQuotes({}) had to shrink array from {} to {} ({} elements, {} is the last)"
-											, pszTicker, curNLV, nLastValid, (curNLV - nLastValid)
-											, nLastValid >= 0 ? AmiDate2Timestamp(pLQ->DateTime).to_string() : tsSubsSince.to_string());
+								if (UNLIKELY(!pModeConv->bAmiArrayRewound)) {
+									pModeConv->bAmiArrayRewound = true;
+									if (pCfgInfo->bResumed) {
+										//nothing to rewind, Ami's array must end where the restored state begins
+										if (UNLIKELY(!_canResume(*pModeConv, nLastValid, pQuotes))) {
+											m_Log->warn("Quotes of {} don't match the state restored from checkpoint, the data may have a gap. "
+												"Delete {} before AmiBroker start to re-request the whole day", pszTicker, m_config.pszCheckpointFileName);
+											m_flags.set<_flagsQ2Ami_CheckTheLog>();
+										}
+									} else if (nLastValid >= 0) {
+										//if Ami's array is older than the quote the subscription time was based on, it wasn't saved
+										if (UNLIKELY(!pModeConv->lastKnownQuote.empty() && m_config.subscribeSinceLastQuote()
+											&& AmiDate2Timestamp(pQuotes[nLastValid].DateTime) < pModeConv->resumableSince(pModeConv->lastKnownQuote)
+											&& tsSubsSince > pClassDescr->tradingDayStart()))
+										{
+											m_Log->warn("Quotes of {} end before the last known quote {}, the data may have a gap", pszTicker
+												, pModeConv->lastKnownQuote.to_string());
+											m_flags.set<_flagsQ2Ami_CheckTheLog>();
+										}
+										const auto curNLV = nLastValid;
+										const Quotation* pLQ;
+										//also we MUST shift nLastValid to previous day's last quote
+										do {
+											pLQ = &pQuotes[nLastValid];
+										} while ((AmiDate2Timestamp(pLQ->DateTime) >= tsSubsSince) && (--nLastValid >= 0));
+
+										if (curNLV > nLastValid) {
+											m_Log->debug("Before first call to _doGetQuotes({}) had to shrink array from {} to {} ({} elements, {} is the last)"
+												, pszTicker, curNLV, nLastValid, (curNLV - nLastValid)
+												, nLastValid >= 0 ? AmiDate2Timestamp(pLQ->DateTime).to_string() : tsSubsSince.to_string());
+										}
 									}
 								}
 
 								ret = _doGetQuotes(pCfgInfo, pModeConv, nLastValid, nSize, pQuotes);
-							} else {
-								m_Log->warn("Server disconnected, can't serve _doGetQuotes for {}", pszTicker);
-							}							
+								cl.unlock();
+								_notifySkipped(pCfgInfo);
+
+								if (UNLIKELY(!bConnected && ret <= nLastValid + 1)) {
+									Q2AMI_LOG_LIMITED(*m_Log, ::spdlog::level::warn, logLimitedPeriodMs
+										, "Server disconnected, can't serve _doGetQuotes for {}", pszTicker);
+								}
+							}
 						}
 					} else {
 						//nothing can be done here.
@@ -760,23 +1448,40 @@ namespace t18 {
 				} else {
 					//we must issue subscription order here if we're connected to the server
 					if (State::Connected != m_state) {
-						m_Log->warn("Failing subscription in GetQuotesEx() for {}, because of disconnected state", pszTicker);
+						Q2AMI_LOG_LIMITED(*m_Log, ::spdlog::level::warn, logLimitedPeriodMs
+							, "Failing subscription in GetQuotesEx() for {}, because of disconnected state", pszTicker);
 					} else {
 						//doing subscription
-						const Quotation* pLQ;
-						if (nLastValid < 0) {
+						const Quotation* pLQ = nullptr;
+						//if the state was restored from the checkpoint and Ami's array matches it, subscribing since the last
+						// deal processed before the restart. Another mode of the ticker might have already decided that.
+						bool bResume = false;
+						{
+							convLock_guard_t cl(pCfgInfo->convLock);
+							if (UNLIKELY(pCfgInfo->hasResumeState())) {
+								if (pCfgInfo->bResumed || _canResume(*pModeConv, nLastValid, pQuotes)) {
+									pCfgInfo->bResumed = bResume = true;
+									tsSubsSince = pCfgInfo->resumeTs;
+								} else {
+									m_Log->info("Quotes of {} don't match the state restored from checkpoint, dropping it", pszTicker);
+									pCfgInfo->dropResumeState();
+								}
+							}
+						}
+						_notifySkipped(pCfgInfo);
+
+						if (bResume) {
+							m_Log->info("Resuming {} from checkpoint since {}", pszTicker, tsSubsSince.to_string());
+						} else if (nLastValid < 0) {
 							pLQ = nullptr;
 							tsSubsSince = mxTimestamp(tag_mxTimestamp());
 						} else {							
 							//tsSubsSince = AmiDate2Timestamp(pLQ->DateTime);
 							// we don't know what's the last known quote for each of other Ami tickers that rely on this psTicker@psClass
-							// (by using different mode convertors)
-							// Therefore we had to stick to the start of session/day to make sure that the first obtained quote
+							// (by using different mode convertors), unless it was saved in the previous session.
+							// Therefore we usually had to stick to the start of session/day to make sure that the first obtained quote
 							// is suitable for each converter.
-							tsSubsSince = mxTimestamp::now();
-							if (LIKELY(pClassDescr->bTradingStartsAtPrevDay)) {
-								tsSubsSince = tsSubsSince.prevDayAt(pClassDescr->mxTradingDayBeginsAt);
-							}else tsSubsSince.set_time(pClassDescr->mxTradingDayBeginsAt);
+							tsSubsSince = _subsSince(pCfgInfo, pClassDescr, pModeConv, AmiDate2Timestamp(pQuotes[nLastValid].DateTime));
 
 							const auto curNLV = nLastValid;
 							//now we MUST shift nLastValid to previous day's last quote
@@ -798,54 +1503,15 @@ namespace t18 {
 							}
 							ret = nLastValid + 1;
 						}
-						T18_ASSERT(!tsSubsSince.empty() && ((nLastValid < 0 && !pLQ) || (tsSubsSince > mxTimestamp(tag_mxTimestamp()) && pLQ)));
+						T18_ASSERT(!tsSubsSince.empty() && (bResume || (nLastValid < 0 && !pLQ) || (tsSubsSince > mxTimestamp(tag_mxTimestamp()) && pLQ)));
 
 						m_Log->debug("before subscribeAllTrades for {}, nLastValid={}, tsSubsSince={}", pszTicker, nLastValid
 							, (mxTimestamp(tag_mxTimestamp()) == tsSubsSince ? "!zero!" : tsSubsSince.to_string().c_str()));
 
-						char req[2 * m_config.maxStringCodeLen + qcli_t::sAllTradesRequest_addedBufLen];
-						const int n = m_pCli->makeAllTradesRequest(req, pCfgInfo->tickerName.c_str(), pClassDescr->className.c_str(), tsSubsSince);
-						if (LIKELY(n > 0)) {
-							T18_ASSERT(static_cast<int>(::std::strlen(req)) == n);//strlen not an issue here
-
-							//updating Ticker data
-							{
-								spinlock_guard_t lk(m_spinlock);
-								//must check again if competing thread already did this
-								bSubsIssued = pCfgInfo->unsafe_subscribeWasIssued();
-
-								if (LIKELY(! bSubsIssued)) {
-									T18_ASSERT(pCfgInfo->tsSubscribedSince.empty());
-									pCfgInfo->tsSubscribedSince = tsSubsSince;
-
-									for (const auto& up : pCfgInfo->modesList) {
-										T18_ASSERT(up);
-										up->setPrevQuot(tsSubsSince, pLQ);
-									}
-								}
-							}
-
-							if (UNLIKELY(bSubsIssued)) {
-								m_Log->debug("Whoa, indeed subscribeAllTrades was already issued for {}@{} here! Skipping new requrest"
-									, pCfgInfo->tickerName, pClassDescr->className);
-							} else {
-								//preparing rawDeals
-								T18_ASSERT(pCfgInfo->initRawDealsCapacity > 0);
-								{
-									dealsLock_guard_t dlg(pCfgInfo->rawDealsLock);
-									pCfgInfo->rawDeals.reserve(pCfgInfo->initRawDealsCapacity);
-								}
-
-								m_Log->info("subscribeAllTrades for {}: req={}.\nInitial raw deals capacity is {}", pszTicker, req, pCfgInfo->initRawDealsCapacity);
-
-								//making request and asynchronously waiting for the results
-								m_pCli->post_packet(proxy::ProtoCli2Srv::subscribeAllTrades, req);
-							}
-						} else {
-							m_Log->critical("Failed to create subscribeAllTrades request for {} @ {}", pszTicker, tsSubsSince.to_string());
-						}
+						_subscribe(pCfgInfo, pClassDescr, tsSubsSince, pLQ, bResume, pszTicker);
 					}
 				}
+				m_flight.record(_Q2Ami::flightEvent::evGetQuotesExit, flightTid, ret);
 			}
 			return ret;
 		}
@@ -856,19 +1522,18 @@ namespace t18 {
 		void hndQueryTickerInfoResult(const ::t18::proxy::prxyTickerInfo* const pPTI
 			, const char*const pTickerName, const char*const pClassName)
 		{
-			if (!m_flags.isSet<_flagsQ2Ami_ConfigureInProcess>()) {
-				m_Log->warn("WTF? in hndQueryTickerInfoResult while Configure() is not in process!");
-				return;
-			}
-
-			{
-				network2ami_lock_t lk(m_syncMtx);
-				T18_ASSERT(m_queryTickerInfo.capacity() > 0);//some sanity checks
-				m_queryTickerInfo.emplace_back(pPTI, pTickerName, pClassName);
+			//the request, that waits for the ticker, completes when its last ticker is answered
+			if (UNLIKELY(!m_tickerInfoRequests.respond(_tickerKey(pTickerName, pClassName), TickerInfo(pPTI, pTickerName, pClassName)))) {
+				m_Log->warn("hndQueryTickerInfoResult: {}@{} wasn't requested or came too late, ignoring", pTickerName, pClassName);
 			}
+		}
 
-			m_syncCV.notify_one();
+		static ::std::string _tickerKey(const char*const pTickerName, const char*const pClassName) {
+			::std::string r(pTickerName);
+			r += "@"; r += pClassName;
+			return r;
 		}
+
 		bool Ami_Configure(const char*const /*pszPath*/, InfoSite*const pSite) {
 			T18_ASSERT(pSite);
 			if (!pSite || pSite->nStructSize < static_cast<int>(sizeof(InfoSite)) || !pSite->AddStockNew) {
@@ -899,7 +1564,6 @@ namespace t18 {
 			// provides a means to setup tickers & tickers properties. So we first must issue a request to the t18qsrv
 			// to obtain properties of tickers listed in config, and on receiving the answer we must update Amibroker's
 			// internal data via pointers store in struct InfoSite
-			auto tickrsList = m_config.queryTickersList();
 			const size_t tc = m_config.tickersCount();
 
 			if (tc <= 0) {
@@ -910,39 +1574,51 @@ namespace t18 {
 				return false;
 			}
 
+			const long timeoutMs = timeout_Configure2queryTickerInfo_ms + timeout_Configure2queryTickerInfo_perTicker_ms * static_cast<long>(tc);
 			m_Log->trace("Going to issue synchronous queryTickerInfo using timeout of {}s..."
-				, static_cast<double>(timeout_Configure2queryTickerInfo_ms) / 1000);
+				, static_cast<double>(timeoutMs) / 1000);
 
 			m_flags.set<_flagsQ2Ami_ConfigureInProcess>();
-
-			//we will query/update multithread variables, so we must protect from the race condition
-			network2ami_lock_t lk(m_syncMtx);
-			T18_ASSERT(m_queryTickerInfo.empty());
-			m_queryTickerInfo.reserve(tc);
-			lk.unlock();
-			
-			//sending the request
-			m_pCli->post_packet(proxy::ProtoCli2Srv::queryTickerInfo, ::std::move(tickrsList));
-
-			//waiting for request completion with timeout
-			lk.lock();
-			m_syncCV.wait_for(lk, ::std::chrono::milliseconds(timeout_Configure2queryTickerInfo_ms)
-				, [&qti = m_queryTickerInfo, tc]()
-			{
-				return tc == qti.size();
+			const auto deadline = ::std::chrono::steady_clock::now() + ::std::chrono::milliseconds(timeoutMs);
+
+			//large tickers list is split into chunks that are sent at once, so the server processes them one after another,
+			// while every chunk is a separate request completing independently. Tickers listed more than once are waited for
+			// only in the first chunk that has them
+			::std::vector<::std::vector<::std::string>> chunkKeys;
+			::std::unordered_set<::std::string> allKeys;
+			allKeys.reserve(tc);
+			auto chunks = m_config.queryTickersList(configureChunkSize, [&chunkKeys, &allKeys](const size_t ci, const ::std::string& t, const ::std::string& c) {
+				if (ci >= chunkKeys.size()) chunkKeys.resize(ci + 1);
+				auto k = _tickerKey(t.c_str(), c.c_str());
+				if (LIKELY(allKeys.insert(k).second)) chunkKeys[ci].emplace_back(::std::move(k));
 			});
-			auto _tc = m_queryTickerInfo.size();
-			//releasing the lock here giving the network thread an opportunity to get&fill some delayed data into the m_queryTickerInfo
-			lk.unlock();
-
-			if (!_tc) {
-				m_flags.clear<_flagsQ2Ami_ConfigureInProcess>();
+			T18_ASSERT(chunks.size() == chunkKeys.size());
+
+			m_Log->debug("Sending {} tickers in {} queryTickerInfo requests", tc, chunks.size());
+			::std::vector<::std::pair<tickerInfoRequests_t::requestId_t, tickerInfoRequests_t::future_t>> requests;
+			requests.reserve(chunks.size());
+			for (size_t ci = 0; ci < chunks.size(); ++ci) {
+				//a chunk of duplicates only isn't worth sending
+				if (chunkKeys[ci].empty()) continue;
+				//must be registered before the response might come
+				requests.emplace_back(m_tickerInfoRequests.add(chunkKeys[ci]));
+				m_pCli->post_packet(proxy::ProtoCli2Srv::queryTickerInfo, ::std::move(chunks[ci]));
+			}
 
-				lk.lock();
-				m_queryTickerInfo.clear();
-				m_queryTickerInfo.shrink_to_fit();//non binding, therefore we must use flags, instead of checking vector's capacity
-				lk.unlock();
+			//collecting results of every request in order. Requests left incomplete by the deadline are cancelled, so
+			// anything that comes later is dropped by hndQueryTickerInfoResult()
+			::std::vector<TickerInfo> qti;
+			qti.reserve(tc);
+			size_t chunksLeft = 0;
+			for (auto& r : requests) {
+				if (::std::future_status::ready != r.second.wait_until(deadline)) m_tickerInfoRequests.cancel(r.first);
+				auto res = r.second.get();
+				if (!res.complete()) ++chunksLeft;
+				for (auto& ti : res.values) qti.emplace_back(::std::move(ti));
+			}
+			m_flags.clear<_flagsQ2Ami_ConfigureInProcess>();
 
+			if (qti.empty()) {
 				T18_COMP_SILENCE_ZERO_AS_NULLPTR;
 				::MessageBoxA(NULL, "Either timeout happened or server really returned empty data for the request.\n"
 					"Check logs on both sides.\n"
@@ -950,8 +1626,11 @@ namespace t18 {
 				T18_COMP_POP;
 				return false;
 			}
+			if (chunksLeft > 0) {
+				m_Log->warn("{} of {} queryTickerInfo requests weren't completed in {}ms", chunksLeft, requests.size(), timeoutMs);
+			}
 
-			T18_ASSERT(_tc <= tc);
+			T18_ASSERT(qti.size() <= tc);
 			 
 			//examining the results
 			::std::string report, tickr;
@@ -959,18 +1638,8 @@ namespace t18 {
 			//tickr is used for logging only
 			tickr.reserve(2* m_config.maxStringCodeLen + 3);
 
-			//TickerInfo ti;//we'll copy here element of m_queryTickerInfo to release the lock AFAP. Actual performance of
-			// this function doesn't really matter
 			size_t nAdded = 0;
-			for (_tc = 0; _tc < tc; ++_tc) {
-				lk.lock();
-				if (_tc >= m_queryTickerInfo.size()) {
-					lk.unlock();
-					break;
-				}
-				auto ti{ m_queryTickerInfo[_tc] };
-				lk.unlock();
-
+			for (const auto& ti : qti) {
 				tickr.clear();
 				tickr += ti.tickerCode; tickr += "@"; tickr += ti.classCode;
 
@@ -1017,17 +1686,11 @@ namespace t18 {
 					report += " that is not in the config! Ignored.\n";
 				}
 			}
-			m_flags.clear<_flagsQ2Ami_ConfigureInProcess>();
-
-			lk.lock();
-			m_queryTickerInfo.clear();
-			m_queryTickerInfo.shrink_to_fit();//non binding, therefore we must use flags, instead of checking vector's capacity
-			lk.unlock();
 
 			if (nAdded < m_config.tickerModesCount()) {
 				m_Log->warn("Only {} tickers out of {} possible were added during Ami_Configure. " \
-					"You may also want to increase timeout_Configure2queryTickerInfo_ms={}"
-					, nAdded, m_config.tickerModesCount(), timeout_Configure2queryTickerInfo_ms);
+					"You may also want to increase timeout_Configure2queryTickerInfo_ms={} or timeout_Configure2queryTickerInfo_perTicker_ms={}"
+					, nAdded, m_config.tickerModesCount(), timeout_Configure2queryTickerInfo_ms, timeout_Configure2queryTickerInfo_perTicker_ms);
 				report += "Only "; report += ::std::to_string(nAdded); report += " tickers out of ";
 				report += ::std::to_string(m_config.tickerModesCount());
 				report += " possible were added during Ami_Configure. Check the log!\n";
@@ -1044,17 +1707,29 @@ namespace t18 {
 		}
 		//////////////////////////////////////////////////////////////////////////
 
-		/*RecentInfo * Ami_GetRecentInfo(const char*const pszTicker) {
-			auto pTI = _getTickerRTInfo(pszTicker);
-			RecentInfo* r;
-			if (pTI) {
-				r = pTI->resetRI();
-			} else {
-				m_Log->warn("Ami_GetRecentInfo: No runtime info for {}", pszTicker);
-				r = nullptr;
+		//called from Ami's UI thread by real-time quote window. Never blocks, see RTInfo
+		RecentInfo * Ami_GetRecentInfo(const char*const pszTicker) {
+			if (!_isDbLoaded() || !pszTicker) return nullptr;
+
+			_Q2Ami::convBase* pModeConv;
+			const ClassDescr_t* pClassDescr;
+			//the real-time quote window may also list symbols of other data sources and asks for them on every refresh. Every
+			// message, even filtered by the sinks, takes a slot of the async logger queue, so parse errors aren't logged at all:
+			// the rate limited message below says the same
+			const auto pCfgInfo = m_config.findByAmiTicker(*m_Log.get(), pszTicker, &pModeConv, &pClassDescr, ::spdlog::level::off);
+			if (UNLIKELY(!pCfgInfo)) {
+				Q2AMI_LOG_LIMITED(*m_Log, ::spdlog::level::debug, logLimitedPeriodMs, "Ami_GetRecentInfo: No runtime info for {}", pszTicker);
+				return nullptr;
 			}
-			return r;
-		}*/
+			T18_ASSERT(pModeConv && pClassDescr);
+
+			auto& ri = pModeConv->recentInfo;
+			if (UNLIKELY(!ri.Exchange[0])) {
+				::strncpy_s(ri.Exchange, pClassDescr->className.c_str(), _TRUNCATE);
+			}
+			pCfgInfo->pRtInfo->fill(ri);
+			return &ri;
+		}
 
 		//////////////////////////////////////////////////////////////////////////
 		void Ami_GetStatus(PluginStatus *const pStatus) {
@@ -1070,6 +1745,14 @@ namespace t18 {
 			static constexpr COLORREF clrCodeERROR = RGB(192, 0, 192);
 
 			if (_isDbLoaded()) {
+				_checkCfgChanged();
+				_checkLockStats();
+				if (UNLIKELY(m_flags.isSet<_flagsQ2Ami_CheckTheLog>()) && !m_bFlightDumped) _dumpFlight();
+				if (UNLIKELY(m_flags.isSet<_flagsQ2Ami_SubscribeAllPending>()) && State::Connected == m_state) {
+					m_flags.clear<_flagsQ2Ami_SubscribeAllPending>();
+					_subscribeAll();
+				}
+
 				switch (m_state) {
 				case State::NotInitialized:
 					pStatus->nStatusCode = sCodeWARN;
@@ -1103,7 +1786,9 @@ namespace t18 {
 					pStatus->nStatusCode = sCodeOK;
 					pStatus->clrStatusColor = clrCodeOK;
 					strcpy_s(pStatus->szShortMessage, "Ok");
-					strcpy_s(pStatus->szLongMessage, "Connection succeeded, working as expected");
+					strcpy_s(pStatus->szLongMessage, "Connection succeeded, working as expected.");
+					_statusThroughput(pStatus->szLongMessage);
+					_statusLatency(pStatus->szLongMessage);
 					break;
 
 				case State::QuikServerDisconnected:
@@ -1111,6 +1796,7 @@ namespace t18 {
 					pStatus->clrStatusColor = clrCodeWARN;
 					strcpy_s(pStatus->szShortMessage, "QUIKs server is disconnected!");
 					strcpy_s(pStatus->szLongMessage, "QUIK is not connected to the broker's server. No data will be updated until connection would have been restored.");
+					_statusThroughput(pStatus->szLongMessage);
 					break;
 
 				case State::SomeRequestFailed:
@@ -1118,6 +1804,7 @@ namespace t18 {
 					pStatus->clrStatusColor = clrCodeMinorERR;
 					strcpy_s(pStatus->szShortMessage, "ReqFailed");
 					strcpy_s(pStatus->szLongMessage, "Some request to t18qsrv proxy failed. Check the log for details. Can continue to work.");
+					_statusThroughput(pStatus->szLongMessage);
 					break;
 
 					/*case State::Timeout:
@@ -1132,7 +1819,7 @@ namespace t18 {
 					pStatus->clrStatusColor /= 3;
 					pStatus->clrStatusColor *= 2;
 					strcat_s(pStatus->szShortMessage, "!LOG");
-					strcat_s(pStatus->szLongMessage, " !SEE LOG!");
+					strncat_s(pStatus->szLongMessage, " !SEE LOG!", _TRUNCATE);
 				}
 			} else {
 				pStatus->nStatusCode = sCodeERROR;
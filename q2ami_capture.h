@@ -0,0 +1,306 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "q2ami_supl.h"
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		//Capture file is a tap of everything the plugin receives from t18qsrv, so a session could be replayed later.
+		//File layout: fileHeader, then records. Each record is recHeader followed by payload of recHeader::len bytes:
+		// - recDeals: raw proxy::prxyTsDeal array as it was passed to hndAllTrades()
+		// - recSubscribed: uint8 bOk, proxy::prxyTickerInfo if bOk, then ticker and class names (uint32 length + chars)
+		// - recConnection: uint8 bConnected
+		//Structures are stored as is, so a file is only readable by a build with the same t18 structures layout, that's
+		// checked with sizes stored in the header.
+		struct capture {
+			static constexpr ::std::uint32_t magic = 0x43413251;//"Q2AC"
+			static constexpr ::std::uint16_t version = 1;
+
+			enum recType : ::std::uint8_t {
+				recDeals = 1,
+				recSubscribed,
+				recConnection
+			};
+
+			struct fileHeader {
+				::std::uint32_t magic;
+				::std::uint16_t version;
+				::std::uint16_t dealSize;
+				::std::uint16_t tickerInfoSize;
+				::std::uint16_t _reserved;
+
+				static fileHeader make()noexcept {
+					return fileHeader{ capture::magic, capture::version, static_cast<::std::uint16_t>(sizeof(proxy::prxyTsDeal))
+						, static_cast<::std::uint16_t>(sizeof(proxy::prxyTickerInfo)), 0 };
+				}
+				bool isCompatible()const noexcept {
+					const auto h = make();
+					return magic == h.magic && version == h.version && dealSize == h.dealSize && tickerInfoSize == h.tickerInfoSize;
+				}
+			};
+			static_assert(sizeof(fileHeader) == 12, "");
+
+			struct recHeader {
+				recType type;
+				::std::uint8_t _reserved[3];
+				::std::uint32_t len;
+				//receipt time as AmiDate::Date, i.e. local time with microseconds
+				::std::uint64_t rcvDate;
+			};
+			static_assert(sizeof(recHeader) == 16, "");
+
+			//capture_YYYYMMDD.bin
+			static ::std::string fileName(const mxTimestamp ts) {
+				char buf[32];
+				sprintf_s(buf, "capture_%04d%02d%02d.bin", ts.Year(), ts.Month(), ts.Day());
+				return buf;
+			}
+		};
+
+		//captureWriter is fed by the network thread and writes records from a dedicated low priority thread, so the disk
+		// never stalls the feed. Records are grouped into chunks by the day of receipt and each day goes into its own file.
+		// If the disk can't keep up and more than maxPendingBytes are waiting, new records are dropped and counted.
+		class captureWriter {
+		public:
+			static constexpr size_t maxPendingBytes = 64 * 1024 * 1024;
+
+		protected:
+			struct chunk {
+				int dayKey;
+				mxTimestamp dayTs;
+				::std::string data;
+			};
+
+			::std::string m_dir;
+			::std::thread m_thread;
+			::std::mutex m_mtx;
+			::std::condition_variable m_cv;
+			::std::deque<chunk> m_chunks;
+			size_t m_pendingBytes{ 0 };
+			bool m_bStop{ false };
+
+			::std::atomic<::std::uint64_t> m_bytesWritten{ 0 }, m_recsDropped{ 0 }, m_writeErrors{ 0 };
+
+		public:
+			~captureWriter() {
+				stop();
+			}
+
+			bool isRunning()const noexcept { return m_thread.joinable(); }
+
+			::std::uint64_t bytesWritten()const noexcept { return m_bytesWritten.load(::std::memory_order_relaxed); }
+			::std::uint64_t recordsDropped()const noexcept { return m_recsDropped.load(::std::memory_order_relaxed); }
+			::std::uint64_t writeErrors()const noexcept { return m_writeErrors.load(::std::memory_order_relaxed); }
+
+			void start(::std::string dir) {
+				T18_ASSERT(!isRunning());
+				m_dir = ::std::move(dir);
+				m_bStop = false;
+				m_bytesWritten = m_recsDropped = m_writeErrors = 0;
+				m_thread = ::std::thread([this]() { _run(); });
+			}
+
+			//writes everything pending and stops the thread
+			void stop() {
+				if (!isRunning()) return;
+				{
+					::std::lock_guard<::std::mutex> lk(m_mtx);
+					m_bStop = true;
+				}
+				m_cv.notify_one();
+				m_thread.join();
+			}
+
+			//network thread only
+			void deals(const mxTimestamp rcvTs, const proxy::prxyTsDeal* pDeals, const size_t cnt) {
+				_record(rcvTs, capture::recDeals, cnt * sizeof(proxy::prxyTsDeal), [pDeals, cnt](::std::string& s) {
+					s.append(reinterpret_cast<const char*>(pDeals), cnt * sizeof(proxy::prxyTsDeal));
+				});
+			}
+			void subscribed(const mxTimestamp rcvTs, const proxy::prxyTickerInfo* pPTI, const char* pTicker, const char* pClass) {
+				const auto lt = ::std::strlen(pTicker), lc = ::std::strlen(pClass);
+				const size_t len = 1 + (pPTI ? sizeof(*pPTI) : 0) + 2 * sizeof(::std::uint32_t) + lt + lc;
+				_record(rcvTs, capture::recSubscribed, len, [=](::std::string& s) {
+					s.push_back(pPTI ? 1 : 0);
+					if (pPTI) s.append(reinterpret_cast<const char*>(pPTI), sizeof(*pPTI));
+					_str(s, pTicker, lt);
+					_str(s, pClass, lc);
+				});
+			}
+			void connection(const mxTimestamp rcvTs, const bool bConnected) {
+				_record(rcvTs, capture::recConnection, 1, [bConnected](::std::string& s) { s.push_back(bConnected ? 1 : 0); });
+			}
+
+		protected:
+			static void _str(::std::string& s, const char* p, const size_t l) {
+				const auto l32 = static_cast<::std::uint32_t>(l);
+				s.append(reinterpret_cast<const char*>(&l32), sizeof(l32));
+				s.append(p, l);
+			}
+
+			template<typename F>
+			void _record(const mxTimestamp rcvTs, const capture::recType t, const size_t len, F&& payload) {
+				if (!isRunning()) return;
+				const int dayKey = rcvTs.Year() * 10000 + rcvTs.Month() * 100 + rcvTs.Day();
+				capture::recHeader h;
+				::std::memset(&h, 0, sizeof(h));
+				h.type = t;
+				h.len = static_cast<::std::uint32_t>(len);
+				h.rcvDate = timestamp2AmiDate(rcvTs).Date;
+
+				{
+					::std::lock_guard<::std::mutex> lk(m_mtx);
+					if (UNLIKELY(m_pendingBytes + sizeof(h) + len > maxPendingBytes)) {
+						m_recsDropped.fetch_add(1, ::std::memory_order_relaxed);
+						return;
+					}
+					if (UNLIKELY(m_chunks.empty() || m_chunks.back().dayKey != dayKey)) m_chunks.push_back(chunk{ dayKey, rcvTs, {} });
+					auto& s = m_chunks.back().data;
+					s.append(reinterpret_cast<const char*>(&h), sizeof(h));
+					payload(s);
+					T18_ASSERT(s.length() >= len);
+					m_pendingBytes += sizeof(h) + len;
+				}
+				//the writer wakes up by itself, no need to disturb it on every packet
+			}
+
+			void _run() {
+				::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+				static constexpr auto flushPeriod = ::std::chrono::milliseconds(250);
+
+				int fileDay = 0;
+				::std::unique_ptr<utils::myFile> pF;
+				::std::unique_lock<::std::mutex> lk(m_mtx);
+				while (true) {
+					const bool bStop = m_cv.wait_for(lk, flushPeriod, [this]() { return m_bStop; });
+					while (!m_chunks.empty()) {
+						auto c = ::std::move(m_chunks.front());
+						m_chunks.pop_front();
+						m_pendingBytes -= c.data.length();
+						lk.unlock();
+
+						if (c.dayKey != fileDay) {
+							pF.reset();
+							pF = _open(c.dayTs);
+							fileDay = c.dayKey;
+						}
+						if (pF && c.data.length() == fwrite(c.data.data(), 1, c.data.length(), *pF)) {
+							m_bytesWritten.fetch_add(c.data.length(), ::std::memory_order_relaxed);
+						} else m_writeErrors.fetch_add(1, ::std::memory_order_relaxed);
+						lk.lock();
+					}
+					if (pF) fflush(*pF);
+					if (bStop) break;
+				}
+			}
+
+			//opens the file of the day for appending, the header is written to new files only
+			::std::unique_ptr<utils::myFile> _open(const mxTimestamp dayTs)const {
+				const auto fpath = m_dir + "/" + capture::fileName(dayTs);
+				auto pF = ::std::make_unique<utils::myFile>(fpath.c_str(), "ab");
+				if (!*pF) return nullptr;
+				fseek(*pF, 0, SEEK_END);
+				if (0 == ftell(*pF)) {
+					const auto fh = capture::fileHeader::make();
+					if (1 != fwrite(&fh, sizeof(fh), 1, *pF)) return nullptr;
+				}
+				return pF;
+			}
+		};
+
+		//captureReader reads a capture file record by record
+		class captureReader {
+		protected:
+			utils::myFile m_hF;
+			bool m_bValid{ false };
+
+		public:
+			struct record {
+				capture::recHeader hdr;
+				::std::string payload;
+
+				mxTimestamp rcvTs()const noexcept {
+					AmiDate ad;
+					ad.Date = hdr.rcvDate;
+					return AmiDate2Timestamp(ad);
+				}
+
+				//recDeals only
+				const proxy::prxyTsDeal* deals()const noexcept { return reinterpret_cast<const proxy::prxyTsDeal*>(payload.data()); }
+				size_t dealsCount()const noexcept { return payload.length() / sizeof(proxy::prxyTsDeal); }
+
+				//recSubscribed only. Returns false if the record is malformed
+				bool subscribed(bool& bOk, proxy::prxyTickerInfo& pti, ::std::string& ticker, ::std::string& cls)const {
+					size_t pos = 0;
+					if (payload.length() < 1) return false;
+					bOk = 0 != payload[pos++];
+					if (bOk) {
+						if (payload.length() < pos + sizeof(pti)) return false;
+						::std::memcpy(&pti, payload.data() + pos, sizeof(pti));
+						pos += sizeof(pti);
+					}
+					return _str(pos, ticker) && _str(pos, cls);
+				}
+
+				//recConnection only
+				bool connected()const noexcept { return !payload.empty() && 0 != payload[0]; }
+
+			protected:
+				bool _str(size_t& pos, ::std::string& s)const {
+					::std::uint32_t l;
+					if (payload.length() < pos + sizeof(l)) return false;
+					::std::memcpy(&l, payload.data() + pos, sizeof(l));
+					pos += sizeof(l);
+					if (payload.length() < pos + l) return false;
+					s.assign(payload.data() + pos, l);
+					pos += l;
+					return true;
+				}
+			};
+
+			explicit captureReader(const char* pPath) : m_hF(pPath, "rb") {
+				capture::fileHeader fh;
+				m_bValid = m_hF && 1 == fread(&fh, sizeof(fh), 1, m_hF) && fh.isCompatible();
+			}
+
+			//false if the file doesn't exist or was written by an incompatible build
+			bool isValid()const noexcept { return m_bValid; }
+
+			//returns false at the end of file or on a truncated record (the tail of a file being written)
+			bool next(record& r) {
+				if (!m_bValid) return false;
+				if (1 != fread(&r.hdr, sizeof(r.hdr), 1, m_hF)) return false;
+				r.payload.resize(r.hdr.len);
+				return 0 == r.hdr.len || r.hdr.len == fread(&r.payload[0], 1, r.hdr.len, m_hF);
+			}
+		};
+
+	}
+}
@@ -23,11 +23,19 @@
 #include <map>
 #include <memory>
 #include <forward_list>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
+#include <unordered_map>
 
 #include "../t18/t18/utils/spinlock.h"
 #include "../t18/t18/base_filesystem.h"
 
 #include "q2ami_convs.h"
+#include "q2ami_rti.h"
+#include "q2ami_hist.h"
+#include "q2ami_locks.h"
+#include "q2ami_metrics.h"
 
 namespace t18 {
 
@@ -37,17 +45,23 @@ namespace t18 {
 		class TickerCfgData {
 		public:
 			typedef ModesVector modesVector_t;
-			typedef utils::spinlock dealsLock_t;
-			typedef utils::spinlock_guard_ex dealsLock_guard_ex_t;
-			typedef utils::spinlock_guard dealsLock_guard_t;
+			typedef instrumentedLock<utils::spinlock> dealsLock_t;
+			typedef ::std::unique_lock<dealsLock_t> dealsLock_guard_ex_t;
+			typedef ::std::lock_guard<dealsLock_t> dealsLock_guard_t;
+
+			typedef ::std::mutex convLock_t;
+			typedef ::std::unique_lock<convLock_t> convLock_guard_t;
 
 		public:
 			const ::std::string tickerName;
+			const ::std::string className;
 
 			const mxTime removeTimeBefore;
 			const mxTime removeTimeInclAfter;
 
-			const modesVector_t modesList;
+			//modes added on config reload are appended by the thread that loads the config (see Cfg::reload()), others
+			// are never changed
+			modesVector_t modesList;
 
 			const size_t initRawDealsCapacity;
 
@@ -78,11 +92,45 @@ namespace t18 {
 			//rawDeals MUST also be accessed with syncronization, because though once created they are never modified from different
 			//threads, they can be moved during vector extension
 
+			//set when the ticker is removed from the config during a reload. If the ticker is added back, it's cleared once
+			// the ticker is subscribed again, see reattach(). It's next to rawDealsLock, because both are touched by the network
+			// thread for every deal
+			::std::atomic<bool> bDetached{ false };
+
+			//All modes of the ticker are converted at once in a single pass over rawDeals, no matter which of them was
+			// requested by Ami. Results are buffered in convBase::stage until Ami asks for them.
+			// convLock protects nextDealToProcess and every mode object of modesList (including its stage).
+			// GetQuotesEx() never waits for it while another Ami thread converts the ticker, see bConvSkipped
+			size_t nextDealToProcess{ 0 };
+			mutable convLock_t convLock;
+			//set by GetQuotesEx() calls that found convLock busy and returned without new data. The thread that holds
+			// convLock notifies Ami about the ticker once it's done, so Ami requests the skipped modes again
+			::std::atomic<bool> bConvSkipped{ false };
+			//exchange time of the last converted deal. Protected by convLock
+			mxTimestamp tsLastConverted;
+
+			//latencies of the ticker deals. Updated from any thread
+			dealLatency latency;
+			//counters for monitoring, see Q2Ami::_describeMetrics()
+			tickerCounters counters;
+
+			//data for Ami's real-time quote window. Updated from the network thread, read from Ami's UI thread.
+			//Points to a record of Cfg's RTInfoPool and is assigned once during config loading
+			RTInfo* pRtInfo{ nullptr };
+
+			//timestamp and number of the last deal processed before the plugin was unloaded. Set when the state of modes
+			// and pRtInfo was restored from the checkpoint file (see Cfg::loadCheckpoint()), cleared once the state was
+			// used or dropped. These three are protected by convLock (the network thread reads them only after the subscription)
+			mxTimestamp resumeTs;
+			dealnum_t resumeDealNum{ 0 };
+			//set if the subscription is issued from resumeTs instead of the beginning of the trading day
+			bool bResumed{ false };
+
 			//////////////////////////////////////////////////////////////////////////
 
 		public:
-			TickerCfgData(const char* p, mxTime fB, mxTime fA, modesVector_t&& mv, size_t expectedRawDeals)
-				: tickerName(p)
+			TickerCfgData(const char* p, const ::std::string& cls, mxTime fB, mxTime fA, modesVector_t&& mv, size_t expectedRawDeals)
+				: tickerName(p), className(cls)
 				, removeTimeBefore(fB), removeTimeInclAfter(fA)
 				, modesList(::std::move(mv))
 				, initRawDealsCapacity(expectedRawDeals)
@@ -97,10 +145,49 @@ namespace t18 {
 			//bool unsafe_subscribeWasSuccessfull()const noexcept { return pti.isValid(); }
 			bool unsafe_subscribeWasSuccessfull()const noexcept { return eTI.isPtiValid(); }
 
-			bool timeSuits(const mxTime t)const noexcept {
-				T18_ASSERT(!t.empty());
-				return (removeTimeBefore.empty() || (removeTimeBefore <= t))
-					&& (removeTimeInclAfter.empty() || (t < removeTimeInclAfter));
+			bool isDetached()const noexcept { return bDetached.load(::std::memory_order_relaxed); }
+
+			//Detaches the ticker from the data stream. There's no way to unsubscribe from the server, so the network thread
+			// just drops new deals of the ticker. Freeing memory of the deals received so far
+			void detach() {
+				bDetached.store(true, ::std::memory_order_relaxed);
+				dealsLock_guard_t dlg(rawDealsLock);
+				rawDeals.clear();
+				rawDeals.shrink_to_fit();
+				counters.dealsStored.store(0, ::std::memory_order_relaxed);
+			}
+
+			//Resets the state of a detached ticker, that is added back to the config, so it's subscribed again as a new one.
+			// If the ticker was subscribed before, the server still sends its deals, so it's kept detached until the new
+			// subscription is answered (see attach()) and then the deals are received since the beginning again.
+			//Must be called by the thread that loads the config before the ticker is published in a config index.
+			void reattach() {
+				T18_ASSERT(isDetached());
+				convLock_guard_t cl(convLock);
+				const bool bHasStream = eTI.isPtiValid() || unsafe_subscribeWasIssued();
+				onResetConnection();
+				tsLastConverted.clear();
+				bConvSkipped.store(false, ::std::memory_order_relaxed);
+				if (pRtInfo) pRtInfo->reset();
+				if (!bHasStream) bDetached.store(false, ::std::memory_order_relaxed);
+			}
+			//network thread only, called when the subscription of a reattached ticker is answered
+			void attach()noexcept {
+				bDetached.store(false, ::std::memory_order_relaxed);
+			}
+
+			bool hasResumeState()const noexcept { return !resumeTs.empty(); }
+
+			//forgets the state restored from the checkpoint. Must be called under convLock before the ticker is subscribed
+			void dropResumeState()noexcept {
+				for (const auto& up : modesList) {
+					T18_ASSERT(up);
+					up->_resetConnection();
+				}
+				if (pRtInfo) pRtInfo->reset();
+				resumeTs.clear();
+				resumeDealNum = 0;
+				bResumed = false;
 			}
 
 			//expecting it be called when network thread is shutdown, therefore it should run in singlethreaded context
@@ -109,9 +196,62 @@ namespace t18 {
 					T18_ASSERT(up);
 					up->_resetConnection();
 				}
+				nextDealToProcess = 0;
+				counters.dealsConverted.store(0, ::std::memory_order_relaxed);
 				//pti = proxy::prxyTickerInfo::createInvalid();
 				eTI.reset();
 				tsSubscribedSince.clear();
+				resumeTs.clear();
+				bResumed = false;
+			}
+		};
+
+		//TickerHotData holds copies of TickerCfgData fields, that the network thread reads for every deal. They are kept
+		// in a compact array indexed by the server's ticker id (Q2Ami::m_tickersHot), so per deal processing doesn't touch
+		// cold parts of TickerCfgData. Network thread only.
+		struct TickerHotData {
+			TickerCfgData* pTCD{ nullptr };
+			RTInfo* pRtInfo{ nullptr };
+			mxTime removeTimeBefore, removeTimeInclAfter;
+			proxy::volume_lots_t lotSize{ 0 };
+			//deals up to and including this one were already processed before the restart, so they must be skipped.
+			// Empty if the ticker wasn't resumed or a newer deal was received
+			mxTimestamp resumeTs;
+			dealnum_t resumeDealNum{ 0 };
+			//exchange time of the last deal received
+			mxTimestamp lastDealTs;
+			bool bDealNumOffsetSpecified{ false };
+			//ticker is already queued for Ami notification
+			bool bNotifyQueued{ false };
+
+			//must be called when eTI has got the ticker info
+			void set(TickerCfgData*const p)noexcept {
+				T18_ASSERT(p && p->eTI.isPtiValid());
+				pTCD = p;
+				pRtInfo = p->pRtInfo;
+				removeTimeBefore = p->removeTimeBefore;
+				removeTimeInclAfter = p->removeTimeInclAfter;
+				lotSize = p->eTI.lotSize;
+				if (p->bResumed) {
+					resumeTs = p->resumeTs;
+					resumeDealNum = p->resumeDealNum;
+				} else resumeTs.clear();
+				bDealNumOffsetSpecified = p->eTI.isDealNumOffsetSpecified();
+				bNotifyQueued = false;
+			}
+
+			bool timeSuits(const mxTime t)const noexcept {
+				T18_ASSERT(!t.empty());
+				return (removeTimeBefore.empty() || (removeTimeBefore <= t))
+					&& (removeTimeInclAfter.empty() || (t < removeTimeInclAfter));
+			}
+
+			//returns true if the deal was already processed before the restart
+			bool seenBeforeResume(const proxy::prxyTsDeal& tsd)noexcept {
+				if (LIKELY(resumeTs.empty())) return false;
+				if (tsd.ts < resumeTs || (tsd.ts == resumeTs && tsd.dealNum <= resumeDealNum)) return true;
+				resumeTs.clear();
+				return false;
 			}
 		};
 
@@ -140,12 +280,31 @@ namespace t18 {
 			};
 		}
 
+		//code16_t is a ticker or class code stored zero padded in 16 bytes. Codes are short (see Cfg::maxStringCodeLen),
+		// so they are compared as two 64 bit words instead of strings
+		struct code16_t {
+			::std::uint64_t w[2];
+
+			code16_t()noexcept : w{ 0, 0 } {}
+			//too long string makes an empty code, that never matches anything
+			code16_t(const char*const p, const size_t len)noexcept : w{ 0, 0 } {
+				if (LIKELY(len < sizeof(w))) ::std::memcpy(w, p, len);
+			}
+			explicit code16_t(const ::std::string& s)noexcept : code16_t(s.data(), s.length()) {}
+
+			bool empty()const noexcept { return 0 == w[0]; }
+			bool operator==(const code16_t& o)const noexcept { return w[0] == o.w[0] && w[1] == o.w[1]; }
+			bool operator!=(const code16_t& o)const noexcept { return !(*this == o); }
+		};
+
 		//ClassDescr describes a class/board of instruments, i.e. class name, index in classes storage and list of tickers
 		struct ClassDescr {
 			typedef TickerCfgData TickerCfgData_t;
-			typedef ::std::forward_list<TickerCfgData_t> TickersList_t;
+			//points to tickers owned by Cfg
+			typedef ::std::vector<TickerCfgData_t*> TickersList_t;
 
 			const ::std::string className;
+			const code16_t classCode;
 			TickersList_t tickersList;
 			const size_t classIndex;
 
@@ -153,8 +312,99 @@ namespace t18 {
 			const bool bTradingStartsAtPrevDay;
 
 			ClassDescr(const ::std::string& cn, const size_t ci, const mxTime mxT, const bool bTSaPD)
-				: className(cn), tickersList(), classIndex(ci), mxTradingDayBeginsAt(mxT), bTradingStartsAtPrevDay(bTSaPD)
+				: className(cn), classCode(cn), tickersList(), classIndex(ci), mxTradingDayBeginsAt(mxT), bTradingStartsAtPrevDay(bTSaPD)
 			{}
+
+			//timestamp of the beginning of the current trading day
+			mxTimestamp tradingDayStart()const {
+				auto ts = mxTimestamp::now();
+				if (LIKELY(bTradingStartsAtPrevDay)) {
+					ts = ts.prevDayAt(mxTradingDayBeginsAt);
+				} else ts.set_time(mxTradingDayBeginsAt);
+				return ts;
+			}
+		};
+
+		//CfgIndex is a snapshot of configured classes and tickers. It's built by the thread that loads the config and
+		// is never modified after publishing (see Cfg), so any thread may read it.
+		//Tickers are found by their ticker&class codes in O(1) with an open addressing hash table, that stores codes
+		// in place, so a lookup doesn't touch TickerCfgData objects until the match is found.
+		struct CfgIndex {
+			struct slot_t {
+				code16_t tickerCode, classCode;
+				TickerCfgData* p{ nullptr };//nullptr means empty slot
+			};
+
+			::std::vector<ClassDescr> classes;
+
+		protected:
+			//classIndex -> class
+			::std::vector<const ClassDescr*> m_byId;
+			::std::vector<slot_t> m_table;
+			size_t m_mask{ 0 };
+
+			static size_t _hash(const code16_t& t, const code16_t& c)noexcept {
+				::std::uint64_t h = (t.w[0] * 0x9E3779B97F4A7C15ull) ^ (t.w[1] * 0xC2B2AE3D27D4EB4Full)
+					^ (c.w[0] * 0x165667B19E3779F9ull) ^ (c.w[1] * 0x27D4EB2F165667C5ull);
+				h ^= h >> 29;
+				return static_cast<size_t>(h);
+			}
+
+		public:
+			//must be called once when classes are filled
+			void build() {
+				size_t n = 0, maxId = 0;
+				for (const auto& e : classes) {
+					n += e.tickersList.size();
+					maxId = ::std::max(maxId, e.classIndex);
+				}
+
+				m_byId.assign(classes.empty() ? 0 : maxId + 1, nullptr);
+				//keeping load factor under 0.5
+				size_t sz = 16;
+				while (sz < 2 * n) sz <<= 1;
+				m_table.assign(sz, slot_t());
+				m_mask = sz - 1;
+
+				for (const auto& e : classes) {
+					m_byId[e.classIndex] = &e;
+					for (const auto p : e.tickersList) {
+						const code16_t tc(p->tickerName);
+						auto i = _hash(tc, e.classCode) & m_mask;
+						while (m_table[i].p && !(m_table[i].tickerCode == tc && m_table[i].classCode == e.classCode)) {
+							i = (i + 1) & m_mask;
+						}
+						//duplicate ticker: the first one wins
+						if (!m_table[i].p) {
+							auto& s = m_table[i];
+							s.tickerCode = tc;
+							s.classCode = e.classCode;
+							s.p = p;
+						}
+					}
+				}
+			}
+
+			TickerCfgData* find(const code16_t& t, const code16_t& c)const noexcept {
+				if (UNLIKELY(m_table.empty() || t.empty() || c.empty())) return nullptr;
+				auto i = _hash(t, c) & m_mask;
+				while (const auto p = m_table[i].p) {
+					if (m_table[i].tickerCode == t && m_table[i].classCode == c) return p;
+					i = (i + 1) & m_mask;
+				}
+				return nullptr;
+			}
+
+			//there are only a few classes, so the linear search over codes is just fine
+			const ClassDescr* findClass(const code16_t& c)const noexcept {
+				for (const auto& e : classes) {
+					if (e.classCode == c) return &e;
+				}
+				return nullptr;
+			}
+			const ClassDescr* classById(const size_t id)const noexcept {
+				return id < m_byId.size() ? m_byId[id] : nullptr;
+			}
 		};
 
 		class Cfg {
@@ -172,12 +422,20 @@ namespace t18 {
 			typedef typename TickerCfgData_t::dealsLock_guard_ex_t dealsLock_guard_ex_t;
 			typedef typename TickerCfgData_t::dealsLock_guard_t dealsLock_guard_t;
 
+			typedef typename TickerCfgData_t::convLock_t convLock_t;
+			typedef typename TickerCfgData_t::convLock_guard_t convLock_guard_t;
+
+			//classes with their tickers. Once published, an index is never modified, a new one is created instead
+			typedef CfgIndex CfgIndex_t;
+
 			static constexpr size_t maxStringCodeLen = 15;
 			static constexpr size_t maxPfxIdStringLen = 5;
 			static_assert(sizeof(modePfxId_t) == 2, "update maxPfxIdStringLen");
 
 			static inline constexpr const char pszConfigFileName[] = "cfg.ini";
 			static inline constexpr const char pszLockFileName[] = "lock.pid";
+			static inline constexpr const char pszCheckpointFileName[] = "checkpoint.bin";
+			static inline constexpr const char pszLastQuotesFileName[] = "lastquotes.txt";
 
 			static inline constexpr const char pszMoexFuturesBoardCode[] = "SPBFUT";
 
@@ -185,34 +443,84 @@ namespace t18 {
 			typedef typename ClassDescr_t::TickersList_t TickersList_t;
 
 			static constexpr int _defaultExpDailyDealsCount = 1000;
+			static constexpr int _defaultUnrequestedModeMaxBars = 100000;
 
-			//classTickersList stores a list of tickers for each class/board
-			::std::vector<ClassDescr> classTickersList;
+			static constexpr ::std::uint32_t _checkpointMagic = 0x50433251;//"Q2CP"
+			//must be changed whenever the format of the checkpoint or of any state saved to it changes
+			static constexpr ::std::uint32_t _checkpointVersion = 2;
+
+			//server identifies subscribed tickers with 8 bit ids (proxy::prxyTsDeal::tid)
+			static constexpr size_t _maxServerTickers = 256;
+
+			//Config could be reloaded while the network thread and Ami's threads are running (see reload()), so it's
+			// RCU-like: tickers live in m_tickersStorage that only grows and never moves its elements, while readers
+			// walk the current index obtained with _index(). The reload creates new index and publishes it with a single
+			// atomic store. Replaced indices are kept in m_retiredIdx until clearAll(), because some thread may still use them.
+			::std::forward_list<TickerCfgData_t> m_tickersStorage;
+			::std::unique_ptr<CfgIndex_t> m_upIndex;
+			::std::atomic<const CfgIndex_t*> m_pIndex{ nullptr };
+			::std::vector<::std::unique_ptr<CfgIndex_t>> m_retiredIdx;
+
+			//classIndex -> className. Classes ids must not change during a session, because they are parts of Ami tickers
+			::std::vector<::std::string> m_classIds;
 
 			::std::string serverIp;
-			unsigned _tickersCnt, _totalModesTickersCount;
+			unsigned _tickersCnt{ 0 }, _totalModesTickersCount{ 0 };
 			::std::uint16_t serverPort{ 0 };
 			bool m_bClassNameAsId{ true }, m_bHideTickerModeName{ true };
 
+			//max number of symbols in Ami's real-time quote window
+			int m_rtSymbolsLimit{ maxRtSymbolsLimit() };
+			RTInfoPool m_rtPool;
+
+			//save converters state to the checkpoint file on DB unload
+			bool m_bCheckpoint{ true };
+
+			//subscribe all tickers right after the connection instead of waiting for Ami to request them
+			bool m_bSubscribeOnConnect{ false };
+			//subscribe since the earliest last quote of ticker's modes instead of the beginning of the trading day
+			bool m_bSubscribeSinceLastQuote{ false };
+			//period of writing metrics file, 0 disables it
+			unsigned m_metricsPeriodSec{ 0 };
+			//tee everything received from t18qsrv to daily capture files
+			bool m_bCapture{ false };
+			//max number of converted bars kept for a mode Ami hasn't requested yet, 0 - unlimited
+			int m_unrequestedModeMaxBars{ _defaultUnrequestedModeMaxBars };
+			//ticker[@class] patterns of tickers to subscribe first
+			::std::vector<::std::string> m_subscribePriority;
+
+			::std::string m_dbPath, m_cfgPath;
+			//last write time of the config file when it was read
+			::std::uint64_t m_cfgWriteTime{ 0 };
+
 			_impl::WinAPI_HANDLE_keeper m_hLockFile;
 
 		protected:
-			ClassDescr* _find_class(const char*const pClass)noexcept {
-				T18_ASSERT(pClass);
-				if (LIKELY(pClass)) {
-					for (auto& e : classTickersList) {
-						if (e.className == pClass) return &e;
-					}
+			//safe to call from any thread
+			const CfgIndex_t& _index()const noexcept {
+				const auto p = m_pIndex.load(::std::memory_order_acquire);
+				T18_ASSERT(p);
+				return *p;
+			}
+
+			//for index that is being built
+			static ClassDescr* _find_class(::std::vector<ClassDescr>& classes, const ::std::string& cls)noexcept {
+				for (auto& e : classes) {
+					if (e.className == cls) return &e;
 				}
 				return nullptr;
 			}
-			const ClassDescr* _find_class(const char*const pClass)const noexcept {
-				return const_cast<self_t*>(this)->_find_class(pClass);
+
+			//returns id of the class, assigning the next free id to unknown class. Config loading thread only
+			size_t _classId(const ::std::string& classCode) {
+				const auto it = ::std::find(m_classIds.begin(), m_classIds.end(), classCode);
+				if (it != m_classIds.end()) return static_cast<size_t>(it - m_classIds.begin());
+				m_classIds.push_back(classCode);
+				return m_classIds.size() - 1;
 			}
 
 			::std::string _makeAmiTickerName(const ::std::string& tickerCode, const ::std::string& classCode
-				, const ClassDescr*const pCD//can be nullptr!
-				, const char*const pMode, const size_t modeId)const
+				, const size_t classId, const char*const pMode, const size_t modeId)const
 			{
 				T18_ASSERT(pMode && !tickerCode.empty() && !classCode.empty());
 				if (modeId > ::std::numeric_limits<modePfxId_t>::max()) {
@@ -228,10 +536,7 @@ namespace t18 {
 				r += tickerCode; r += "@";
 				
 				if (m_bClassNameAsId) {
-					r += ::std::to_string(pCD 
-						? pCD->classIndex
-						: classTickersList.size()//class hasn't been added yet, it'll have this ID when added
-					);
+					r += ::std::to_string(classId);
 				}else r += classCode;
 
 				if (!m_bHideTickerModeName) {
@@ -242,13 +547,22 @@ namespace t18 {
 				return r;
 			}
 
+			template<typename...Args>
+			static void _logFindErr(::spdlog::logger& lgr, const ::spdlog::level::level_enum lvl, const char*const fmt, const Args&...args) {
+				if (lvl != ::spdlog::level::off) lgr.log(lvl, fmt, args...);
+			}
+
 		public:
+			Cfg() : m_upIndex(::std::make_unique<CfgIndex_t>()) {
+				m_pIndex.store(m_upIndex.get(), ::std::memory_order_release);
+			}
 
-			//Parses full ticker name and returns it's parts
+			//Parses full ticker name and returns it's parts. Unknown names are logged with errLvl (level::off - aren't logged at all)
 			TickerCfgData* findByAmiTicker(::spdlog::logger& lgr, const char*const pszAmiTicker
 				, OUT convBase**const ppConvModeObj
 				//, OUT const ::std::string**const ppsTicker, OUT const ::std::string**const ppsClass
 				, OUT const ClassDescr**const ppClassDescr
+				, const ::spdlog::level::level_enum errLvl = ::spdlog::level::critical
 			)
 			{
 				T18_ASSERT(ppConvModeObj && ppClassDescr);
@@ -280,31 +594,24 @@ namespace t18 {
 							if (LIKELY(modeidLen > 0 && modeidLen <= maxPfxIdStringLen)) {
 
 								//now all parts seems to be good. Trying to match to what we expect. Starting with class code
+								const auto& idx = _index();
 								//it can be an id
-								ClassDescr* pCD{nullptr};
+								const ClassDescr* pCD{nullptr};
 								if (m_bClassNameAsId) {
 									const auto icid = ::std::atoi(pTickerEnd + 1);
-									const auto cid = static_cast<size_t>(icid);
-									if (UNLIKELY(icid<0 || cid>classTickersList.size())) {
-										lgr.critical("{}{}, invalid class id={}", _logPfx, pszAmiTicker, icid);
+									if (UNLIKELY(icid < 0)) {
+										_logFindErr(lgr, errLvl, "{}{}, invalid class id={}", _logPfx, pszAmiTicker, icid);
 										return nullptr;
 									}
-									for (auto& e : classTickersList) {
-										if (e.classIndex == cid) {
-											pCD = &e;
-											break;
-										}
-									}
+									pCD = idx.classById(static_cast<size_t>(icid));
 									if (UNLIKELY(!pCD)) {
-										lgr.critical("{}{}, failed to find class with id={}", _logPfx, pszAmiTicker, icid);
+										_logFindErr(lgr, errLvl, "{}{}, failed to find class with id={}", _logPfx, pszAmiTicker, icid);
 										return nullptr;
 									}
 								} else {
-									char pClass[maxStringCodeLen + 1];
-									if (UNLIKELY(::strncpy_s(pClass, pTickerEnd + 1, classLen))) throw ::std::runtime_error("WTF? Failed to copy string");
-									pCD = _find_class(pClass);
+									pCD = idx.findClass(code16_t(pTickerEnd + 1, classLen));
 									if (UNLIKELY(!pCD)) {
-										lgr.critical("{}{}, failed to find class={}", _logPfx, pszAmiTicker, pClass);
+										_logFindErr(lgr, errLvl, "{}{}, failed to find class={}", _logPfx, pszAmiTicker, ::std::string(pTickerEnd + 1, classLen));
 										return nullptr;
 									}
 								}
@@ -313,37 +620,30 @@ namespace t18 {
 								*ppClassDescr = pCD;
 
 								//trying to find ticker of the class
-								char tmpStr[maxStringCodeLen + 1];
-								if (UNLIKELY(::strncpy_s(tmpStr, pszAmiTicker, tickerLen))) throw ::std::runtime_error("WTF? Failed to copy string");
-								TickerCfgData* pTCD{ nullptr };
-								for (auto& e : pCD->tickersList) {
-									if (tmpStr == e.tickerName) {
-										pTCD = &e;
-										break;
-									}
-								}
+								TickerCfgData* pTCD = idx.find(code16_t(pszAmiTicker, tickerLen), pCD->classCode);
 								if (UNLIKELY(!pTCD)) {
-									lgr.critical("{}{}, failed to find ticker={}", _logPfx, pszAmiTicker, tmpStr);
+									_logFindErr(lgr, errLvl, "{}{}, failed to find ticker={}", _logPfx, pszAmiTicker, ::std::string(pszAmiTicker, tickerLen));
 									return nullptr;
 								}
 								//*ppsTicker = &pTCD->tickerName;
 
 								//finally trying to find tickers' mode
+								char tmpStr[maxStringCodeLen + 1];
 								const auto modeid = ::std::atoi(pModeNameEnd + 1);
 								if (UNLIKELY(!bNoModename && 0 != ::strncpy_s(tmpStr, pClassEnd + 1, modeNameLen))) 
 									throw ::std::runtime_error("WTF? Failed to copy string");
 								const auto pModeConv = pTCD->modesList.findMode(modeid, bNoModename ? nullptr : tmpStr);
 								if (UNLIKELY(!pModeConv)) {
-									lgr.critical("{}{}, failed to find mode={}", _logPfx, pszAmiTicker, modeid);
+									_logFindErr(lgr, errLvl, "{}{}, failed to find mode={}", _logPfx, pszAmiTicker, modeid);
 									return nullptr;
 								}
 								*ppConvModeObj = pModeConv;
 								return pTCD;
 
-							} else lgr.critical("{}{}, wrong modeid len={}", _logPfx, pszAmiTicker, modeidLen);
-						}else lgr.critical("{}{}, wrong mode name len={}", _logPfx, pszAmiTicker, modeNameLen);
-					} else lgr.critical("{}{}, wrong class len={}", _logPfx, pszAmiTicker, classLen);
-				} else lgr.critical("{}{}, wrong ticker len={}", _logPfx, pszAmiTicker, tickerLen);
+							} else _logFindErr(lgr, errLvl, "{}{}, wrong modeid len={}", _logPfx, pszAmiTicker, modeidLen);
+						}else _logFindErr(lgr, errLvl, "{}{}, wrong mode name len={}", _logPfx, pszAmiTicker, modeNameLen);
+					} else _logFindErr(lgr, errLvl, "{}{}, wrong class len={}", _logPfx, pszAmiTicker, classLen);
+				} else _logFindErr(lgr, errLvl, "{}{}, wrong ticker len={}", _logPfx, pszAmiTicker, tickerLen);
 				return nullptr;
 			}
 
@@ -352,11 +652,31 @@ namespace t18 {
 			auto ServerPort()const noexcept { return serverPort; }
 			size_t tickersCount()const noexcept { return _tickersCnt; }
 			size_t tickerModesCount()const noexcept { return _totalModesTickersCount; }
+			int rtSymbolsLimit()const noexcept { return m_rtSymbolsLimit; }
+			//the largest number of Ami tickers the plugin could ever serve: every server subscription in every known mode.
+			// It's the limit until the config is loaded
+			static constexpr int maxRtSymbolsLimit()noexcept {
+				return static_cast<int>(_maxServerTickers * ModesCreator_t::knownModesCount);
+			}
+			bool subscribeOnConnect()const noexcept { return m_bSubscribeOnConnect; }
+			const ::std::string& dbPath()const noexcept { return m_dbPath; }
+			bool subscribeSinceLastQuote()const noexcept { return m_bSubscribeSinceLastQuote; }
+			unsigned metricsPeriodSec()const noexcept { return m_metricsPeriodSec; }
+			bool capture()const noexcept { return m_bCapture; }
+			int unrequestedModeMaxBars()const noexcept { return m_unrequestedModeMaxBars; }
 
 			bool isValid()const noexcept {
+				const auto& cls = _index().classes;
 				return serverPort > 1000 && !serverIp.empty() && _tickersCnt > 0 && _totalModesTickersCount > 0
-					&& !classTickersList.empty() && !classTickersList.begin()->className.empty()
-					&& !classTickersList.begin()->tickersList.empty() && !classTickersList.begin()->tickersList.front().tickerName.empty();
+					&& !cls.empty() && !cls.front().className.empty()
+					&& !cls.front().tickersList.empty() && !cls.front().tickersList.front()->tickerName.empty();
+			}
+
+			//returns true if the config file was changed since it was read last time
+			bool cfgFileChanged()const noexcept {
+				if (m_cfgPath.empty()) return false;
+				const auto t = _fileWriteTime(m_cfgPath);
+				return t && t != m_cfgWriteTime;
 			}
 
 		protected:
@@ -370,8 +690,14 @@ namespace t18 {
 				return fpath;
 			}
 
+			static ::std::uint64_t _fileWriteTime(const ::std::string& fpath)noexcept {
+				WIN32_FILE_ATTRIBUTE_DATA fad;
+				if (!::GetFileAttributesExA(fpath.c_str(), GetFileExInfoStandard, &fad)) return 0;
+				return (static_cast<::std::uint64_t>(fad.ftLastWriteTime.dwHighDateTime) << 32) | fad.ftLastWriteTime.dwLowDateTime;
+			}
+
 			static ::std::string _defConfig() {
-				char _buf[2048];
+				char _buf[4096];
 				sprintf_s(_buf, "# default config, edit as necessary\n\n"
 					"# server's ip&port address:\n"
 					"serverIp = 111.222.113.224\n"
@@ -380,6 +706,22 @@ namespace t18 {
 					"classnameAsId = 1\n"
 					"# only ticker mode ID will be printed to Ami's ticker name if nonzero\n"
 					"hideTickerModeName = 1\n\n"
+					"# max number of symbols in real-time quote window. 0 means all configured Ami tickers\n"
+					"rtSymbolsLimit = 0\n\n"
+					"# save state of tickers on DB unload to continue from it instead of re-requesting all the day's deals\n"
+					"checkpoint = 1\n\n"
+					"# subscribe all tickers on connection instead of the first request of a ticker from Ami\n"
+					"subscribeOnConnect = 0\n"
+					"# comma separated ticker[@class] patterns (* and ? wildcards) to subscribe first\n"
+					"subscribePriority = \n"
+					"# subscribe since the last quote known for every mode of a ticker instead of the beginning of the trading day\n"
+					"subscribeSinceLastQuote = 0\n\n"
+					"# write plugin metrics in Prometheus text format to metrics.prom of the DB directory every N seconds. 0 disables\n"
+					"metricsPeriodSec = 0\n\n"
+					"# tee all data received from t18qsrv to capture_YYYYMMDD.bin of the DB directory\n"
+					"capture = 0\n\n"
+					"# max number of bars kept in memory for an Ami ticker that wasn't requested by Ami yet. 0 means unlimited\n"
+					"unrequestedModeMaxBars = %d\n\n"
 					"# specify category of tickers to fetch using classCode as [section name]\n"
 					"# On MOEX.com the TQBR code is used for the stock market section and the SPBFUT for the derivatives market\n"
 					"# QJSIM is used in a QUIK Junior (QUIK's demo) program to address simulated data for stock market\n"
@@ -416,7 +758,7 @@ namespace t18 {
 					"tradingDayBeginsAtPrevDay = 1\n"
 					"tradingDayBeginsAt = 190000\n\n"
 
-					, static_cast<unsigned>(proxy::defaultServerTcpPort));
+					, static_cast<unsigned>(proxy::defaultServerTcpPort), _defaultUnrequestedModeMaxBars);
 				return ::std::string(_buf);
 			}
 
@@ -469,68 +811,208 @@ namespace t18 {
 				m_hLockFile.close();
 				serverIp.clear();
 				serverPort = 0;
-				classTickersList.clear();
+
+				//indices must be cleared before tickers, and tickers before the pool of real-time data records
+				m_retiredIdx.clear();
+				m_upIndex = ::std::make_unique<CfgIndex_t>();
+				m_pIndex.store(m_upIndex.get(), ::std::memory_order_release);
+				m_tickersStorage.clear();
+				m_rtPool.clear();
+
+				m_classIds.clear();
 				_tickersCnt = _totalModesTickersCount = 0;
+				m_rtSymbolsLimit = maxRtSymbolsLimit();
+				m_bCheckpoint = true;
+				m_bSubscribeOnConnect = false;
+				m_bSubscribeSinceLastQuote = false;
+				m_subscribePriority.clear();
+				m_metricsPeriodSec = 0;
+				m_bCapture = false;
+				m_unrequestedModeMaxBars = _defaultUnrequestedModeMaxBars;
+				m_dbPath.clear();
+				m_cfgPath.clear();
+				m_cfgWriteTime = 0;
 			}
 
 			void logDealsStorageUseCount(::spdlog::logger& lgr)const noexcept {
 				lgr.info("logDealsStorageUseCount {");
-				for (const auto& e : classTickersList) {
-					for (const auto& td : e.tickersList) {
-						dealsLock_guard_ex_t lk(td.rawDealsLock);
-						const auto s = td.rawDeals.size();
-						const auto cap = td.rawDeals.capacity();
+				for (const auto& e : _index().classes) {
+					for (const auto ptd : e.tickersList) {
+						dealsLock_guard_ex_t lk(ptd->rawDealsLock);
+						const auto s = ptd->rawDeals.size();
+						const auto cap = ptd->rawDeals.capacity();
 						lk.unlock();
 
-						lgr.info("{}@{} has used {} of {} total tick storage", e.className, td.tickerName, s, cap);
+						lgr.info("{}@{} has used {} of {} total tick storage", e.className, ptd->tickerName, s, cap);
 					}
 				}
 				lgr.info("logDealsStorageUseCount }");
 			}
 
+			//calls f(const TickerCfgData&, const ClassDescr&) for every ticker of the current index. Safe to call from any thread
+			template<typename F>
+			void forEachTicker(F&& f)const {
+				for (const auto& e : _index().classes) {
+					for (const auto ptd : e.tickersList) f(*ptd, e);
+				}
+			}
+
+			//logs rawDealsLock counters of every ticker or only of those that were contended
+			void logLockStats(::spdlog::logger& lgr, const bool bContendedOnly)const {
+				::std::string s;
+				for (const auto& e : _index().classes) {
+					for (const auto ptd : e.tickersList) {
+						const auto& st = ptd->rawDealsLock.stats();
+						if (bContendedOnly && !st.wasContended()) continue;
+						st.describe(s, (ptd->tickerName + "@" + e.className).c_str());
+					}
+				}
+				if (!s.empty()) lgr.info("rawDealsLock stats:\n{}", s);
+			}
+
 			bool readFromPath(::spdlog::logger& lgr, const char*const pszPath) {
 				clearAll();
 
 				if (!_acquireDbLock(lgr, pszPath)) return false;
 
-				::std::string fpath{ _makeFileName(pszPath, pszConfigFileName) };
+				m_dbPath = pszPath;
+				m_cfgPath = _makeFileName(pszPath, pszConfigFileName);
 
-				if (!::utils::myFile::exist(fpath.c_str())) {
-					lgr.warn("No config file found at {}, creating new one", fpath);
+				if (!::utils::myFile::exist(m_cfgPath.c_str())) {
+					lgr.warn("No config file found at {}, creating new one", m_cfgPath);
 					//creating and reading
-					utils::myFile hF(fpath.c_str(), "w");
+					utils::myFile hF(m_cfgPath.c_str(), "w");
 					auto cfg = _defConfig();
 					fwrite(cfg.data(), 1, cfg.length(), hF);
 				}
 
-				//file exists, must read and parse it
-				INIReader reader(fpath);
-				if (reader.ParseError() != 0) {
-					lgr.error("Failed to parse cfg '{}', error={}", fpath, reader.ParseError());
-					return false;
-				}
+				size_t nNew, nRemoved, nNewModes;
+				return _load(lgr, false, nNew, nRemoved, nNewModes, [](TickerCfgData_t&, ::std::unique_ptr<convBase_t>&&) {
+					T18_ASSERT(!"WTF? Modes are never added on initial load");
+				});
+			}
+
+			//Re-reads the config file of the loaded DB and applies the difference to the current config: new tickers
+			// are created, tickers no longer listed are detached, tickers listed again after the removal are reattached.
+			// Existing tickers are kept as is, so their subscriptions and received deals survive, only converters of new
+			// modes are added to them with fAddMode(TickerCfgData&, ::std::unique_ptr<convBase>&&), that must append the mode
+			// to modesList. Must be called from the thread that loads the config.
+			//Returns true if the set of tickers or modes has changed.
+			template<typename F>
+			bool reload(::spdlog::logger& lgr, OUT size_t& nNew, OUT size_t& nRemoved, OUT size_t& nNewModes, F&& fAddMode) {
+				nNew = nRemoved = nNewModes = 0;
+				if (m_cfgPath.empty()) return false;
+				return _load(lgr, true, nNew, nRemoved, nNewModes, ::std::forward<F>(fAddMode)) && (nNew > 0 || nRemoved > 0 || nNewModes > 0);
+			}
 
-				serverIp = reader.Get("", "serverIp", "");
-				if (serverIp.empty()) {
+		protected:
+			bool _loadGlobals(::spdlog::logger& lgr, const INIReader& reader, const bool bReload) {
+				const auto sIp = reader.Get("", "serverIp", "");
+				if (sIp.empty()) {
 					lgr.error("Failed to parse serverIp");
 					return false;
 				}
-				lgr.info("serverIp = {}", serverIp);
 
 				auto port = reader.GetInteger("", "serverPort", 0);
 				if (port < 1000 || ::std::numeric_limits<decltype(serverPort)>::max() <= port) {
 					lgr.error("Invalid port={} specified! Must be in range (1000,2^16)", port);
 					return false;
 				}
-				serverPort = static_cast<decltype(serverPort)>(port);
-				lgr.info("serverPort = {}", serverPort);
 
-				m_bClassNameAsId = (0 != reader.GetInteger("", "classnameAsId", 1));
-				m_bHideTickerModeName = (0 != reader.GetInteger("", "hideTickerModeName", 1));
-				lgr.info("classnameAsId = {}, hideTickerModeName = {}", m_bClassNameAsId, m_bHideTickerModeName);
+				const bool bClassNameAsId = (0 != reader.GetInteger("", "classnameAsId", 1));
+				const bool bHideTickerModeName = (0 != reader.GetInteger("", "hideTickerModeName", 1));
+
+				if (bReload) {
+					//these define connection and names of Ami tickers, so can't be changed on the fly
+					if (sIp != serverIp || static_cast<decltype(serverPort)>(port) != serverPort
+						|| bClassNameAsId != m_bClassNameAsId || bHideTickerModeName != m_bHideTickerModeName)
+					{
+						lgr.warn("Changes of serverIp, serverPort, classnameAsId or hideTickerModeName require AmiBroker restart. Ignoring them");
+					}
+				} else {
+					serverIp = sIp;
+					lgr.info("serverIp = {}", serverIp);
+					serverPort = static_cast<decltype(serverPort)>(port);
+					lgr.info("serverPort = {}", serverPort);
+
+					m_bClassNameAsId = bClassNameAsId;
+					m_bHideTickerModeName = bHideTickerModeName;
+					lgr.info("classnameAsId = {}, hideTickerModeName = {}", m_bClassNameAsId, m_bHideTickerModeName);
+				}
+				return true;
+			}
+
+			typedef ::std::vector<::std::pair<TickerCfgData*, ::std::unique_ptr<convBase_t>>> newModes_t;
+
+			//creates converters for modes of modeNames, that the known ticker doesn't have yet. Their Ami names get the next
+			// mode ids, so ids of existing modes never change. Modes removed from the config are kept until the restart
+			void _diffModes(::spdlog::logger& lgr, const INIReader& reader, ModesCreator_t& MCreator, TickerCfgData& td
+				, const ::std::string& ccode, const size_t classId, const tradingDayDescr& tdd
+				, const ::std::vector<::std::string>& modeNames, OUT newModes_t& newModes)
+			{
+				const auto& ml = td.modesList;
+				for (const auto& up : ml) {
+					if (modeNames.end() == ::std::find(modeNames.begin(), modeNames.end(), up->modeName)) {
+						lgr.warn("Mode {} of {}@{} has been removed from config. It requires AmiBroker restart, keeping it"
+							, up->modeName, td.tickerName, ccode);
+					}
+				}
+
+				for (const auto& sMode : modeNames) {
+					if (ml.findMode(sMode.c_str())) continue;
+					//the ticker could be listed in the config twice
+					size_t nAdded = 0;
+					bool bAdded = false;
+					for (const auto& e : newModes) {
+						if (e.first != &td) continue;
+						++nAdded;
+						bAdded = bAdded || sMode == e.second->modeName;
+					}
+					if (bAdded) continue;
+
+					const auto modeId = ml.size() + nAdded;
+					if (modeId >= ml.capacity()) {
+						lgr.warn("Too many modes added to {}@{}. Mode {} requires AmiBroker restart", td.tickerName, ccode, sMode);
+						continue;
+					}
+					if (auto up = _createMode(lgr, reader, MCreator, ccode, td.tickerName, classId, tdd, sMode, modeId)) {
+						newModes.emplace_back(&td, ::std::move(up));
+					}
+				}
+			}
+
+			//parses the config file. On initial load everything is created from scratch. On reload the result is diffed against
+			// the current index: only new tickers and new modes of known tickers get converters. Nothing is changed until
+			// the whole config is validated, then the new index is published.
+			template<typename F>
+			bool _load(::spdlog::logger& lgr, const bool bReload, OUT size_t& nNew, OUT size_t& nRemoved, OUT size_t& nNewModes
+				, F&& fAddMode)
+			{
+				nNew = nRemoved = nNewModes = 0;
+				//must be taken before reading to not miss changes made during the reading
+				m_cfgWriteTime = _fileWriteTime(m_cfgPath);
+
+				//file exists, must read and parse it
+				INIReader reader(m_cfgPath);
+				if (reader.ParseError() != 0) {
+					lgr.error("Failed to parse cfg '{}', error={}", m_cfgPath, reader.ParseError());
+					return false;
+				}
+
+				if (!_loadGlobals(lgr, reader, bReload)) return false;
+
+				const CfgIndex_t& oldIdx = _index();
+				T18_ASSERT(bReload || oldIdx.classes.empty());
+				auto upIdx = ::std::make_unique<CfgIndex_t>();
+				auto& newClasses = upIdx->classes;
+				newClasses.reserve(::std::max(oldIdx.classes.size(), size_t(2)));//generally it's enough. If it's not enough, it'll just resize
 
 				ModesCreator_t MCreator;
-				classTickersList.reserve(2);//generally it's enough. If it's not enough, it'll just resize
+				//new tickers are created in the separate list, which is moved into m_tickersStorage only if the config is valid
+				::std::forward_list<TickerCfgData_t> newStorage;
+				::std::vector<TickerCfgData*> newTickers, reattached;
+				newModes_t newModes;
+				::std::vector<::std::string> modeNames;
 
 				const auto& classCodes = reader.Sections();
 				for (const auto& ccode : classCodes) {
@@ -549,12 +1031,18 @@ namespace t18 {
 
 						const int defExpDailyDealsCount = reader.GetInteger(ccode, "defExpDailyDealsCount", _defaultExpDailyDealsCount);
 
-						::std::string tickers = reader.Get(ccode, "tickers", "");
+						::std::string tickers = _expandTickers(lgr, reader, ccode);
 						if (UNLIKELY(tickers.empty())) {
 							if (!ccode.empty()) lgr.warn("tickers are empty for classCode={}. skipping...", ccode);
 						} else {
-							auto pClassDescr = _find_class(ccode.c_str());
-							TickersList_t* pList = pClassDescr ? &pClassDescr->tickersList : nullptr;
+							const code16_t classCode(ccode);
+							const auto pOldClassDescr = oldIdx.findClass(classCode);
+							auto pClassDescr = _find_class(newClasses, ccode);
+							//known class keeps its settings, see below
+							const auto pTDDescr = pClassDescr ? pClassDescr : pOldClassDescr;
+							const tradingDayDescr tdd = pTDDescr
+								? tradingDayDescr{ pTDDescr->mxTradingDayBeginsAt, pTDDescr->bTradingStartsAtPrevDay }
+								: tradingDayDescr{ tradingDayBeginsAt, bTradingDayBeginsAtPrevDay };
 
 							//parsing individual ticker codes from the comma-separated string
 							//ugly (prior to c++17, but ok later) trick with const_cast
@@ -565,58 +1053,57 @@ namespace t18 {
 								if (LIKELY(szTl <= maxStringCodeLen)) {
 									::std::string sTicker(pTicker);
 
-									const int tickerSessStart = reader.GetInteger(ccode, sTicker + "_sessionStart", defSessionStart);
-									const int tickerSessEnd = reader.GetInteger(ccode, sTicker + "_sessionEnd", defSessionEnd);
-
-									const int tickerExpDailyDealsCount = reader.GetInteger(ccode, sTicker + "_ExpDailyDealsCount", defExpDailyDealsCount);
-
-									//parsing modes and creating corresponding objects
+									//parsing modes list
 									::std::string tickerModes = reader.Get(ccode, sTicker + "_modes", defModes);
-									if (UNLIKELY(tickerModes.empty())) {
+									modeNames.clear();
+									char* _mctx;
+									const char* pMode = ::strtok_s(const_cast<char*>(tickerModes.data()), ",", &_mctx);
+									while (pMode) {
+										if (LIKELY(MCreator.find(pMode))) {
+											modeNames.emplace_back(pMode);
+										} else {
+											lgr.critical("Failed to find mode {} for ticker {}@{}. Skipping", pMode, sTicker, ccode);
+										}
+										pMode = ::strtok_s(nullptr, ",", &_mctx);
+									}
+
+									TickerCfgData* pTCD = nullptr;
+									const size_t classId = pClassDescr ? pClassDescr->classIndex : _classId(ccode);
+									if (UNLIKELY(modeNames.empty())) {
 										lgr.critical("Empty modes list for ticker {}@{}, skipping ticker", sTicker, ccode);
+									} else if (auto pOld = oldIdx.find(code16_t(sTicker), classCode)) {
+										//the ticker is already known, it must be kept as is. Only new modes are added to it
+										pTCD = pOld;
+										_diffModes(lgr, reader, MCreator, *pOld, ccode, classId, tdd, modeNames, newModes);
+									} else if (auto pDetached = bReload ? _findDetached(ccode, sTicker) : nullptr) {
+										//the ticker was removed from config earlier, it'll be subscribed again
+										pTCD = pDetached;
+										if (reattached.end() == ::std::find(reattached.begin(), reattached.end(), pDetached)) {
+											reattached.push_back(pDetached);
+										}
+										_diffModes(lgr, reader, MCreator, *pDetached, ccode, classId, tdd, modeNames, newModes);
+										lgr.info("Ticker {}@{} has been added back to config", sTicker, ccode);
 									} else {
-										modesVector_t mv;
-										mv.reserve(static_cast<unsigned>(::std::count(tickerModes.begin(), tickerModes.end(), ',')) + 1u);
-
-										char* _mctx;
-										const char* pMode = ::strtok_s(const_cast<char*>(tickerModes.data()), ",", &_mctx);
-										while (pMode) {
-											const auto pCreator = MCreator.find(pMode);
-											if (LIKELY(pCreator)) {
-												// essentially calls converter's static fromCfg()
-												mv.push_back((*pCreator)(lgr
-													, _makeAmiTickerName(sTicker, ccode, pClassDescr, pMode, mv.size())
-													, sTicker, ccode, reader));
-
-												if (mv.back()) {
-													++_totalModesTickersCount;
-												} else {
-													lgr.critical("Failed to create mode {} for ticker {}@{}. Skipping", pMode, sTicker, ccode);
-													mv.pop_back();
-												}
-											} else {
-												lgr.critical("Failed to find mode {} for ticker {}@{}. Skipping", pMode, sTicker, ccode);
-											}
-											pMode = ::strtok_s(nullptr, ",", &_mctx);
+										pTCD = _createTicker(lgr, reader, MCreator, newStorage, ccode, sTicker, classId, tdd, modeNames
+											, defSessionStart, defSessionEnd, defExpDailyDealsCount);
+										if (pTCD) {
+											newTickers.push_back(pTCD);
+											if (bReload) lgr.info("Ticker {}@{} has been added to config", sTicker, ccode);
 										}
+									}
 
-										if (UNLIKELY(mv.empty())) {
-											lgr.critical("Failed to parse modes list for ticker {}@{}, skipping ticker", sTicker, ccode);
-										} else {
-											if (!pList) {
-												classTickersList.emplace_back(ccode, classTickersList.size()
-													, tradingDayBeginsAt, bTradingDayBeginsAtPrevDay);
-												pClassDescr = &classTickersList.back();
-												pList = &pClassDescr->tickersList;
+									if (pTCD) {
+										if (!pClassDescr) {
+											//class settings of a known class aren't changed, because subscriptions depend on them
+											if (pOldClassDescr) {
+												newClasses.emplace_back(pOldClassDescr->className, pOldClassDescr->classIndex
+													, pOldClassDescr->mxTradingDayBeginsAt, pOldClassDescr->bTradingStartsAtPrevDay);
+											} else {
+												newClasses.emplace_back(ccode, _classId(ccode), tradingDayBeginsAt, bTradingDayBeginsAtPrevDay);
 											}
-
-											pList->emplace_front(pTicker
-												, _parseTime(tickerSessStart), _parseTime(tickerSessEnd), ::std::move(mv)
-												, static_cast<size_t>(tickerExpDailyDealsCount > 0
-													? tickerExpDailyDealsCount : _defaultExpDailyDealsCount)
-											);
-											++_tickersCnt;
+											pClassDescr = &newClasses.back();
 										}
+										pClassDescr->tickersList.push_back(pTCD);
 									}
 								} else {
 									lgr.critical("ticker={} for classCode={} is too long to be correct ({} > {}). Skipping"
@@ -631,19 +1118,87 @@ namespace t18 {
 							, ccode, ccode.length(), maxStringCodeLen);
 					}
 				}
+
+				if (newClasses.empty()) {
+					//everything created so far is freed here
+					lgr.error("Failed to read tickers!");
+					return false;
+				}
+				upIdx->build();
+				m_tickersStorage.splice_after(m_tickersStorage.before_begin(), newStorage);
+
+				//tickers that are no longer in config are detached, i.e. all their received data is dropped.
+				for (const auto& e : oldIdx.classes) {
+					for (const auto ptd : e.tickersList) {
+						if (upIdx->find(code16_t(ptd->tickerName), e.classCode) != ptd) {
+							ptd->detach();
+							++nRemoved;
+							lgr.info("Ticker {}@{} has been removed from config", ptd->tickerName, e.className);
+						}
+					}
+				}
+				nNew = newTickers.size() + reattached.size();
+
+				//real-time data records for new tickers are allocated in one go
+				m_rtPool.reserve(newTickers.size());
+				for (auto ptd : newTickers) {
+					ptd->pRtInfo = m_rtPool.acquire();
+				}
+				//reattached tickers aren't visible to other threads yet
+				for (auto ptd : reattached) ptd->reattach();
+
+				nNewModes = newModes.size();
+				for (auto& e : newModes) {
+					lgr.info("Mode {} has been added to {}@{}", e.second->modeName, e.first->tickerName, e.first->className);
+					fAddMode(*e.first, ::std::move(e.second));
+				}
+
+				if (!bReload || nNew > 0 || nRemoved > 0) {
+					_publish(::std::move(upIdx));
+				} else if (nNewModes > 0) _countTickers();
+
 				if (!isValid()) {
 					lgr.error("Failed to read tickers!");
 					return false;
 				}
+				if (_tickersCnt > _maxServerTickers) {
+					lgr.warn("{} tickers configured, but server can't handle more than {} subscriptions", _tickersCnt, _maxServerTickers);
+				}
+
+				//non positive value means every Ami ticker could be shown in the real-time quote window
+				const auto rtLim = reader.GetInteger("", "rtSymbolsLimit", 0);
+				m_rtSymbolsLimit = rtLim > 0 ? static_cast<int>(::std::min(rtLim, static_cast<long>(::std::numeric_limits<int>::max())))
+					: static_cast<int>(_totalModesTickersCount);
+				lgr.info("rtSymbolsLimit = {}", m_rtSymbolsLimit);
+
+				m_bCheckpoint = (0 != reader.GetInteger("", "checkpoint", 1));
+
+				m_bSubscribeOnConnect = (0 != reader.GetInteger("", "subscribeOnConnect", 0));
+				m_bSubscribeSinceLastQuote = (0 != reader.GetInteger("", "subscribeSinceLastQuote", 0));
+				m_subscribePriority.clear();
+				{
+					auto sPrio = reader.Get("", "subscribePriority", "");
+					char* _ctx = nullptr;
+					for (const char* p = ::strtok_s(const_cast<char*>(sPrio.data()), ", \t", &_ctx); p; p = ::strtok_s(nullptr, ", \t", &_ctx)) {
+						m_subscribePriority.emplace_back(p);
+					}
+				}
+				if (m_bSubscribeOnConnect) lgr.info("subscribeOnConnect is set, {} priority patterns", m_subscribePriority.size());
+
+				const auto metricsPeriod = reader.GetInteger("", "metricsPeriodSec", 0);
+				m_metricsPeriodSec = metricsPeriod > 0 ? static_cast<unsigned>(::std::min(metricsPeriod, 86400L)) : 0;
+				m_bCapture = (0 != reader.GetInteger("", "capture", 0));
+				const auto maxBars = reader.GetInteger("", "unrequestedModeMaxBars", _defaultUnrequestedModeMaxBars);
+				m_unrequestedModeMaxBars = maxBars > 0 ? static_cast<int>(::std::min(maxBars, static_cast<long>(::std::numeric_limits<int>::max() / 2))) : 0;
 
 				//log what we've parsed
 				if (lgr.level() <= ::spdlog::level::trace) {
-					for (const auto& e : classTickersList) {
+					for (const auto& e : _index().classes) {
 						::std::string s;
 						s.reserve(_tickersCnt*(maxStringCodeLen + 1 + 32) + 1);
-						for (const auto& td : e.tickersList) {
-							s += td.tickerName;
-							s += "(cap="; s += ::std::to_string(td.rawDeals.capacity());
+						for (const auto ptd : e.tickersList) {
+							s += ptd->tickerName;
+							s += "(cap="; s += ::std::to_string(ptd->rawDeals.capacity());
 							s += "),";
 						}
 						lgr.trace("For classCode {} (idx={}) tickers are: {}", e.className, e.classIndex, s);
@@ -653,45 +1208,468 @@ namespace t18 {
 				return true;
 			}
 
-			//returns tickers list in format <class-code>(<ticker-1>(?:,<ticker-i>)*)
-			::std::string queryTickersList()const noexcept {
-				T18_ASSERT(isValid());
+			//matches str against pattern with * (any sequence) and ? (any single char) wildcards
+			static bool _wildcardMatch(const char* pat, const char* str)noexcept {
+				const char* pStar = nullptr;
+				const char* pStarStr = nullptr;
+				while (*str) {
+					if (*pat == '*') {
+						pStar = pat++;
+						pStarStr = str;
+					} else if (*pat == '?' || *pat == *str) {
+						++pat;
+						++str;
+					} else if (pStar) {
+						pat = pStar + 1;
+						str = ++pStarStr;
+					} else return false;
+				}
+				while (*pat == '*') ++pat;
+				return !*pat;
+			}
+
+			//reads instrument codes from the file. Codes are separated by commas, spaces or line breaks
+			static ::std::vector<::std::string> _readInstrumentsList(const ::std::string& fpath) {
+				::std::vector<::std::string> r;
+				if (!::utils::myFile::exist(fpath.c_str())) return r;
+
+				utils::myFile hF(fpath.c_str(), "r");
+				char buf[1024];
+				while (::fgets(buf, sizeof(buf), hF)) {
+					char* _ctx;
+					const char* p = ::strtok_s(buf, ", \t\r\n", &_ctx);
+					while (p) {
+						r.emplace_back(p);
+						p = ::strtok_s(nullptr, ", \t\r\n", &_ctx);
+					}
+				}
+				return r;
+			}
+
+			//returns comma-separated "tickers" list of the class with wildcard patterns (like * or Si*) replaced by matching
+			// codes from the class instruments list file. The server has no request to list instruments of a class, so the
+			// list must be exported from QUIK to the file "<classCode>_instruments.txt" (could be changed with "instrumentsFile"
+			// class parameter) in the DB directory.
+			::std::string _expandTickers(::spdlog::logger& lgr, const INIReader& reader, const ::std::string& ccode)const {
+				::std::string tickers = reader.Get(ccode, "tickers", "");
+				if (tickers.find_first_of("*?") == ::std::string::npos) return tickers;
+
+				const auto fpath = _makeFileName(m_dbPath.c_str()
+					, reader.Get(ccode, "instrumentsFile", ccode + "_instruments.txt").c_str());
+				const auto instruments = _readInstrumentsList(fpath);
+				if (instruments.empty()) {
+					lgr.error("Tickers of classCode={} contain patterns, but instruments list file '{}' is absent or empty", ccode, fpath);
+				}
+
 				::std::string r;
-				r.reserve(tickersCount() * 16);
+				r.reserve(tickers.length() + instruments.size() * 8);
+				::std::unordered_set<::std::string> added;
+				added.reserve(instruments.size());
+
+				char* _ctx;
+				const char* pTicker = ::strtok_s(const_cast<char*>(tickers.data()), ",", &_ctx);
+				while (pTicker) {
+					if (::std::strpbrk(pTicker, "*?")) {
+						size_t n = 0;
+						for (const auto& s : instruments) {
+							if (_wildcardMatch(pTicker, s.c_str()) && added.insert(s).second) {
+								r += s; r += ",";
+								++n;
+							}
+						}
+						lgr.info("Pattern {} of classCode={} matched {} instruments", pTicker, ccode, n);
+					} else if (added.emplace(pTicker).second) {
+						r += pTicker; r += ",";
+					}
+					pTicker = ::strtok_s(nullptr, ",", &_ctx);
+				}
+				if (!r.empty()) r.pop_back();
+				return r;
+			}
 
-				for (const auto& me : classTickersList) {
+			//returns nullptr if failed
+			::std::unique_ptr<convBase_t> _createMode(::spdlog::logger& lgr, const INIReader& reader, ModesCreator_t& MCreator
+				, const ::std::string& ccode, const ::std::string& sTicker, const size_t classId, const tradingDayDescr& tdd
+				, const ::std::string& sMode, const size_t modeId)
+			{
+				const auto pCreator = MCreator.find(sMode);
+				T18_ASSERT(pCreator);
+				// essentially calls converter's static fromCfg()
+				auto up = (*pCreator)(lgr, _makeAmiTickerName(sTicker, ccode, classId, sMode.c_str(), modeId), sTicker, ccode, reader, tdd);
+				if (UNLIKELY(!up)) {
+					lgr.critical("Failed to create mode {} for ticker {}@{}. Skipping", sMode, sTicker, ccode);
+				}
+				return up;
+			}
+
+			TickerCfgData* _createTicker(::spdlog::logger& lgr, const INIReader& reader, ModesCreator_t& MCreator
+				, ::std::forward_list<TickerCfgData_t>& storage, const ::std::string& ccode, const ::std::string& sTicker
+				, const size_t classId, const tradingDayDescr& tdd, const ::std::vector<::std::string>& modeNames
+				, const int defSessionStart, const int defSessionEnd, const int defExpDailyDealsCount)
+			{
+				const int tickerSessStart = reader.GetInteger(ccode, sTicker + "_sessionStart", defSessionStart);
+				const int tickerSessEnd = reader.GetInteger(ccode, sTicker + "_sessionEnd", defSessionEnd);
+
+				const int tickerExpDailyDealsCount = reader.GetInteger(ccode, sTicker + "_ExpDailyDealsCount", defExpDailyDealsCount);
+
+				//creating modes objects. Every known mode could be added to the ticker later on config reload
+				modesVector_t mv;
+				mv.reserve(modeNames.size() + MCreator.count());
+				for (const auto& sMode : modeNames) {
+					if (auto up = _createMode(lgr, reader, MCreator, ccode, sTicker, classId, tdd, sMode, mv.size())) {
+						mv.push_back(::std::move(up));
+					}
+				}
+
+				if (UNLIKELY(mv.empty())) {
+					lgr.critical("Failed to parse modes list for ticker {}@{}, skipping ticker", sTicker, ccode);
+					return nullptr;
+				}
+
+				storage.emplace_front(sTicker.c_str(), ccode
+					, _parseTime(tickerSessStart), _parseTime(tickerSessEnd), ::std::move(mv)
+					, static_cast<size_t>(tickerExpDailyDealsCount > 0
+						? tickerExpDailyDealsCount : _defaultExpDailyDealsCount)
+				);
+				return &storage.front();
+			}
+
+			//returns the ticker, that was created earlier, but then removed from the config
+			TickerCfgData* _findDetached(const ::std::string& ccode, const ::std::string& sTicker)noexcept {
+				for (auto& td : m_tickersStorage) {
+					if (td.isDetached() && td.tickerName == sTicker && td.className == ccode) return &td;
+				}
+				return nullptr;
+			}
+
+			void _publish(::std::unique_ptr<CfgIndex_t>&& upIdx) {
+				T18_ASSERT(upIdx);
+				m_retiredIdx.emplace_back(::std::move(m_upIndex));
+				m_upIndex = ::std::move(upIdx);
+				m_pIndex.store(m_upIndex.get(), ::std::memory_order_release);
+				_countTickers();
+			}
+
+			//detached tickers are still in the storage, so counting tickers of the index
+			void _countTickers()noexcept {
+				_tickersCnt = _totalModesTickersCount = 0;
+				for (const auto& e : m_upIndex->classes) {
+					for (const auto ptd : e.tickersList) {
+						++_tickersCnt;
+						_totalModesTickersCount += static_cast<unsigned>(ptd->modesList.size());
+					}
+				}
+			}
+
+		public:
+			//returns tickers list split into chunks of at most chunkSize tickers. Each chunk has format
+			// (<class-code>(<ticker-1>(?:,<ticker-i>)*))+
+			//f(chunkIdx, tickerName, className) is called for every ticker put into a chunk
+			template<typename F>
+			::std::vector<::std::string> queryTickersList(const size_t chunkSize, F&& f)const {
+				T18_ASSERT(isValid() && chunkSize > 0);
+				::std::vector<::std::string> ret;
+				ret.reserve(tickersCount() / chunkSize + 1);
+
+				size_t inChunk = chunkSize;
+				for (const auto& me : _index().classes) {
 					T18_ASSERT(!me.className.empty() && !me.tickersList.empty());
-					r += me.className;
-					r += "(";
-					bool b = false;
-					for (const auto& te : me.tickersList) {
-						if (b) {
+					bool bClassOpened = false;
+					for (const auto pte : me.tickersList) {
+						T18_ASSERT(!pte->tickerName.empty());
+						if (inChunk >= chunkSize) {
+							if (bClassOpened) ret.back() += ")";
+							ret.emplace_back();
+							ret.back().reserve(chunkSize * (maxStringCodeLen + 1) + 2 * maxStringCodeLen);
+							inChunk = 0;
+							bClassOpened = false;
+						}
+						auto& r = ret.back();
+						if (bClassOpened) {
 							r += ",";
-						} else b = true;
-						T18_ASSERT(!te.tickerName.empty());
-						r += te.tickerName;
+						} else {
+							r += me.className;
+							r += "(";
+							bClassOpened = true;
+						}
+						r += pte->tickerName;
+						++inChunk;
+						f(ret.size() - 1, pte->tickerName, me.className);
 					}
-					r += ")";
+					if (bClassOpened) ret.back() += ")";
 				}
-				return r;
+				return ret;
+			}
+
+			//returns every configured ticker with its class in the order of subscription: tickers matching subscribePriority
+			// patterns go first in the order of patterns, then the rest in the config order. Must be called from the
+			// thread that loads the config
+			::std::vector<::std::pair<TickerCfgData_t*, const ClassDescr_t*>> subscriptionOrder()const {
+				::std::vector<::std::pair<TickerCfgData_t*, const ClassDescr_t*>> ret;
+				ret.reserve(_tickersCnt);
+				::std::unordered_set<const TickerCfgData_t*> added;
+
+				for (const auto& pat : m_subscribePriority) {
+					const auto at = pat.find('@');
+					const auto tPat = pat.substr(0, at);
+					const auto cPat = at == ::std::string::npos ? ::std::string("*") : pat.substr(at + 1);
+					for (const auto& e : _index().classes) {
+						if (!_wildcardMatch(cPat.c_str(), e.className.c_str())) continue;
+						for (const auto ptd : e.tickersList) {
+							if (_wildcardMatch(tPat.c_str(), ptd->tickerName.c_str()) && added.insert(ptd).second) {
+								ret.emplace_back(ptd, &e);
+							}
+						}
+					}
+				}
+				for (const auto& e : _index().classes) {
+					for (const auto ptd : e.tickersList) {
+						if (added.find(ptd) == added.end()) ret.emplace_back(ptd, &e);
+					}
+				}
+				return ret;
 			}
 
 			//checks whether the passed ticker@class is in config
 			//safe to call from multithreading env after config has been read
 			TickerCfgData* find(const char*const tickr, const char*const clss) noexcept {
-				//auto it = classTickersList.find(clss);
-				//if (it != classTickersList.end()) {
-				auto pClassDescr = _find_class(clss);
-				if (pClassDescr) {
-					for (auto& e : pClassDescr->tickersList) {
-						if (tickr == e.tickerName) return &e;
-					}
-				}
-				return nullptr;
+				T18_ASSERT(tickr && clss);
+				return _index().find(code16_t(tickr, ::std::strlen(tickr)), code16_t(clss, ::std::strlen(clss)));
 			}
 			TickerCfgData* find(const ::std::string& tickr, const ::std::string& clss) noexcept {
 				return find(tickr.c_str(), clss.c_str());
 			}
+
+			//////////////////////////////////////////////////////////////////////////
+			//Checkpoint file keeps the state of modes and RTInfo of every subscribed ticker together with the last
+			// processed deal, so after a restart the ticker could be subscribed from that deal instead of the beginning of
+			// the trading day. Deals themselves aren't stored, so the state is valid only while Ami's arrays match it
+			// (see Q2Ami::_canResume()).
+			//Must be called when the network thread is stopped. prepare(TickerCfgData&) is called under convLock of each
+			// ticker before its state is saved.
+			template<typename F>
+			void saveCheckpoint(::spdlog::logger& lgr, F&& prepare) {
+				if (!m_bCheckpoint || m_dbPath.empty()) return;
+
+				::std::string buf;
+				stateWriter w(buf);
+				w.pod(_checkpointMagic);
+				w.pod(_checkpointVersion);
+				const auto cntPos = buf.length();
+				w.pod(::std::uint32_t(0));
+
+				::std::uint32_t cnt = 0;
+				for (const auto& e : _index().classes) {
+					for (const auto ptd : e.tickersList) {
+						convLock_guard_t cl(ptd->convLock);
+						if (ptd->isDetached() || !ptd->unsafe_subscribeWasIssued() || !ptd->unsafe_subscribeWasSuccessfull()) continue;
+						prepare(*ptd);
+
+						mxTimestamp lastTs;
+						dealnum_t lastDealNum = 0;
+						{
+							dealsLock_guard_t dlg(ptd->rawDealsLock);
+							if (!ptd->rawDeals.empty()) {
+								T18_ASSERT(ptd->nextDealToProcess == ptd->rawDeals.size());
+								lastTs = ptd->rawDeals.back().ts;
+								lastDealNum = ptd->rawDeals.back().dealNum;
+							}
+						}
+						if (lastTs.empty()) {
+							//resumed ticker without new deals is saved again
+							if (!ptd->bResumed) continue;
+							lastTs = ptd->resumeTs;
+							lastDealNum = ptd->resumeDealNum;
+						}
+
+						w.str(e.className);
+						w.str(ptd->tickerName);
+						w.ts(lastTs);
+						w.pod(lastDealNum);
+						w.block([ptd](stateWriter& tw) {
+							ptd->pRtInfo->saveState(tw);
+							tw.pod(static_cast<::std::uint32_t>(ptd->modesList.size()));
+							for (const auto& up : ptd->modesList) {
+								tw.str(up->amiName);
+								tw.block([&up](stateWriter& mw) { up->saveState(mw); });
+							}
+						});
+						++cnt;
+					}
+				}
+				::std::memcpy(&buf[cntPos], &cnt, sizeof(cnt));
+
+				//writing to a temporary file first, so the checkpoint is never left half written
+				const auto fpath = _makeFileName(m_dbPath.c_str(), pszCheckpointFileName);
+				const auto tmpPath = fpath + ".tmp";
+				{
+					utils::myFile hF(tmpPath.c_str(), "wb");
+					if (!hF || buf.length() != fwrite(buf.data(), 1, buf.length(), hF)) {
+						lgr.error("Failed to write checkpoint file {}", tmpPath);
+						return;
+					}
+				}
+				if (!::MoveFileExA(tmpPath.c_str(), fpath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+					lgr.error("Failed to replace checkpoint file {}, error={}", fpath, ::GetLastError());
+					return;
+				}
+				lgr.info("Checkpoint of {} tickers saved to {}", cnt, fpath);
+			}
+
+			//Saves convBase::lastKnownQuote of every mode to a text file in the DB directory, one "amiName AmiDate" per line.
+			// Must be called when Ami doesn't request quotes anymore
+			void saveLastQuotes(::spdlog::logger& lgr) {
+				if (!m_bSubscribeSinceLastQuote || m_dbPath.empty()) return;
+
+				::std::string buf;
+				for (const auto& e : _index().classes) {
+					for (const auto ptd : e.tickersList) {
+						convLock_guard_t cl(ptd->convLock);
+						for (const auto& up : ptd->modesList) {
+							if (up->lastKnownQuote.empty()) continue;
+							buf += up->amiName;
+							buf += ' ';
+							buf += ::std::to_string(timestamp2AmiDate(up->lastKnownQuote).Date);
+							buf += '\n';
+						}
+					}
+				}
+
+				const auto fpath = _makeFileName(m_dbPath.c_str(), pszLastQuotesFileName);
+				const auto tmpPath = fpath + ".tmp";
+				{
+					utils::myFile hF(tmpPath.c_str(), "w");
+					if (!hF || buf.length() != fwrite(buf.data(), 1, buf.length(), hF)) {
+						lgr.error("Failed to write last quotes file {}", tmpPath);
+						return;
+					}
+				}
+				if (!::MoveFileExA(tmpPath.c_str(), fpath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+					lgr.error("Failed to replace last quotes file {}, error={}", fpath, ::GetLastError());
+				}
+			}
+
+			//restores convBase::lastKnownQuote of modes saved with saveLastQuotes(). Must be called right after the config has been read
+			void loadLastQuotes(::spdlog::logger& lgr) {
+				if (!m_bSubscribeSinceLastQuote || m_dbPath.empty()) return;
+				const auto fpath = _makeFileName(m_dbPath.c_str(), pszLastQuotesFileName);
+				if (!::utils::myFile::exist(fpath.c_str())) return;
+
+				::std::unordered_map<::std::string, ::std::uint64_t> lastQuotes;
+				{
+					utils::myFile hF(fpath.c_str(), "r");
+					if (!hF) {
+						lgr.warn("Failed to open last quotes file {}", fpath);
+						return;
+					}
+					char buf[256];
+					while (fgets(buf, sizeof(buf), hF)) {
+						char* _ctx = nullptr;
+						const char* pName = ::strtok_s(buf, " \t\r\n", &_ctx);
+						const char* pDate = pName ? ::strtok_s(nullptr, " \t\r\n", &_ctx) : nullptr;
+						if (pDate) lastQuotes[pName] = ::std::strtoull(pDate, nullptr, 10);
+					}
+				}
+
+				size_t cnt = 0;
+				for (const auto& e : _index().classes) {
+					for (const auto ptd : e.tickersList) {
+						for (const auto& up : ptd->modesList) {
+							const auto it = lastQuotes.find(up->amiName);
+							if (it == lastQuotes.end() || 0 == it->second) continue;
+							AmiDate ad;
+							ad.Date = it->second;
+							up->lastKnownQuote = AmiDate2Timestamp(ad);
+							++cnt;
+						}
+					}
+				}
+				lgr.info("Last known quotes of {} Ami tickers loaded", cnt);
+			}
+
+		protected:
+			//returns false if the state of the ticker couldn't be restored from r. Modes then must be reset
+			static bool _loadTickerState(TickerCfgData_t& tcd, stateReader& r) {
+				if (!tcd.pRtInfo->loadState(r)) return false;
+				::std::uint32_t modesCnt;
+				if (!r.pod(modesCnt) || modesCnt != tcd.modesList.size()) return false;
+
+				::std::string amiName;
+				for (::std::uint32_t i = 0; i < modesCnt; ++i) {
+					if (!r.str(amiName)) return false;
+					auto sr = r.block();
+					//modes could be reordered in the config, but an Ami ticker always has the same converter
+					convBase_t* pConv = nullptr;
+					for (const auto& up : tcd.modesList) {
+						if (up->amiName == amiName) {
+							pConv = up.get();
+							break;
+						}
+					}
+					if (!pConv || !pConv->loadState(sr)) return false;
+				}
+				return r.good();
+			}
+
+		public:
+			//reads the checkpoint file of the loaded DB and restores state of tickers, that were saved during the current
+			// trading day. The file is deleted afterwards. Must be called right after the config has been read.
+			void loadCheckpoint(::spdlog::logger& lgr) {
+				if (m_dbPath.empty()) return;
+				const auto fpath = _makeFileName(m_dbPath.c_str(), pszCheckpointFileName);
+				if (!::utils::myFile::exist(fpath.c_str())) return;
+
+				::std::string buf;
+				{
+					utils::myFile hF(fpath.c_str(), "rb");
+					if (hF) {
+						char _b[4096];
+						size_t n;
+						while ((n = fread(_b, 1, sizeof(_b), hF)) > 0) buf.append(_b, n);
+					}
+				}
+				//the state is useful only once
+				::DeleteFileA(fpath.c_str());
+				if (!m_bCheckpoint) return;
+
+				stateReader r(buf.data(), buf.length());
+				::std::uint32_t magic, ver, cnt;
+				if (!r.pod(magic) || !r.pod(ver) || !r.pod(cnt) || magic != _checkpointMagic || ver != _checkpointVersion) {
+					lgr.warn("Checkpoint file {} has unsupported format, ignoring it", fpath);
+					return;
+				}
+
+				const auto& idx = _index();
+				size_t nRestored = 0;
+				::std::string sClass, sTicker;
+				for (::std::uint32_t i = 0; i < cnt; ++i) {
+					mxTimestamp lastTs;
+					dealnum_t lastDealNum = 0;
+					if (!r.str(sClass) || !r.str(sTicker) || !r.ts(lastTs) || !r.pod(lastDealNum)) break;
+
+					auto tr = r.block();
+					if (!r.good()) break;
+
+					const auto pCD = idx.findClass(code16_t(sClass.c_str(), sClass.length()));
+					const auto ptd = find(sTicker, sClass);
+					if (!pCD || !ptd || ptd->isDetached() || lastTs < pCD->tradingDayStart()) {
+						lgr.info("Checkpoint state of {}@{} is outdated or not configured, skipping it", sTicker, sClass);
+						continue;
+					}
+
+					if (_loadTickerState(*ptd, tr)) {
+						ptd->resumeTs = lastTs;
+						ptd->resumeDealNum = lastDealNum;
+						++nRestored;
+						lgr.info("State of {}@{} restored from checkpoint, last deal {} @ {}", sTicker, sClass, lastDealNum, lastTs.to_string());
+					} else {
+						lgr.warn("Failed to restore state of {}@{} from checkpoint", sTicker, sClass);
+						ptd->dropResumeState();
+					}
+				}
+				if (!r.good()) lgr.warn("Checkpoint file {} is truncated or damaged", fpath);
+				lgr.info("State of {} tickers restored from checkpoint", nRestored);
+			}
 		};
 	}
 
@@ -33,16 +33,26 @@ T18_COMP_POP; T18_COMP_POP; T18_COMP_POP;
 
 #include "../t18/t18/utils/myFile.h"
 
-#include "q2ami_supl.h"
+#include "q2ami_state.h"
 
 namespace t18 {
 	namespace _Q2Ami {
 
 		class TickerCfgData; //fwd declaration
 
+		//trading day settings of a class the ticker belongs to (see tradingDayBeginsAt and tradingDayBeginsAtPrevDay
+		// config options). Passed to converters' fromCfg()
+		struct tradingDayDescr {
+			mxTime beginsAt;
+			bool bStartsAtPrevDay;
+		};
+
 		//////////////////////////////////////////////////////////////////////////
 		//everything that process default ticks (as well as returns non processed ticks) MUST be derived from this class
-		//Objects of any convBase derived class are used from within a single ami-spawned thread.
+		//Objects of any convBase derived class are used from ami-spawned threads under protection of TickerCfgData::convLock.
+		// Several Ami threads may request modes of the same ticker at once, only one of them converts while others return
+		// without new data and are notified later (see Q2Ami::_claimBusyTicker()).
+		// All modes of a ticker are run over new deals at once, no matter which of them Ami has requested.
 		// See Q2Ami::_doGetQuotes() implementation for use, some details and restictions to converters
 		struct convBase {
 		protected:
@@ -51,7 +61,27 @@ namespace t18 {
 			//mxTimestamp m_lastRealTs;//timestamp of the real last seen deal
 
 		public:
-			size_t nextDealToProcess{ 0 };//for external use only
+			//////////////////////////////////////////////////////////////////////////
+			//for external use only. The following vars are used by Q2Ami to buffer converter output from the moment deals
+			// were converted until Ami requests the mode data. Converters must not touch them.
+			::std::vector<Quotation> stage;
+			//index of the last valid element of stage. processDeal() works with stage as it were Ami's quotes array
+			int stageLastValid{ -1 };
+			//if set, the first stage element has already been delivered to Ami, but it's kept in the stage, because
+			// converter may update it in place later (then it'll be delivered again)
+			bool stageHasDelivered{ false };
+			//false until the first call to GetQuotesEx() for the mode after (re)connection
+			bool bAmiArrayRewound{ false };
+			//nSize of Ami's quotes array as seen on the last delivery, 0 if unknown. Stage never grows much larger than that.
+			int amiArraySize{ 0 };
+			//timestamp of the last quote in Ami's array of the mode as known to the plugin. Kept between sessions
+			// (see Cfg::saveLastQuotes()), empty if unknown
+			mxTimestamp lastKnownQuote;
+
+			//snapshot of ticker's RTInfo returned to Ami by GetRecentInfo(). It's written only from Ami's thread that
+			// calls GetRecentInfo()
+			RecentInfo recentInfo;
+			//////////////////////////////////////////////////////////////////////////
 
 			const ::std::string amiName;//full ticker name in Ami. Don't change it
 			const char*const modeName; //note that this field is usually just a "mirror" of inline constexpr sModeName field defined in
@@ -62,6 +92,10 @@ namespace t18 {
 		protected:
 			convBase(::spdlog::logger& lgr, ::std::string&& an, const char* _modeName) : amiName(::std::move(an)), modeName(_modeName)
 			{
+				::std::memset(&recentInfo, 0, sizeof(recentInfo));
+				recentInfo.nStructSize = static_cast<int>(sizeof(recentInfo));
+				::strncpy_s(recentInfo.Name, amiName.c_str(), _TRUNCATE);
+
 				lgr.info("Converter {} for amiTicker {} created", modeName, amiName);
 			}
 
@@ -82,10 +116,33 @@ namespace t18 {
 
 			//expecting it be called when network thread is shutdown
 			virtual void _resetConnection() {
-				nextDealToProcess = 0;
+				stage.clear();
+				stageLastValid = -1;
+				stageHasDelivered = false;
+				bAmiArrayRewound = false;
 			};
 
 		public:
+			//Saves incremental state of the converter together with its stage for the checkpoint. Derived converters with
+			// their own state must call base class version first.
+			virtual void saveState(stateWriter& w)const {
+				w.ts(m_prevTs);
+				w.pod(stageHasDelivered);
+				w.pod(stageLastValid);
+				for (int i = 0; i <= stageLastValid; ++i) w.pod(stage[static_cast<size_t>(i)]);
+			}
+			//returns false if the state can't be restored. The converter must be reset by caller then
+			virtual bool loadState(stateReader& r) {
+				int lv;
+				if (!r.ts(m_prevTs) || !r.pod(stageHasDelivered) || !r.pod(lv) || lv < -1) return false;
+				stage.resize(::std::max(stage.size(), static_cast<size_t>(lv + 1)));
+				for (int i = 0; i <= lv; ++i) {
+					if (!r.pod(stage[static_cast<size_t>(i)])) return false;
+				}
+				stageLastValid = lv;
+				return true;
+			}
+
 			// pQ might be null when no history available (t in that case ==0, but not empty)
 			// Note that timestamp t may be set to a later time, that is pointed by pQ->DateTime
 			virtual void setPrevQuot(mxTimestamp t, const Quotation* /*pQ*/)noexcept {
@@ -94,6 +151,14 @@ namespace t18 {
 				//m_lastRealTs = t;
 			}
 
+			//returns timestamp of the earliest deal, that the mode must get to recreate every Ami quote since lastQuote. Quotes
+			// in Ami's array at or after that timestamp will be removed before the mode gets new deals.
+			//Empty value means the mode needs all deals of the trading day (default, since it's always safe)
+			virtual mxTimestamp resumableSince(const mxTimestamp lastQuote)const noexcept {
+				T18_UNREF(lastQuote);
+				return mxTimestamp();
+			}
+
 			//default implementation does nothing
 			/*virtual int dropPossiblyUnfinished(const Quotation*const pQuotes, const int nSize, int nLastValid) {
 				T18_UNREF(pQuotes); T18_UNREF(nSize);
@@ -145,13 +210,14 @@ namespace t18 {
 
 				//return empty ::std::unique_ptr in case of non severe failure
 				static ::std::unique_ptr<convBase> fromCfg(::spdlog::logger& lgr, ::std::string&& amiTickerPfx
-					, const ::std::string& tickerCode, const ::std::string& classCode, const INIReader& iniReader)
+					, const ::std::string& tickerCode, const ::std::string& classCode, const INIReader& iniReader
+					, const tradingDayDescr& tdd)
 				{
 					//you don't have to use default implementation.
 					//Don't change amiTickerPfx string here, pass it to base class. It's used to match symbol in Ami to this very mode
 					// converter object
 					//note that there's a reference to config ini reader passed, you may use it to read additional parameters for the ticker from ini
-					T18_UNREF(tickerCode); T18_UNREF(classCode); T18_UNREF(iniReader);
+					T18_UNREF(tickerCode); T18_UNREF(classCode); T18_UNREF(iniReader); T18_UNREF(tdd);
 					return base_class_t::_defFromCfg<ticks>(lgr, ::std::move(amiTickerPfx));
 				}
 
@@ -169,10 +235,162 @@ namespace t18 {
 					return 0;
 				}
 
+				//timestamps of quotes could be shifted a few microseconds forward by _makeUniqueTs(), so starting from
+				// the beginning of the second of the last quote
+				virtual mxTimestamp resumableSince(const mxTimestamp lastQuote)const noexcept override {
+					return mxTimestamp(lastQuote.Year(), lastQuote.Month(), lastQuote.Day(), lastQuote.Hour(), lastQuote.Minute(), lastQuote.Second(), 0);
+				}
+
 				/*virtual void _resetConnection() override {
 					//#todo 
 				}*/
 			};
+
+			//order-flow bars of fixed time frame. Besides OHLC they carry some aggregated properties of the deals stream,
+			// that are updated incrementally on each deal, so there's no need to recalculate them in AFL over the full tick history.
+			// Fields layout:
+			// - Volume - total volume of the bar
+			// - OpenInterest - volume delta of the bar, i.e. buy volume minus sell volume
+			// - AuxData1 - VWAP of the bar
+			// - AuxData2 - number of deals in the bar
+			// Buy/sell volumes are (V +/- delta)/2. Cumulative delta is a sum of OpenInterest since the trading day start, it isn't
+			// stored, because OpenInterest is a float and a cumulative value of a liquid ticker loses precision past 2^24.
+			// Bars never straddle the class trading day boundary (tradingDayBeginsAt), so the sum could be reset exactly there
+			struct oflow : public convBase {
+				typedef convBase base_class_t;
+				inline static constexpr char sModeName[] = "oflow";
+
+				//bar length in seconds. Could be changed with "oflowPeriod" class-wide parameter or <ticker>_oflowPeriod
+				static constexpr long defPeriodSec = 60;
+
+			protected:
+				const int m_periodSec;
+				//time of day the trading day of the ticker's class begins at. Whether it begins at the previous calendar day
+				// doesn't matter here, the boundary is always at this time
+				const mxTime m_tradingDayBeginsAt;
+
+				//real (not made unique) timestamp of the current bar start. Empty if there's no current bar
+				mxTimestamp m_barStart;
+				double m_barPV{ 0 }, m_barVol{ 0 }, m_barDelta{ 0 };
+				unsigned m_barDeals{ 0 };
+
+				//////////////////////////////////////////////////////////////////////////
+			public:
+				oflow(::spdlog::logger& lgr, ::std::string&& an, const int periodSec, const mxTime tradingDayBeginsAt)
+					: base_class_t(lgr, ::std::move(an), sModeName), m_periodSec(periodSec), m_tradingDayBeginsAt(tradingDayBeginsAt)
+				{
+					T18_ASSERT(m_periodSec > 0);
+				}
+
+				static ::std::unique_ptr<convBase> fromCfg(::spdlog::logger& lgr, ::std::string&& amiTickerPfx
+					, const ::std::string& tickerCode, const ::std::string& classCode, const INIReader& iniReader
+					, const tradingDayDescr& tdd)
+				{
+					const auto defPeriod = iniReader.GetInteger(classCode, "oflowPeriod", defPeriodSec);
+					const auto period = iniReader.GetInteger(classCode, tickerCode + "_oflowPeriod", defPeriod);
+					//bar must fit a day evenly, or bars boundaries will drift from day to day
+					if (UNLIKELY(period <= 0 || period > 86400 || 0 != (86400 % period))) {
+						lgr.critical("Invalid oflowPeriod={} for {}@{}. It must be a positive divisor of 86400", period, tickerCode, classCode);
+						return ::std::unique_ptr<convBase>();
+					}
+					return ::std::make_unique<oflow>(lgr, ::std::move(amiTickerPfx), static_cast<int>(period), tdd.beginsAt);
+				}
+
+				virtual int processDeal(const proxy::prxyTsDeal& tsd, const extTickerInfo& eTI
+					, Quotation*const pQuotes, IN OUT int& nLastValid, const int nSize) override
+				{
+					T18_ASSERT(nLastValid >= -1 && nLastValid < nSize);
+					T18_UNREF(nSize);
+
+					const mxTimestamp ts = tsd.ts;
+					const auto barStart = _barStartOf(ts);
+					const auto vl = static_cast<double>(tsd.volLots*eTI.lotSize);
+					const auto pr = static_cast<decltype(Quotation::Price)>(tsd.pr);
+
+					if (LIKELY(nLastValid >= 0 && !m_barStart.empty() && barStart == m_barStart)) {
+						//the deal belongs to the current bar, updating it in place
+						auto& q = pQuotes[nLastValid];
+						q.Price = pr;
+						if (pr > q.High) q.High = pr;
+						if (pr < q.Low) q.Low = pr;
+					} else {
+						//starting a new bar
+						m_barStart = barStart;
+						m_barPV = m_barVol = m_barDelta = 0;
+						m_barDeals = 0;
+
+						auto& q = pQuotes[++nLastValid];
+						timestamp2AmiDate(q.DateTime, base_class_t::_makeUniqueTs(barStart));
+						q.Price = pr;
+						q.Open = pr;
+						q.High = pr;
+						q.Low = pr;
+					}
+
+					m_barPV += vl*static_cast<double>(tsd.pr);
+					m_barVol += vl;
+					m_barDelta += static_cast<bool>(tsd.bLong) ? vl : -vl;
+					++m_barDeals;
+
+					auto& q = pQuotes[nLastValid];
+					q.Volume = static_cast<decltype(q.Volume)>(m_barVol);
+					q.OpenInterest = static_cast<decltype(q.OpenInterest)>(m_barDelta);
+					q.AuxData1 = m_barVol > 0 ? static_cast<decltype(q.AuxData1)>(m_barPV / m_barVol) : pr;
+					q.AuxData2 = static_cast<decltype(q.AuxData2)>(m_barDeals);
+					return 0;
+				}
+
+				virtual void setPrevQuot(mxTimestamp t, const Quotation* pQ)noexcept override {
+					base_class_t::setPrevQuot(t, pQ);
+					//pQ may belong to an array of a different mode of the same ticker, so we can't continue the bar from it
+					_resetBar();
+				}
+
+				//bars don't depend on each other, so only the bar of the last quote must be rebuilt
+				virtual mxTimestamp resumableSince(const mxTimestamp lastQuote)const noexcept override {
+					return _barStartOf(lastQuote);
+				}
+
+				virtual void saveState(stateWriter& w)const override {
+					base_class_t::saveState(w);
+					w.pod(m_periodSec);
+					w.ts(m_barStart);
+					w.pod(m_barPV);
+					w.pod(m_barVol);
+					w.pod(m_barDelta);
+					w.pod(m_barDeals);
+				}
+				virtual bool loadState(stateReader& r) override {
+					int period;
+					//bars of different length can't be continued
+					return base_class_t::loadState(r) && r.pod(period) && period == m_periodSec
+						&& r.ts(m_barStart) && r.pod(m_barPV) && r.pod(m_barVol) && r.pod(m_barDelta)
+						&& r.pod(m_barDeals);
+				}
+
+			protected:
+				virtual void _resetConnection() override {
+					base_class_t::_resetConnection();
+					_resetBar();
+				}
+
+				void _resetBar()noexcept {
+					m_barStart.clear();
+					m_barPV = m_barVol = m_barDelta = 0;
+					m_barDeals = 0;
+				}
+
+				mxTimestamp _barStartOf(const mxTimestamp& ts)const noexcept {
+					const int sod = ts.Hour() * 3600 + ts.Minute() * 60 + ts.Second();
+					const int bs = sod - sod % m_periodSec;
+					mxTimestamp r(ts.Year(), ts.Month(), ts.Day(), bs / 3600, (bs % 3600) / 60, bs % 60, 0);
+					//a bar that contains the trading day boundary is split there
+					if (UNLIKELY(r.Time() < m_tradingDayBeginsAt && !(ts.Time() < m_tradingDayBeginsAt))) {
+						r.set_time(m_tradingDayBeginsAt);
+					}
+					return r;
+				}
+			};
 		}
 
 #if T18_HAS_INCLUDE("../t18+/Q2Ami/exp_convs.h")
@@ -184,7 +402,7 @@ namespace t18 {
 #else
 		namespace modes {
 			//define in a similar way a tuple type with your own converters in ../t18+/Q2Ami/exp_convs.h
-			typedef decltype(hana::tuple_t<ticks>) Conv_Modes_t;
+			typedef decltype(hana::tuple_t<ticks, oflow>) Conv_Modes_t;
 		}
 #endif
 
@@ -193,7 +411,7 @@ namespace t18 {
 		class ModesCreator {
 		public:
 			typedef ::std::function<::std::unique_ptr<convBase>(::spdlog::logger& lgr, ::std::string&&
-				, const ::std::string&, const ::std::string&, const INIReader&)> modeCreatorFunc_t;
+				, const ::std::string&, const ::std::string&, const INIReader&, const tradingDayDescr&)> modeCreatorFunc_t;
 
 		protected:
 			struct modeDescr {
@@ -206,10 +424,12 @@ namespace t18 {
 			::std::vector<modeDescr> m_fList;
 
 		public:
+			static constexpr size_t knownModesCount = hana::value(hana::length(modes::Conv_Modes_t()));
+
 			ModesCreator() {
 				using namespace modes;
 				
-				m_fList.reserve( hana::value(hana::length(modes::Conv_Modes_t())) );
+				m_fList.reserve(knownModesCount);
 				hana::for_each(modes::Conv_Modes_t(), [&fList = m_fList](auto&& modeT)noexcept {
 					typedef typename ::std::decay_t<decltype(modeT)>::type mode_t;
 					fList.emplace_back(mode_t::fromCfg, mode_t::sModeName);
@@ -222,16 +442,57 @@ namespace t18 {
 				}
 				return nullptr;
 			}
+
+			size_t count()const noexcept { return m_fList.size(); }
 		};
 
-		//ModesVector keeps all conversion modes for a ticker in one place
-		struct ModesVector : public ::std::vector<::std::unique_ptr<convBase>> {
-		private:
-			typedef ::std::vector<::std::unique_ptr<convBase>> base_class_t;
+		//ModesVector keeps all conversion modes for a ticker in one place.
+		//Modes could be added to a ticker on config reload while other threads walk the vector, so its capacity is set once
+		// with reserve() and never changes. push_back() constructs the element first and then publishes the new size, so
+		// any thread sees either the old or the new set of modes. There must be only one thread that modifies the vector.
+		struct ModesVector {
+			typedef ::std::unique_ptr<convBase> value_type;
+
+		protected:
+			::std::unique_ptr<value_type[]> m_p;
+			size_t m_capacity{ 0 };
+			::std::atomic<size_t> m_size{ 0 };
 
 		public:
-			template<typename...Args>
-			ModesVector(Args...a) : base_class_t(::std::forward<Args>(a)...) {}
+			ModesVector() = default;
+			ModesVector(ModesVector&& o)noexcept : m_p(::std::move(o.m_p)), m_capacity(o.m_capacity)
+				, m_size(o.m_size.load(::std::memory_order_relaxed))
+			{
+				o.m_capacity = 0;
+				o.m_size.store(0, ::std::memory_order_relaxed);
+			}
+			ModesVector(const ModesVector&) = delete;
+			ModesVector& operator=(const ModesVector&) = delete;
+
+			//must be called once before the first push_back()
+			void reserve(const size_t n) {
+				T18_ASSERT(!m_p && n > 0);
+				m_p = ::std::make_unique<value_type[]>(n);
+				m_capacity = n;
+			}
+			size_t capacity()const noexcept { return m_capacity; }
+
+			size_t size()const noexcept { return m_size.load(::std::memory_order_acquire); }
+			bool empty()const noexcept { return 0 == size(); }
+
+			const value_type* begin()const noexcept { return m_p.get(); }
+			const value_type* end()const noexcept { return m_p.get() + size(); }
+			const value_type& operator[](const size_t i)const noexcept {
+				T18_ASSERT(i < size());
+				return m_p[i];
+			}
+
+			void push_back(value_type&& v)noexcept {
+				const auto n = m_size.load(::std::memory_order_relaxed);
+				T18_ASSERT(n < m_capacity);
+				m_p[n] = ::std::move(v);
+				m_size.store(n + 1, ::std::memory_order_release);
+			}
 
 			convBase* findMode(const char*const pModeName)const noexcept {
 				for (auto& uPtr : *this) {
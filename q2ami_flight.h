@@ -0,0 +1,180 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+//the header is self-contained, it's used by the offline decoder (tools/flight2trace.cpp) too
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		//event of the flight recorder. Meaning of a and b depends on the type
+		struct flightEvent {
+			enum type_t : ::std::uint16_t {
+				evNone = 0,
+				evPacket,//AllTrades packet received. a=deals in the packet
+				evNotify,//Ami notified about new deals of tid. a=deals of the ticker in memory
+				evGetQuotesEnter,//GetQuotesEx() called. a=nLastValid, b=nSize
+				evGetQuotesExit,//GetQuotesEx() returns. a=returned value
+				evConvert,//new deals of tid converted. a=the first deal index, b=number of deals
+				evShift,//Ami's quotes array shifted. a=nLastValid before the shift, b=shift
+				evConnection,//connection to the server changed. a=1 if connected
+				evSubscribed,//subscription result of tid received. a=1 if the ticker exists on the server
+				evInvalidTime,//bars with non increasing time delivered to Ami. a=index of the bar, b=nLastValid
+				evGetQuotesBusy,//GetQuotesEx() found tid being converted by another thread. a=nLastValid, b=nSize
+				_evCount
+			};
+			static constexpr const char* typeNames[_evCount] = { "none", "packet", "notify", "GetQuotesEx", "GetQuotesEx"
+				, "convert", "shift", "connection", "subscribed", "invalidTime", "GetQuotesExBusy" };
+
+			::std::uint64_t ns;//flightRecorder::nowNs()
+			::std::int32_t a, b;
+			::std::uint16_t type;
+			::std::uint16_t tid;//server's ticker id or flightRecorder::noTid
+			::std::uint32_t thread;//flightRecorder::threadIdx()
+		};
+		static_assert(sizeof(flightEvent) == 24, "update fileVersion if the event changes");
+
+		//flightRecorder keeps the last capacity events of the network and quote paths in a ring buffer, so what preceded
+		// an intermittent failure could be dumped to a file and examined later. Recording costs an atomic increment,
+		// a clock read and two stores, so the recorder is always on. Any thread may record at any time.
+		//Every slot is a tiny seqlock: its sequence is zeroed while the event is being written and set to the event
+		// index + 1 after, so a reader skips events being overwritten.
+		class flightRecorder {
+		public:
+			static constexpr unsigned capacityLog2 = 16;
+			static constexpr size_t capacity = size_t(1) << capacityLog2;
+			static constexpr ::std::uint16_t noTid = 0xffff;
+
+			//dump file is fileHeader, eventsCnt of flightEvent and namesCnt of (uint16 tid, uint8 len, len chars) records
+			static constexpr ::std::uint32_t fileMagic = 0x52463251;//"Q2FR"
+			static constexpr ::std::uint32_t fileVersion = 1;
+			struct fileHeader {
+				::std::uint32_t magic, version;
+				//nowNs() and microseconds since the Unix epoch at the moment of the dump, to convert event times
+				::std::uint64_t dumpNs;
+				::std::int64_t dumpUnixUs;
+				::std::uint32_t eventsCnt, namesCnt;
+			};
+
+		protected:
+			//the event is kept in relaxed atomic words, so snapshot() could copy a slot being overwritten without a data race
+			// (the header is self-contained, so not _Q2Ami::atomicPod)
+			static constexpr size_t _eventWords = sizeof(flightEvent) / sizeof(::std::uint64_t);
+			static_assert(sizeof(flightEvent) == _eventWords * sizeof(::std::uint64_t), "");
+			struct slot_t {
+				::std::atomic<::std::uint64_t> seq{ 0 };
+				::std::atomic<::std::uint64_t> e[_eventWords]{};
+			};
+
+			::std::unique_ptr<slot_t[]> m_slots;
+			alignas(64) ::std::atomic<::std::uint64_t> m_head{ 0 };
+
+		public:
+			flightRecorder() : m_slots(::std::make_unique<slot_t[]>(capacity)) {}
+
+			static ::std::uint64_t nowNs()noexcept {
+				return static_cast<::std::uint64_t>(::std::chrono::duration_cast<::std::chrono::nanoseconds>(
+					::std::chrono::steady_clock::now().time_since_epoch()).count());
+			}
+			static ::std::int64_t unixUs()noexcept {
+				return ::std::chrono::duration_cast<::std::chrono::microseconds>(::std::chrono::system_clock::now().time_since_epoch()).count();
+			}
+			//small sequential id of the calling thread
+			static ::std::uint32_t threadIdx()noexcept {
+				static ::std::atomic<::std::uint32_t> lastIdx{ 0 };
+				thread_local const ::std::uint32_t idx = lastIdx.fetch_add(1, ::std::memory_order_relaxed) + 1;
+				return idx;
+			}
+
+			void record(const flightEvent::type_t type, const ::std::uint16_t tid, const ::std::int32_t a = 0, const ::std::int32_t b = 0)noexcept {
+				const auto idx = m_head.fetch_add(1, ::std::memory_order_relaxed);
+				auto& s = m_slots[idx & (capacity - 1)];
+				flightEvent e;
+				e.ns = nowNs();
+				e.a = a;
+				e.b = b;
+				e.type = type;
+				e.tid = tid;
+				e.thread = threadIdx();
+				::std::uint64_t w[_eventWords];
+				::std::memcpy(w, &e, sizeof(e));
+
+				s.seq.store(0, ::std::memory_order_relaxed);
+				::std::atomic_thread_fence(::std::memory_order_release);
+				for (size_t k = 0; k < _eventWords; ++k) s.e[k].store(w[k], ::std::memory_order_relaxed);
+				s.seq.store(idx + 1, ::std::memory_order_release);
+			}
+
+			//returns recorded events in the order of recording. Events being written concurrently are skipped
+			::std::vector<flightEvent> snapshot()const {
+				const auto head = m_head.load(::std::memory_order_acquire);
+				const auto from = head > capacity ? head - capacity : 0;
+				::std::vector<flightEvent> r;
+				r.reserve(static_cast<size_t>(head - from));
+				for (auto i = from; i < head; ++i) {
+					const auto& s = m_slots[i & (capacity - 1)];
+					const auto s1 = s.seq.load(::std::memory_order_acquire);
+					if (s1 != i + 1) continue;
+					::std::uint64_t w[_eventWords];
+					for (size_t k = 0; k < _eventWords; ++k) w[k] = s.e[k].load(::std::memory_order_relaxed);
+					::std::atomic_thread_fence(::std::memory_order_acquire);
+					flightEvent e;
+					::std::memcpy(&e, w, sizeof(e));
+					if (s.seq.load(::std::memory_order_relaxed) == s1) r.push_back(e);
+				}
+				return r;
+			}
+
+			//serializes snapshot() with names of tickers to the dump file format
+			::std::string serialize(const ::std::vector<::std::pair<::std::uint16_t, ::std::string>>& names)const {
+				const auto ev = snapshot();
+				fileHeader h;
+				h.magic = fileMagic;
+				h.version = fileVersion;
+				h.dumpNs = nowNs();
+				h.dumpUnixUs = unixUs();
+				h.eventsCnt = static_cast<::std::uint32_t>(ev.size());
+				h.namesCnt = static_cast<::std::uint32_t>(names.size());
+
+				::std::string s;
+				s.reserve(sizeof(h) + ev.size() * sizeof(flightEvent) + names.size() * 32);
+				s.append(reinterpret_cast<const char*>(&h), sizeof(h));
+				if (!ev.empty()) s.append(reinterpret_cast<const char*>(ev.data()), ev.size() * sizeof(flightEvent));
+				for (const auto& n : names) {
+					const auto len = static_cast<::std::uint8_t>(::std::min(n.second.length(), size_t(255)));
+					s.append(reinterpret_cast<const char*>(&n.first), sizeof(n.first));
+					s += static_cast<char>(len);
+					s.append(n.second.data(), len);
+				}
+				return s;
+			}
+		};
+
+	}
+}
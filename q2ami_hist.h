@@ -0,0 +1,171 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+
+#include "q2ami_supl.h"
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		//Log-linear histogram of non negative integer values (microseconds of latency here) in the spirit of HdrHistogram:
+		// values are grouped by their highest set bit, and each group is split into subBuckets linear buckets, so the
+		// relative error of a reported value is below 1/subBuckets. Counters are relaxed atomics, so any thread may record
+		// and read at any time. A snapshot read concurrently with updates may be slightly inconsistent, that's fine for statistics.
+		class latencyHist {
+		public:
+			typedef ::std::uint64_t value_t;
+
+			static constexpr unsigned subBucketsLog2 = 3;
+			static constexpr unsigned subBuckets = 1u << subBucketsLog2;
+			//larger values (~19 hours in microseconds) go to the last bucket
+			static constexpr unsigned maxValueLog2 = 36;
+			static constexpr unsigned bucketsCnt = (maxValueLog2 - subBucketsLog2 + 2) * subBuckets;
+
+		protected:
+			::std::atomic<value_t> m_buckets[bucketsCnt];
+			::std::atomic<value_t> m_count{ 0 }, m_max{ 0 };
+
+		public:
+			latencyHist()noexcept {
+				reset();
+			}
+
+			void reset()noexcept {
+				for (auto& b : m_buckets) b.store(0, ::std::memory_order_relaxed);
+				m_count.store(0, ::std::memory_order_relaxed);
+				m_max.store(0, ::std::memory_order_relaxed);
+			}
+
+			static unsigned msbOf(value_t v)noexcept {
+				T18_ASSERT(v);
+				unsigned r = 0;
+				for (unsigned s = 32; s; s >>= 1) {
+					if (v >> s) {
+						v >>= s;
+						r += s;
+					}
+				}
+				return r;
+			}
+
+			static unsigned bucketOf(const value_t v)noexcept {
+				if (v < subBuckets) return static_cast<unsigned>(v);
+				const unsigned shift = msbOf(v) - subBucketsLog2;
+				const unsigned idx = (shift + 1) * subBuckets + static_cast<unsigned>((v >> shift) & (subBuckets - 1));
+				return ::std::min(idx, bucketsCnt - 1);
+			}
+			//the lowest value, that goes to the bucket
+			static value_t bucketLowest(const unsigned idx)noexcept {
+				if (idx < subBuckets) return idx;
+				const unsigned shift = idx / subBuckets - 1;
+				return static_cast<value_t>(subBuckets + idx % subBuckets) << shift;
+			}
+
+			void record(const value_t v)noexcept {
+				m_buckets[bucketOf(v)].fetch_add(1, ::std::memory_order_relaxed);
+				m_count.fetch_add(1, ::std::memory_order_relaxed);
+				auto m = m_max.load(::std::memory_order_relaxed);
+				while (v > m && !m_max.compare_exchange_weak(m, v, ::std::memory_order_relaxed)) {}
+			}
+
+			value_t count()const noexcept { return m_count.load(::std::memory_order_relaxed); }
+			value_t max()const noexcept { return m_max.load(::std::memory_order_relaxed); }
+
+			//returns the upper bound of the bucket that contains p-th (0<p<=1) quantile of recorded values
+			value_t percentile(const double p)const noexcept {
+				value_t total = 0;
+				for (const auto& b : m_buckets) total += b.load(::std::memory_order_relaxed);
+				if (!total) return 0;
+
+				const auto target = ::std::max(value_t(1), static_cast<value_t>(p * static_cast<double>(total) + .5));
+				value_t cum = 0;
+				for (unsigned i = 0; i < bucketsCnt; ++i) {
+					cum += m_buckets[i].load(::std::memory_order_relaxed);
+					if (cum >= target) {
+						return i + 1 < bucketsCnt ? ::std::min(bucketLowest(i + 1) - 1, max()) : max();
+					}
+				}
+				return max();
+			}
+		};
+
+		//latency of deals from the exchange time of a deal to the moment it passed a stage of processing
+		struct dealLatency {
+			enum stage_t {
+				stReceipt = 0,//deal received by hndAllTrades()
+				stNotify,//Ami notified about new deals of a ticker, measured for the last deal of the ticker in the packet
+				stDelivery,//deals converted and delivered to Ami in GetQuotesEx(), measured for the last converted deal
+				_stagesCount
+			};
+			static constexpr const char* stageNames[_stagesCount] = { "receipt", "notify", "delivery" };
+
+			latencyHist hist[_stagesCount];
+
+			void record(const stage_t st, const latencyHist::value_t v)noexcept {
+				hist[st].record(v);
+			}
+			void reset()noexcept {
+				for (auto& h : hist) h.reset();
+			}
+
+			//formats "stage count p50 p99 max" lines (values in milliseconds) prefixed with pfx
+			void describe(::std::string& s, const char*const pfx)const {
+				char _buf[256];
+				for (int i = 0; i < _stagesCount; ++i) {
+					const auto& h = hist[i];
+					if (!h.count()) continue;
+					sprintf_s(_buf, "%-24s %-9s %10llu %10.3f %10.3f %10.3f\n", pfx, stageNames[i]
+						, static_cast<unsigned long long>(h.count()), h.percentile(.5) / 1000., h.percentile(.99) / 1000., h.max() / 1000.);
+					s += _buf;
+				}
+			}
+		};
+
+		//computes latencies of deals relative to the time of creation. The time of deals is the exchange local time,
+		// so it's meaningful only if the clock of the computer is synchronized and set to the same time zone.
+		class latencyClock {
+		protected:
+			int m_dayKey;
+			::std::int64_t m_usOfDay;
+
+			static ::std::int64_t _usOfDay(const mxTimestamp& t)noexcept {
+				return ((static_cast<::std::int64_t>(t.Hour()) * 60 + t.Minute()) * 60 + t.Second()) * 1000000 + t.Microsecond();
+			}
+			static int _dayKey(const mxTimestamp& t)noexcept {
+				return t.Year() * 10000 + t.Month() * 100 + t.Day();
+			}
+
+		public:
+			explicit latencyClock(const mxTimestamp now)noexcept : m_dayKey(_dayKey(now)), m_usOfDay(_usOfDay(now)) {}
+
+			//returns microseconds passed since ts, or -1 if ts belongs to another day. Deals from the future
+			// (clocks aren't synchronized) have zero latency
+			::std::int64_t since(const mxTimestamp ts)const noexcept {
+				if (UNLIKELY(_dayKey(ts) != m_dayKey)) return -1;
+				return ::std::max(::std::int64_t(0), m_usOfDay - _usOfDay(ts));
+			}
+		};
+
+	}
+}
@@ -0,0 +1,152 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "q2ami_supl.h"
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		//counters of a lock. They are updated only by the owner of the lock while holding it, so plain relaxed
+		// load+store is enough and costs nothing more than a non atomic increment. Readers from other threads may see slightly stale values.
+		struct lockStats {
+			::std::atomic<::std::uint64_t> acquisitions{ 0 }, contended{ 0 }, spins{ 0 }, waitNs{ 0 };
+
+			static void add(::std::atomic<::std::uint64_t>& c, const ::std::uint64_t v)noexcept {
+				c.store(c.load(::std::memory_order_relaxed) + v, ::std::memory_order_relaxed);
+			}
+
+			bool wasContended()const noexcept { return contended.load(::std::memory_order_relaxed) > 0; }
+
+			//appends a line with the counters to s
+			void describe(::std::string& s, const char*const pName)const {
+				const auto acq = acquisitions.load(::std::memory_order_relaxed);
+				const auto cont = contended.load(::std::memory_order_relaxed);
+				char _buf[256];
+				sprintf_s(_buf, "%-24s acquired=%llu contended=%llu (%.3f%%) spins=%llu wait=%.3fms\n", pName
+					, static_cast<unsigned long long>(acq), static_cast<unsigned long long>(cont)
+					, acq ? 100. * static_cast<double>(cont) / static_cast<double>(acq) : 0.
+					, static_cast<unsigned long long>(spins.load(::std::memory_order_relaxed))
+					, static_cast<double>(waitNs.load(::std::memory_order_relaxed)) / 1e6);
+				s += _buf;
+			}
+		};
+
+		//atomicPod keeps a trivially copyable T as relaxed atomic words, so a seqlock reader could copy it while the writer
+		// updates it without a data race. Ordering is provided by the sequence counter and fences of the seqlock
+		template<typename T, typename WordT = ::std::uint32_t>
+		class atomicPod {
+			static_assert(::std::is_trivially_copyable<T>::value && 0 == sizeof(T) % sizeof(WordT), "T must be made of whole words");
+			static constexpr size_t _words = sizeof(T) / sizeof(WordT);
+
+			::std::atomic<WordT> m_w[_words]{};
+
+		public:
+			void store(const T& v)noexcept {
+				WordT b[_words];
+				::std::memcpy(b, &v, sizeof(T));
+				for (size_t i = 0; i < _words; ++i) m_w[i].store(b[i], ::std::memory_order_relaxed);
+			}
+			T load()const noexcept {
+				WordT b[_words];
+				for (size_t i = 0; i < _words; ++i) b[i] = m_w[i].load(::std::memory_order_relaxed);
+				T v;
+				::std::memcpy(&v, b, sizeof(T));
+				return v;
+			}
+		};
+
+		//instrumentedLock wraps a lock (anything with lock()/unlock()) counting acquisitions and, if the lock has try_lock(),
+		// contended acquisitions, spins and time spent waiting. Uncontended acquisition costs a single try_lock() as before.
+		// When the lock is busy, up to maxCountedSpins attempts are made with try_lock() and then the blocking lock() of
+		// the wrapped lock is used, so a mutex doesn't turn into a spinlock.
+		template<typename LockT>
+		class instrumentedLock {
+		public:
+			typedef LockT lock_t;
+			static constexpr unsigned maxCountedSpins = 64;
+
+		protected:
+			template<typename L, typename = void>
+			struct _hasTryLock : ::std::false_type {};
+			template<typename L>
+			struct _hasTryLock<L, ::std::void_t<decltype(::std::declval<L&>().try_lock())>> : ::std::true_type {};
+
+			LockT m_lock;
+			lockStats m_stats;
+
+		public:
+			static constexpr bool bCountsContention = _hasTryLock<LockT>::value;
+
+			void lock() {
+				if constexpr (bCountsContention) {
+					if (LIKELY(m_lock.try_lock())) {
+						lockStats::add(m_stats.acquisitions, 1);
+						return;
+					}
+					const auto t0 = ::std::chrono::steady_clock::now();
+					unsigned spins = 0;
+					bool bLocked = false;
+					while (spins < maxCountedSpins) {
+						YieldProcessor();
+						++spins;
+						if (m_lock.try_lock()) {
+							bLocked = true;
+							break;
+						}
+					}
+					if (!bLocked) m_lock.lock();
+					const auto dt = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(::std::chrono::steady_clock::now() - t0).count();
+
+					lockStats::add(m_stats.acquisitions, 1);
+					lockStats::add(m_stats.contended, 1);
+					lockStats::add(m_stats.spins, spins);
+					lockStats::add(m_stats.waitNs, static_cast<::std::uint64_t>(dt));
+				} else {
+					m_lock.lock();
+					lockStats::add(m_stats.acquisitions, 1);
+				}
+			}
+
+			template<typename L = LockT, typename = ::std::enable_if_t<_hasTryLock<L>::value>>
+			bool try_lock() {
+				if (m_lock.try_lock()) {
+					lockStats::add(m_stats.acquisitions, 1);
+					return true;
+				}
+				return false;
+			}
+
+			void unlock() {
+				m_lock.unlock();
+			}
+
+			const lockStats& stats()const noexcept { return m_stats; }
+		};
+
+	}
+}
@@ -0,0 +1,67 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "q2ami_supl.h"
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		//logRateLimiter lets at most one message per period through. It's meant to be a static object of a call site
+		// (see Q2AMI_LOG_LIMITED) that may fire once per deal or per packet, so a flood of identical errors doesn't fill
+		// the log queue. Number of suppressed messages is reported with the next message let through.
+		//Safe to use from any thread.
+		class logRateLimiter {
+		protected:
+			const ::std::uint64_t m_periodMs;
+			::std::atomic<::std::uint64_t> m_nextTick{ 0 };
+			::std::atomic<unsigned> m_suppressed{ 0 };
+
+		public:
+			explicit logRateLimiter(const ::std::uint64_t periodMs)noexcept : m_periodMs(periodMs) {}
+
+			//returns true if the message must be logged. nSuppressed is set to the number of messages skipped since
+			// the last one logged
+			bool allow(unsigned& nSuppressed)noexcept {
+				const auto now = ::GetTickCount64();
+				auto next = m_nextTick.load(::std::memory_order_relaxed);
+				if (now < next || !m_nextTick.compare_exchange_strong(next, now + m_periodMs, ::std::memory_order_relaxed)) {
+					m_suppressed.fetch_add(1, ::std::memory_order_relaxed);
+					return false;
+				}
+				nSuppressed = m_suppressed.exchange(0, ::std::memory_order_relaxed);
+				return true;
+			}
+		};
+
+	}
+}
+
+//logs a message with lgr.log(lvl, ...) at most once per periodMs from this call site.
+#define Q2AMI_LOG_LIMITED(lgr, lvl, periodMs, ...) do { \
+	static ::t18::_Q2Ami::logRateLimiter _q2ami_rl_(periodMs); \
+	unsigned _q2ami_rl_n_; \
+	if (_q2ami_rl_.allow(_q2ami_rl_n_)) { \
+		(lgr).log(lvl, __VA_ARGS__); \
+		if (UNLIKELY(_q2ami_rl_n_)) (lgr).log(lvl, "({} similar messages were suppressed since the previous one)", _q2ami_rl_n_); \
+	} \
+} while (0)
@@ -0,0 +1,219 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../t18/t18/base_filesystem.h"
+
+#include "q2ami_hist.h"
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		//adds v to a counter, that is written by a single thread only (or under a lock). Relaxed load+store costs the same
+		// as a plain increment, readers from other threads may see slightly stale values
+		inline void counterAdd(::std::atomic<::std::uint64_t>& c, const ::std::uint64_t v)noexcept {
+			c.store(c.load(::std::memory_order_relaxed) + v, ::std::memory_order_relaxed);
+		}
+
+		//counters of a ticker for monitoring. Read by any thread at any time
+		struct tickerCounters {
+			//network thread only
+			::std::atomic<::std::uint64_t> dealsReceived{ 0 };
+			//deals dropped by the time filter, of detached tickers or already processed before the restart. Network thread only
+			::std::atomic<::std::uint64_t> dealsFiltered{ 0 };
+			//copy of rawDeals.size(). Written under rawDealsLock
+			::std::atomic<::std::uint64_t> dealsStored{ 0 };
+			//copy of nextDealToProcess. Written under convLock
+			::std::atomic<::std::uint64_t> dealsConverted{ 0 };
+			//number of times Ami was notified about new deals of the ticker. Network thread only
+			::std::atomic<::std::uint64_t> notifications{ 0 };
+
+			//number of deals received, but not converted yet
+			::std::uint64_t backlog()const noexcept {
+				const auto s = dealsStored.load(::std::memory_order_relaxed);
+				const auto c = dealsConverted.load(::std::memory_order_relaxed);
+				return s > c ? s - c : 0;
+			}
+
+			void reset()noexcept {
+				dealsReceived.store(0, ::std::memory_order_relaxed);
+				dealsFiltered.store(0, ::std::memory_order_relaxed);
+				dealsStored.store(0, ::std::memory_order_relaxed);
+				dealsConverted.store(0, ::std::memory_order_relaxed);
+				notifications.store(0, ::std::memory_order_relaxed);
+			}
+		};
+
+		//plugin wide counters for monitoring
+		struct pluginCounters {
+			//network thread only
+			::std::atomic<::std::uint64_t> packets{ 0 }, deals{ 0 }, dealBytes{ 0 }, notifications{ 0 };
+			//::GetTickCount64() when the last packet of deals was received. Network thread only
+			::std::atomic<::std::uint64_t> lastPacketTick{ 0 };
+			//GetQuotesEx() calls, Ami may call it from several threads at once
+			::std::atomic<::std::uint64_t> getQuotesNs{ 0 };
+			latencyHist getQuotesUs;
+			//GetQuotesEx() calls, that found the ticker being converted by another thread and returned without waiting
+			::std::atomic<::std::uint64_t> getQuotesBusy{ 0 };
+
+			void recordGetQuotes(const ::std::uint64_t ns)noexcept {
+				getQuotesNs.fetch_add(ns, ::std::memory_order_relaxed);
+				getQuotesUs.record(ns / 1000);
+			}
+
+			void reset()noexcept {
+				packets.store(0, ::std::memory_order_relaxed);
+				deals.store(0, ::std::memory_order_relaxed);
+				dealBytes.store(0, ::std::memory_order_relaxed);
+				notifications.store(0, ::std::memory_order_relaxed);
+				lastPacketTick.store(0, ::std::memory_order_relaxed);
+				getQuotesNs.store(0, ::std::memory_order_relaxed);
+				getQuotesUs.reset();
+				getQuotesBusy.store(0, ::std::memory_order_relaxed);
+			}
+		};
+
+		//measures the time since creation till the end of the scope
+		class scopedDuration {
+		protected:
+			pluginCounters& m_c;
+			const ::std::chrono::steady_clock::time_point m_start;
+
+		public:
+			explicit scopedDuration(pluginCounters& c)noexcept : m_c(c), m_start(::std::chrono::steady_clock::now()) {}
+			~scopedDuration() {
+				m_c.recordGetQuotes(static_cast<::std::uint64_t>(::std::chrono::duration_cast<::std::chrono::nanoseconds>(
+					::std::chrono::steady_clock::now() - m_start).count()));
+			}
+		};
+
+		//helps to format metrics in Prometheus text exposition format
+		class promText {
+		protected:
+			::std::string& m_s;
+
+		public:
+			explicit promText(::std::string& s)noexcept : m_s(s) {}
+
+			//HELP and TYPE lines must precede samples of a metric
+			void family(const char*const pName, const char*const pType, const char*const pHelp) {
+				m_s += "# HELP "; m_s += pName; m_s += ' '; m_s += pHelp;
+				m_s += "\n# TYPE "; m_s += pName; m_s += ' '; m_s += pType; m_s += '\n';
+			}
+
+			//labels must be already formatted, see label()
+			void sample(const char*const pName, const ::std::uint64_t v, const ::std::string& labels = ::std::string()) {
+				_name(pName, labels);
+				m_s += ::std::to_string(v);
+				m_s += '\n';
+			}
+			void sample(const char*const pName, const double v, const ::std::string& labels = ::std::string()) {
+				_name(pName, labels);
+				char _buf[32];
+				sprintf_s(_buf, "%.9g\n", v);
+				m_s += _buf;
+			}
+
+			//appends name="value" pair to labels escaping the value
+			static void label(::std::string& labels, const char*const pName, const ::std::string& val) {
+				if (!labels.empty()) labels += ',';
+				labels += pName;
+				labels += "=\"";
+				for (const char c : val) {
+					if ('\\' == c || '"' == c) labels += '\\';
+					labels += c;
+				}
+				labels += '"';
+			}
+
+		protected:
+			void _name(const char*const pName, const ::std::string& labels) {
+				m_s += pName;
+				if (!labels.empty()) {
+					m_s += '{'; m_s += labels; m_s += '}';
+				}
+				m_s += ' ';
+			}
+		};
+
+		//periodicFileWriter calls make(::std::string&) from a dedicated low priority thread once in a period and replaces
+		// the file with the result. The file is written to a temporary one first, so readers never see it half written.
+		class periodicFileWriter {
+		protected:
+			::std::thread m_thread;
+			::std::mutex m_mtx;
+			::std::condition_variable m_cv;
+			bool m_bStop{ false };
+			unsigned m_periodSec{ 0 };
+
+		public:
+			~periodicFileWriter() {
+				stop();
+			}
+
+			bool isRunning()const noexcept { return m_thread.joinable(); }
+			unsigned periodSec()const noexcept { return m_periodSec; }
+
+			//make must be safe to call from any thread until stop() returns
+			void start(::std::string fpath, const unsigned periodSec, ::std::function<void(::std::string&)> make) {
+				T18_ASSERT(!isRunning() && periodSec > 0 && make);
+				m_bStop = false;
+				m_periodSec = periodSec;
+				m_thread = ::std::thread([this, fpath{ ::std::move(fpath) }, periodSec, make{ ::std::move(make) }]() {
+					::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+					const auto tmpPath = fpath + ".tmp";
+					::std::string buf;
+					::std::unique_lock<::std::mutex> lk(m_mtx);
+					while (!m_cv.wait_for(lk, ::std::chrono::seconds(periodSec), [this]() { return m_bStop; })) {
+						lk.unlock();
+						buf.clear();
+						make(buf);
+						if (writeFile(tmpPath, buf)) ::MoveFileExA(tmpPath.c_str(), fpath.c_str(), MOVEFILE_REPLACE_EXISTING);
+						lk.lock();
+					}
+				});
+			}
+
+			void stop() {
+				if (!isRunning()) return;
+				{
+					::std::lock_guard<::std::mutex> lk(m_mtx);
+					m_bStop = true;
+				}
+				m_cv.notify_one();
+				m_thread.join();
+			}
+
+			static bool writeFile(const ::std::string& fpath, const ::std::string& s) {
+				utils::myFile hF(fpath.c_str(), "wb");
+				return hF && s.length() == fwrite(s.data(), 1, s.length(), hF);
+			}
+		};
+
+	}
+}
@@ -0,0 +1,200 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+//The plugin itself is Windows only, but the engine (config, converters, network handlers and GetQuotesEx()) doesn't
+// depend on anything but a handful of WinAPI and MS CRT functions. This file provides them on other platforms, so the
+// engine compiles there for the benchmark harness (see bench/). It's included by stdafx.h instead of Windows.h.
+//Only what the engine uses is defined and only to the extent it's used.
+
+#ifdef _WIN32
+#error "q2ami_platform.h must not be used on Windows, include Windows.h instead"
+#endif
+
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//////////////////////////////////////////////////////////////////////////
+//compiler
+#ifndef _MSC_VER
+#define __int64 long long
+#define __declspec(x)
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//types and constants
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef unsigned long DWORD;
+typedef void* HWND;
+typedef void* HANDLE;
+typedef const char* LPCTSTR;
+typedef ::std::uintptr_t WPARAM;
+typedef ::std::intptr_t LPARAM;
+typedef DWORD COLORREF;
+
+#define RGB(r, g, b) (static_cast<COLORREF>(static_cast<::std::uint8_t>(r)) | (static_cast<COLORREF>(static_cast<::std::uint8_t>(g)) << 8) \
+	| (static_cast<COLORREF>(static_cast<::std::uint8_t>(b)) << 16))
+
+#define WM_USER 0x0400
+#define MAX_PATH 260
+#define INVALID_HANDLE_VALUE (reinterpret_cast<HANDLE>(static_cast<::std::intptr_t>(-1)))
+
+#define MB_OK 0x0u
+#define MB_ICONERROR 0x10u
+#define MB_ICONWARNING 0x30u
+
+#define GENERIC_READ 0x80000000ul
+#define GENERIC_WRITE 0x40000000ul
+#define OPEN_ALWAYS 4ul
+#define FILE_ATTRIBUTE_NORMAL 0x80ul
+#define FILE_FLAG_WRITE_THROUGH 0x80000000ul
+#define FILE_FLAG_NO_BUFFERING 0x20000000ul
+#define MOVEFILE_REPLACE_EXISTING 0x1ul
+#define THREAD_PRIORITY_LOWEST (-2)
+#define GetFileExInfoStandard 0
+
+#define _TRUNCATE (static_cast<size_t>(-1))
+
+struct FILETIME {
+	DWORD dwLowDateTime, dwHighDateTime;
+};
+struct WIN32_FILE_ATTRIBUTE_DATA {
+	DWORD dwFileAttributes;
+	FILETIME ftCreationTime, ftLastAccessTime, ftLastWriteTime;
+	DWORD nFileSizeHigh, nFileSizeLow;
+};
+
+namespace q2ami_platform {
+	//PostMessage() passes messages to this function, so a host (like bench/mock_ami.h) could receive Ami notifications
+	typedef void(*postMessageSink_t)(HWND, UINT, WPARAM, LPARAM);
+	inline postMessageSink_t& postMessageSink()noexcept {
+		static postMessageSink_t p = nullptr;
+		return p;
+	}
+
+	inline HANDLE fd2handle(const int fd)noexcept { return reinterpret_cast<HANDLE>(static_cast<::std::intptr_t>(fd)); }
+	inline int handle2fd(const HANDLE h)noexcept { return static_cast<int>(reinterpret_cast<::std::intptr_t>(h)); }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//WinAPI
+inline ::std::uint64_t GetTickCount64()noexcept {
+	return static_cast<::std::uint64_t>(::std::chrono::duration_cast<::std::chrono::milliseconds>(
+		::std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+inline DWORD GetLastError()noexcept { return static_cast<DWORD>(errno); }
+
+inline void YieldProcessor()noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+inline HANDLE GetCurrentThread()noexcept { return nullptr; }
+inline BOOL SetThreadPriority(HANDLE, int)noexcept { return 1; }
+
+inline BOOL PostMessage(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp) {
+	if (const auto f = q2ami_platform::postMessageSink()) f(hWnd, msg, wp, lp);
+	return 1;
+}
+inline int MessageBoxA(HWND, const char* pText, const char* pCaption, UINT) {
+	::std::fprintf(stderr, "%s: %s\n", pCaption, pText);
+	return 1;
+}
+#define MessageBox MessageBoxA
+inline void OutputDebugStringA(const char* p) { ::std::fputs(p, stderr); }
+
+//exclusive (non shared) open is emulated with an advisory lock, that's all _acquireDbLock() needs
+inline HANDLE CreateFileA(const char* pPath, DWORD, DWORD, void*, DWORD, DWORD, void*) {
+	const int fd = ::open(pPath, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) return INVALID_HANDLE_VALUE;
+	if (::flock(fd, LOCK_EX | LOCK_NB)) {
+		::close(fd);
+		return INVALID_HANDLE_VALUE;
+	}
+	return q2ami_platform::fd2handle(fd);
+}
+#define CreateFile CreateFileA
+inline BOOL CloseHandle(HANDLE h) { return 0 == ::close(q2ami_platform::handle2fd(h)); }
+
+inline BOOL MoveFileExA(const char* pFrom, const char* pTo, DWORD) { return 0 == ::rename(pFrom, pTo); }
+inline BOOL DeleteFileA(const char* p) { return 0 == ::unlink(p); }
+
+inline BOOL GetFileAttributesExA(const char* p, int, WIN32_FILE_ATTRIBUTE_DATA* pD) {
+	struct stat st;
+	if (::stat(p, &st)) return 0;
+	::std::memset(pD, 0, sizeof(*pD));
+	//only change detection is needed, so the epoch and resolution doesn't matter
+	const auto t = static_cast<::std::uint64_t>(st.st_mtim.tv_sec) * 10000000u + static_cast<::std::uint64_t>(st.st_mtim.tv_nsec) / 100;
+	pD->ftLastWriteTime.dwLowDateTime = static_cast<DWORD>(t & 0xffffffffu);
+	pD->ftLastWriteTime.dwHighDateTime = static_cast<DWORD>(t >> 32);
+	pD->nFileSizeLow = static_cast<DWORD>(st.st_size);
+	return 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//MS CRT "secure" functions. Unlike the originals, they truncate instead of calling the invalid parameter handler
+inline int sprintf_s(char* pBuf, const size_t n, const char* pFmt, ...) {
+	va_list ap;
+	va_start(ap, pFmt);
+	const int r = ::std::vsnprintf(pBuf, n, pFmt, ap);
+	va_end(ap);
+	return r;
+}
+template<size_t N>
+inline int sprintf_s(char (&buf)[N], const char* pFmt, ...) {
+	va_list ap;
+	va_start(ap, pFmt);
+	const int r = ::std::vsnprintf(buf, N, pFmt, ap);
+	va_end(ap);
+	return r;
+}
+template<size_t N>
+inline int strcpy_s(char (&dest)[N], const char* pSrc)noexcept {
+	const auto l = ::std::min(::std::strlen(pSrc), N - 1);
+	::std::memcpy(dest, pSrc, l);
+	dest[l] = 0;
+	return 0;
+}
+template<size_t N>
+inline int strncat_s(char (&dest)[N], const char* pSrc, const size_t cnt)noexcept {
+	const auto dl = ::strnlen(dest, N);
+	if (dl >= N) return EINVAL;
+	const auto l = ::std::min({ ::std::strlen(pSrc), cnt, N - 1 - dl });
+	::std::memcpy(dest + dl, pSrc, l);
+	dest[dl + l] = 0;
+	return 0;
+}
+template<size_t N>
+inline int strcat_s(char (&dest)[N], const char* pSrc)noexcept {
+	return strncat_s(dest, pSrc, _TRUNCATE);
+}
+inline char* strtok_s(char* pStr, const char* pDelim, char** pCtx)noexcept {
+	return ::strtok_r(pStr, pDelim, pCtx);
+}
@@ -0,0 +1,194 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "q2ami_supl.h"
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		//requestTracker matches responses of the server to requests sent with qcli_t::post_packet(). The protocol has no
+		// request ids, a response is identified only by its key (e.g. "ticker@class" for queryTickerInfo), so the tracker
+		// assigns local ids to requests and gives a response to the oldest pending request waiting for its key. A request
+		// may wait for many keys (like a queryTickerInfo for a list of tickers) and completes once every key was answered,
+		// or when it's cancelled (on a timeout or a disconnection) with responses received so far.
+		//The result of a request is obtained either from a future, or from a callback called by the thread that completed
+		// the request (usually the network thread), so any number of requests could be outstanding at once and the caller
+		// doesn't have to block. Register a request before posting it, or the response may come first.
+		//Thread safe. LockT is anything with lock()/unlock(), e.g. instrumentedLock<::std::mutex>
+		template<typename KeyT, typename ValueT, typename LockT = ::std::mutex>
+		class requestTracker {
+		public:
+			typedef ::std::uint64_t requestId_t;
+
+			struct result_t {
+				requestId_t id{ 0 };
+				//responses in the order of arrival
+				::std::vector<ValueT> values;
+				//number of keys that weren't answered. Non zero only for cancelled requests
+				size_t nMissing{ 0 };
+
+				bool complete()const noexcept { return 0 == nMissing; }
+			};
+			typedef ::std::future<result_t> future_t;
+			typedef ::std::function<void(result_t&&)> callback_t;
+
+		protected:
+			struct request {
+				result_t res;
+				::std::promise<result_t> promise;
+				//if set, it's called instead of fulfilling the promise
+				callback_t cb;
+			};
+
+			mutable LockT m_lock;
+			requestId_t m_lastId{ 0 };
+			::std::unordered_map<requestId_t, request> m_requests;
+			//ids of requests waiting for the key, the oldest first
+			::std::unordered_map<KeyT, ::std::deque<requestId_t>> m_waiting;
+
+			typedef ::std::unique_lock<LockT> lock_guard_t;
+
+			requestId_t _add(const ::std::vector<KeyT>& keys, request&& r) {
+				lock_guard_t lk(m_lock);
+				const auto id = ++m_lastId;
+				r.res.id = id;
+				r.res.nMissing = keys.size();
+				r.res.values.reserve(keys.size());
+				for (const auto& k : keys) m_waiting[k].push_back(id);
+				m_requests.emplace(id, ::std::move(r));
+				return id;
+			}
+
+			//must be called without the lock held
+			static void _finish(request&& r) {
+				if (r.cb) {
+					r.cb(::std::move(r.res));
+				} else r.promise.set_value(::std::move(r.res));
+			}
+
+			//removes the request and every key it still waits for. Must be called under the lock
+			request _extract(const typename decltype(m_requests)::iterator it) {
+				request r = ::std::move(it->second);
+				m_requests.erase(it);
+				if (r.res.nMissing > 0) {
+					for (auto wit = m_waiting.begin(); wit != m_waiting.end();) {
+						auto& q = wit->second;
+						q.erase(::std::remove(q.begin(), q.end(), r.res.id), q.end());
+						if (q.empty()) {
+							wit = m_waiting.erase(wit);
+						} else ++wit;
+					}
+				}
+				return r;
+			}
+
+		public:
+			//registers a request waiting for a response for every key (a key repeated n times needs n responses).
+			// Returns its id and the future of its result. A request without keys is completed at once
+			::std::pair<requestId_t, future_t> add(const ::std::vector<KeyT>& keys) {
+				request r;
+				auto f = r.promise.get_future();
+				const auto id = _add(keys, ::std::move(r));
+				if (keys.empty()) cancel(id);
+				return { id, ::std::move(f) };
+			}
+
+			//the same, but the result is passed to cb, called by the thread that completes the request. cb must not
+			// call the tracker
+			requestId_t add(const ::std::vector<KeyT>& keys, callback_t cb) {
+				T18_ASSERT(cb);
+				request r;
+				r.cb = ::std::move(cb);
+				const auto id = _add(keys, ::std::move(r));
+				if (keys.empty()) cancel(id);
+				return id;
+			}
+
+			//gives the response to the oldest pending request waiting for the key. Returns false if there's no such request,
+			// i.e. the response wasn't requested or came after the request was cancelled
+			bool respond(const KeyT& key, ValueT&& v) {
+				request done;
+				{
+					lock_guard_t lk(m_lock);
+					const auto wit = m_waiting.find(key);
+					if (wit == m_waiting.end()) return false;
+					const auto id = wit->second.front();
+					wit->second.pop_front();
+					if (wit->second.empty()) m_waiting.erase(wit);
+
+					const auto it = m_requests.find(id);
+					T18_ASSERT(it != m_requests.end());
+					auto& res = it->second.res;
+					res.values.emplace_back(::std::move(v));
+					T18_ASSERT(res.nMissing > 0);
+					if (--res.nMissing > 0) return true;
+					done = _extract(it);
+				}
+				_finish(::std::move(done));
+				return true;
+			}
+
+			//completes the request with responses received so far. Returns false if the request is already completed
+			bool cancel(const requestId_t id) {
+				request done;
+				{
+					lock_guard_t lk(m_lock);
+					const auto it = m_requests.find(id);
+					if (it == m_requests.end()) return false;
+					done = _extract(it);
+				}
+				_finish(::std::move(done));
+				return true;
+			}
+
+			//cancels every pending request, e.g. when the connection is lost and no responses will come
+			size_t cancelAll() {
+				::std::vector<request> done;
+				{
+					lock_guard_t lk(m_lock);
+					done.reserve(m_requests.size());
+					for (auto& e : m_requests) done.emplace_back(::std::move(e.second));
+					m_requests.clear();
+					m_waiting.clear();
+				}
+				for (auto& r : done) _finish(::std::move(r));
+				return done.size();
+			}
+
+			size_t pending()const {
+				lock_guard_t lk(m_lock);
+				return m_requests.size();
+			}
+
+			const LockT& lock()const noexcept { return m_lock; }
+		};
+
+	}
+}
@@ -0,0 +1,223 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <vector>
+#include <memory>
+
+#include "q2ami_state.h"
+#include "q2ami_locks.h"
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		static constexpr size_t cacheLineSize = 64;
+
+		//RTInfo holds the data of a ticker for Ami's real-time quote window (RecentInfo structure).
+		//The data is updated by the network thread on each deal into a private working copy and then published once per
+		// received packet with a seqlock, so Ami's UI thread reads a consistent snapshot without ever blocking the network thread.
+		//Objects are allocated by RTInfoPool. Writer-only and shared parts live on different cache lines, so per deal updates
+		// don't disturb readers.
+		class alignas(cacheLineSize) RTInfo {
+		public:
+			struct data_t {
+				float fOpen, fHigh, fLow, fLast, fPrev, fChange;
+				float fTradeVol, fTotalVol;
+				int nDateChange, nTimeChange;//YYYYMMDD, HHMMSS
+				int nDateUpdate, nTimeUpdate;
+				int nBitmap, nStatus;
+			};
+
+		protected:
+			//these are used by the network thread only
+			data_t m_work;
+			int m_dayKey{ 0 };
+			//set once a live deal is received after the subscription, see onDeal()
+			bool m_bLive{ false };
+
+			//odd value means the writer is updating m_pub
+			alignas(cacheLineSize) ::std::atomic<unsigned> m_seq{ 0 };
+			atomicPod<data_t> m_pub;
+
+		public:
+			RTInfo()noexcept {
+				::std::memset(&m_work, 0, sizeof(m_work));
+				//backfill isn't complete until the first live deal is received
+				m_work.nStatus = RI_STATUS_INCOMPLETE;
+				m_pub.store(m_work);
+			}
+
+			//network thread must not be running for the following functions
+			void reset()noexcept {
+				::std::memset(&m_work, 0, sizeof(m_work));
+				m_work.nStatus = RI_STATUS_INCOMPLETE;
+				m_dayKey = 0;
+				m_bLive = false;
+				publish();
+			}
+			void saveState(stateWriter& w)const {
+				w.pod(m_work);
+				w.pod(m_dayKey);
+			}
+			bool loadState(stateReader& r)noexcept {
+				data_t d;
+				int dk;
+				if (!r.pod(d) || !r.pod(dk)) return false;
+				m_work = d;
+				m_dayKey = dk;
+				//deals since the checkpoint are to be received again
+				m_work.nStatus |= RI_STATUS_INCOMPLETE;
+				m_bLive = false;
+				publish();
+				return true;
+			}
+
+			//network thread only. The server sends deals since the requested time after the subscription is answered,
+			// so the backfill is incomplete until then and until the first live deal is received
+			void onSubscribed()noexcept {
+				m_bLive = false;
+				m_work.nStatus |= RI_STATUS_INCOMPLETE;
+				publish();
+			}
+
+			//network thread only. bLive must be set if the deal is a fresh one and not a part of the backfill
+			void onDeal(const proxy::prxyTsDeal& tsd, const proxy::volume_lots_t lotSize, const bool bLive)noexcept {
+				const mxTimestamp ts = tsd.ts;
+				const int dayKey = ts.Year() * 10000 + ts.Month() * 100 + ts.Day();
+				const int timeKey = ts.Hour() * 10000 + ts.Minute() * 100 + ts.Second();
+				const auto pr = static_cast<float>(tsd.pr);
+				const auto vl = static_cast<float>(tsd.volLots*lotSize);
+
+				auto& w = m_work;
+				if (UNLIKELY(dayKey != m_dayKey)) {
+					if (m_dayKey) {
+						w.fPrev = w.fLast;
+						w.nBitmap |= RI_PREVCHANGE;
+					}
+					m_dayKey = dayKey;
+					w.fOpen = w.fHigh = w.fLow = pr;
+					w.fTotalVol = 0;
+				} else {
+					if (pr > w.fHigh) w.fHigh = pr;
+					if (pr < w.fLow) w.fLow = pr;
+				}
+
+				w.nDateChange = dayKey;
+				w.nTimeChange = timeKey;
+				if (pr != w.fLast) {
+					w.nDateUpdate = dayKey;
+					w.nTimeUpdate = timeKey;
+				}
+
+				w.fLast = pr;
+				w.fChange = (w.nBitmap & RI_PREVCHANGE) ? pr - w.fPrev : 0;
+				w.fTradeVol = vl;
+				w.fTotalVol += vl;
+
+				w.nBitmap |= RI_LAST | RI_OPEN | RI_HIGHLOW | RI_TRADEVOL | RI_TOTALVOL | RI_DATEUPDATE | RI_DATECHANGE;
+				// STATUS FIELD MUST BE CORRECT !
+				m_bLive = m_bLive || bLive;
+				w.nStatus = RI_STATUS_UPDATE | RI_STATUS_TRADE | RI_STATUS_BARSREADY | (m_bLive ? 0 : RI_STATUS_INCOMPLETE);
+			}
+
+			//network thread only. Makes changes done with onDeal() visible to readers
+			void publish()noexcept {
+				const auto s = m_seq.load(::std::memory_order_relaxed);
+				m_seq.store(s + 1, ::std::memory_order_relaxed);
+				::std::atomic_thread_fence(::std::memory_order_release);
+				m_pub.store(m_work);
+				m_seq.store(s + 2, ::std::memory_order_release);
+			}
+
+			//safe to call from any thread
+			data_t read()const noexcept {
+				data_t d;
+				while (true) {
+					const auto s1 = m_seq.load(::std::memory_order_acquire);
+					if (LIKELY(0 == (s1 & 1))) {
+						d = m_pub.load();
+						::std::atomic_thread_fence(::std::memory_order_acquire);
+						if (LIKELY(s1 == m_seq.load(::std::memory_order_relaxed))) break;
+					}
+					::std::this_thread::yield();
+				}
+				return d;
+			}
+
+			//fills data fields of ri with the latest published snapshot. Name and Exchange fields aren't touched
+			void fill(RecentInfo& ri)const noexcept {
+				const auto d = read();
+				ri.nStructSize = static_cast<int>(sizeof(RecentInfo));
+				ri.nStatus = d.nStatus;
+				ri.nBitmap = d.nBitmap;
+				ri.fOpen = d.fOpen;
+				ri.fHigh = d.fHigh;
+				ri.fLow = d.fLow;
+				ri.fLast = d.fLast;
+				ri.fPrev = d.fPrev;
+				ri.fChange = d.fChange;
+				ri.fTradeVol = d.fTradeVol;
+				ri.fTotalVol = d.fTotalVol;
+				ri.iTradeVol = static_cast<int>(d.fTradeVol);
+				ri.iTotalVol = static_cast<int>(d.fTotalVol);
+				ri.nDateChange = d.nDateChange;
+				ri.nTimeChange = d.nTimeChange;
+				ri.nDateUpdate = d.nDateUpdate;
+				ri.nTimeUpdate = d.nTimeUpdate;
+			}
+		};
+
+		//RTInfoPool preallocates RTInfo records for all configured tickers in a single contiguous chunk at DB load. If more
+		// records are needed later, a new chunk is allocated, so pointers to records are never invalidated until clear().
+		class RTInfoPool {
+		protected:
+			static constexpr size_t _minChunkSize = 16;
+
+			::std::vector<::std::unique_ptr<RTInfo[]>> m_chunks;
+			size_t m_lastChunkSize{ 0 }, m_lastChunkUsed{ 0 };
+
+		public:
+			//makes sure at least n records could be acquired without further allocations
+			void reserve(const size_t n) {
+				if (m_lastChunkSize - m_lastChunkUsed < n) {
+					const auto sz = ::std::max(n, _minChunkSize);
+					m_chunks.emplace_back(::std::make_unique<RTInfo[]>(sz));
+					m_lastChunkSize = sz;
+					m_lastChunkUsed = 0;
+				}
+			}
+
+			RTInfo* acquire() {
+				if (UNLIKELY(m_lastChunkUsed >= m_lastChunkSize)) reserve(m_lastChunkSize);
+				T18_ASSERT(!m_chunks.empty() && m_lastChunkUsed < m_lastChunkSize);
+				return &m_chunks.back()[m_lastChunkUsed++];
+			}
+
+			//everything that uses acquired records must be destroyed first
+			void clear()noexcept {
+				m_chunks.clear();
+				m_lastChunkSize = m_lastChunkUsed = 0;
+			}
+		};
+
+	}
+}
@@ -0,0 +1,129 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <type_traits>
+
+#include "q2ami_supl.h"
+
+namespace t18 {
+	namespace _Q2Ami {
+
+		//stateWriter and stateReader (de)serialize incremental state of converters and tickers for the checkpoint file,
+		// that is written on DB unload and read on DB load (see Q2Ami::_saveCheckpoint()). The format is plain binary
+		// for the same build, so only trivially copyable types could be written as is.
+		class stateWriter {
+		protected:
+			::std::string& m_buf;
+
+		public:
+			explicit stateWriter(::std::string& b)noexcept : m_buf(b) {}
+
+			template<typename T>
+			void pod(const T& v) {
+				static_assert(::std::is_trivially_copyable<T>::value, "");
+				m_buf.append(reinterpret_cast<const char*>(&v), sizeof(T));
+			}
+
+			//timestamps are stored as AmiDate, empty timestamp is stored as a flag only
+			void ts(const mxTimestamp t) {
+				const ::std::uint8_t bEmpty = t.empty() ? 1 : 0;
+				pod(bEmpty);
+				if (!bEmpty) pod(timestamp2AmiDate(t).Date);
+			}
+
+			void str(const ::std::string& s) {
+				pod(static_cast<::std::uint32_t>(s.length()));
+				m_buf.append(s);
+			}
+
+			//writes length of the data written by f() before the data, so a reader could skip it
+			template<typename F>
+			void block(F&& f) {
+				const auto pos = m_buf.length();
+				pod(::std::uint32_t(0));
+				f(*this);
+				const auto len = static_cast<::std::uint32_t>(m_buf.length() - pos - sizeof(::std::uint32_t));
+				::std::memcpy(&m_buf[pos], &len, sizeof(len));
+			}
+		};
+
+		//every read function returns false if there's not enough data. Once failed, reader stays failed.
+		class stateReader {
+		protected:
+			const char* m_p;
+			const char* m_pEnd;
+			bool m_bOk{ true };
+
+		public:
+			stateReader(const char*const p, const size_t len)noexcept : m_p(p), m_pEnd(p + len) {}
+
+			bool good()const noexcept { return m_bOk; }
+			bool eof()const noexcept { return m_p >= m_pEnd; }
+
+			template<typename T>
+			bool pod(T& v)noexcept {
+				static_assert(::std::is_trivially_copyable<T>::value, "");
+				if (UNLIKELY(!m_bOk || static_cast<size_t>(m_pEnd - m_p) < sizeof(T))) return m_bOk = false;
+				::std::memcpy(&v, m_p, sizeof(T));
+				m_p += sizeof(T);
+				return true;
+			}
+
+			bool ts(mxTimestamp& t)noexcept {
+				::std::uint8_t bEmpty;
+				if (!pod(bEmpty)) return false;
+				if (bEmpty) {
+					t.clear();
+				} else {
+					AmiDate ad;
+					if (!pod(ad.Date)) return false;
+					t = AmiDate2Timestamp(ad);
+				}
+				return true;
+			}
+
+			bool str(::std::string& s) {
+				::std::uint32_t len;
+				if (!pod(len)) return false;
+				if (UNLIKELY(static_cast<size_t>(m_pEnd - m_p) < len)) return m_bOk = false;
+				s.assign(m_p, len);
+				m_p += len;
+				return true;
+			}
+
+			//returns reader of a block written with stateWriter::block() and skips it in this reader
+			stateReader block()noexcept {
+				::std::uint32_t len;
+				if (!pod(len) || static_cast<size_t>(m_pEnd - m_p) < len) {
+					m_bOk = false;
+					stateReader r(m_p, 0);
+					r.m_bOk = false;
+					return r;
+				}
+				stateReader r(m_p, len);
+				m_p += len;
+				return r;
+			}
+		};
+
+	}
+}
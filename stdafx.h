@@ -35,11 +35,16 @@
 //no need to automatically link boost libs
 #define BOOST_ALL_NO_LIB
 
+#ifdef _WIN32
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 // Windows Header Files:
 #include <Windows.h>
+#else
+//the engine only, see bench/
+#include "q2ami_platform.h"
+#endif
 
 #include <string>
 #include <memory>
@@ -0,0 +1,174 @@
+/*
+    This file is a part of Q2Ami project (AmiBroker data-source plugin to fetch
+    data from QUIK terminal over the net; requires https://github.com/Arech/t18qsrv)
+    Copyright (C) 2019, Arech (aradvert@gmail.com; https://github.com/Arech)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+//Offline decoder of flight recorder dumps (flight.bin, see q2ami_flight.h) to Chrome trace event JSON, that can be
+// opened with chrome://tracing or https://ui.perfetto.dev
+//Standalone, build with any C++17 compiler, for example:
+//	cl /EHsc /std:c++17 /O2 flight2trace.cpp
+//	g++ -std=c++17 -O2 -o flight2trace flight2trace.cpp
+//Usage: flight2trace flight.bin [trace.json]
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <cstdio>
+#include <map>
+
+#include "../q2ami_flight.h"
+
+using namespace ::t18::_Q2Ami;
+
+namespace {
+
+	struct file_closer {
+		void operator()(::std::FILE* f)const noexcept { ::std::fclose(f); }
+	};
+	typedef ::std::unique_ptr<::std::FILE, file_closer> file_t;
+
+	bool readAll(::std::FILE* f, void* p, const size_t n) {
+		return n == ::std::fread(p, 1, n, f);
+	}
+
+	void jsonString(::std::string& s, const ::std::string& v) {
+		s += '"';
+		for (const char c : v) {
+			if ('"' == c || '\\' == c) s += '\\';
+			if (static_cast<unsigned char>(c) >= 0x20) s += c;
+		}
+		s += '"';
+	}
+
+	//names of a and b arguments of events
+	const char* argNames[flightEvent::_evCount][2] = {
+		{ "a", "b" }
+		, { "deals", nullptr }
+		, { "dealsInMemory", nullptr }
+		, { "nLastValid", "nSize" }
+		, { "ret", nullptr }
+		, { "firstDeal", "deals" }
+		, { "nLastValid", "shift" }
+		, { "connected", nullptr }
+		, { "exists", nullptr }
+		, { "idx", "nLastValid" }
+		, { "nLastValid", "nSize" }
+	};
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		::std::fprintf(stderr, "Usage: %s flight.bin [trace.json]\n", argv[0]);
+		return 1;
+	}
+
+	file_t in(::std::fopen(argv[1], "rb"));
+	if (!in) {
+		::std::fprintf(stderr, "Failed to open %s\n", argv[1]);
+		return 1;
+	}
+
+	flightRecorder::fileHeader h;
+	if (!readAll(in.get(), &h, sizeof(h)) || flightRecorder::fileMagic != h.magic) {
+		::std::fprintf(stderr, "%s is not a flight recorder dump\n", argv[1]);
+		return 1;
+	}
+	if (flightRecorder::fileVersion != h.version) {
+		::std::fprintf(stderr, "Unsupported dump version %u, expected %u\n", h.version, flightRecorder::fileVersion);
+		return 1;
+	}
+
+	::std::vector<flightEvent> ev(h.eventsCnt);
+	if (h.eventsCnt && !readAll(in.get(), ev.data(), ev.size() * sizeof(flightEvent))) {
+		::std::fprintf(stderr, "Truncated dump, failed to read %u events\n", h.eventsCnt);
+		return 1;
+	}
+
+	::std::map<::std::uint16_t, ::std::string> names;
+	for (::std::uint32_t i = 0; i < h.namesCnt; ++i) {
+		::std::uint16_t tid;
+		::std::uint8_t len;
+		char buf[256];
+		if (!readAll(in.get(), &tid, sizeof(tid)) || !readAll(in.get(), &len, sizeof(len)) || !readAll(in.get(), buf, len)) {
+			::std::fprintf(stderr, "Truncated dump, failed to read names of tickers\n");
+			return 1;
+		}
+		names[tid] = ::std::string(buf, len);
+	}
+	in.reset();
+
+	const auto tickerName = [&names](const ::std::uint16_t tid) {
+		if (flightRecorder::noTid == tid) return ::std::string();
+		const auto it = names.find(tid);
+		return it == names.end() ? "tid=" + ::std::to_string(tid) : it->second;
+	};
+
+	//timestamps are microseconds since the first event. Absolute time of the first event is in otherData
+	const ::std::uint64_t baseNs = ev.empty() ? h.dumpNs : ev.front().ns;
+	const auto baseUnixUs = h.dumpUnixUs - static_cast<::std::int64_t>((h.dumpNs - baseNs) / 1000);
+
+	::std::string s;
+	s.reserve(ev.size() * 128 + 256);
+	s += "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"firstEventUnixUs\":";
+	s += ::std::to_string(baseUnixUs);
+	s += "},\"traceEvents\":[\n";
+
+	char buf[128];
+	bool bFirst = true;
+	for (const auto& e : ev) {
+		if (e.type >= flightEvent::_evCount || flightEvent::evNone == e.type) continue;
+		if (!bFirst) s += ",\n";
+		bFirst = false;
+
+		const auto tn = tickerName(e.tid);
+		s += "{\"name\":";
+		jsonString(s, tn.empty() ? ::std::string(flightEvent::typeNames[e.type]) : ::std::string(flightEvent::typeNames[e.type]) + " " + tn);
+
+		const char* ph = "i";
+		if (flightEvent::evGetQuotesEnter == e.type) ph = "B";
+		else if (flightEvent::evGetQuotesExit == e.type) ph = "E";
+		::std::snprintf(buf, sizeof(buf), ",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", ph
+			, static_cast<double>(e.ns - baseNs) / 1000., e.thread);
+		s += buf;
+		if ('i' == *ph) s += ",\"s\":\"t\"";
+
+		s += ",\"args\":{";
+		const auto& an = argNames[e.type];
+		::std::snprintf(buf, sizeof(buf), "\"%s\":%d", an[0], e.a);
+		s += buf;
+		if (an[1]) {
+			::std::snprintf(buf, sizeof(buf), ",\"%s\":%d", an[1], e.b);
+			s += buf;
+		}
+		s += "}}";
+	}
+	s += "\n]}\n";
+
+	file_t out(argc > 2 ? ::std::fopen(argv[2], "w") : nullptr);
+	if (argc > 2 && !out) {
+		::std::fprintf(stderr, "Failed to create %s\n", argv[2]);
+		return 1;
+	}
+	::std::FILE* const f = out ? out.get() : stdout;
+	if (s.length() != ::std::fwrite(s.data(), 1, s.length(), f)) {
+		::std::fprintf(stderr, "Failed to write the trace\n");
+		return 1;
+	}
+	::std::fprintf(stderr, "%zu events decoded\n", ev.size());
+	return 0;
+}